@@ -0,0 +1,77 @@
+#include "arena.h"
+
+bool StrView::EqualsIgnoreCase(const StrView& s) const {
+    if(len != s.len) { return false; }
+    for(size_t i = 0; i < len; i++) {
+        // 只有字母需要忽略大小写，'A'和'a'只差0x20这一位
+        char a = data[i], b = s.data[i];
+        if(a == b) { continue; }
+        if((a | 0x20) != (b | 0x20) || (a | 0x20) < 'a' || (a | 0x20) > 'z') { return false; }
+    }
+    return true;
+}
+
+Arena::Arena(size_t blockSize, size_t maxRetain)
+    : blockSize_(blockSize), maxRetain_(maxRetain), reserved_(0),
+      head_(nullptr), cur_(nullptr), ptr_(nullptr), end_(nullptr) {
+    // 第一块在构造时就申请好，连接对象本身是复用的，所以整个进程生命周期只申请一次
+    head_ = static_cast<Block*>(malloc(sizeof(Block) + blockSize_));
+    if(!head_) { throw std::bad_alloc(); }
+    head_->next = nullptr;
+    head_->size = blockSize_;
+    reserved_ = blockSize_;
+    UseBlock_(head_);
+}
+
+Arena::~Arena() {
+    FreeBlocks_(head_);
+}
+
+void Arena::Reset() {
+    // 大请求留下了太多内存块：只保留第一块，其余归还给系统
+    if(reserved_ > maxRetain_) {
+        FreeBlocks_(head_->next);
+        head_->next = nullptr;
+        reserved_ = head_->size;
+    }
+    UseBlock_(head_);
+}
+
+size_t Arena::BytesUsed() const {
+    size_t used = 0;
+    for(Block* b = head_; b != cur_; b = b->next) {
+        used += b->size;
+    }
+    return used + (ptr_ - cur_->data());
+}
+
+char* Arena::NextBlock_(size_t len) {
+    // 优先复用之前申请过的块（Reset以后后面的块还挂在链表上）
+    Block* next = cur_->next;
+    if(next == nullptr || next->size < len) {
+        size_t size = len > blockSize_ ? len : blockSize_;
+        Block* block = static_cast<Block*>(malloc(sizeof(Block) + size));
+        if(!block) { throw std::bad_alloc(); }
+        block->size = size;
+        block->next = next;
+        cur_->next = block;
+        reserved_ += size;
+        next = block;
+    }
+    UseBlock_(next);
+    return ptr_;
+}
+
+void Arena::UseBlock_(Block* block) {
+    cur_ = block;
+    ptr_ = block->data();
+    end_ = ptr_ + block->size;
+}
+
+void Arena::FreeBlocks_(Block* block) {
+    while(block) {
+        Block* next = block->next;
+        free(block);
+        block = next;
+    }
+}
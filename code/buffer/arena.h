@@ -0,0 +1,124 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/**********************************************************************
+ * -------------------------------Arena--------------------------------
+ *
+ * 每个连接持有一个Arena（线性/bump分配器），一次请求里面的所有字符串、
+ * 请求头、表单字段都从这里分配，只移动指针不调用malloc；下一个请求开始
+ * 时Reset()把指针拨回第一块内存，所有内存一次性“释放”。
+ *
+ * 注意：
+ * 1、从Arena分配的对象不会被析构，只能放平凡析构的类型（StrView等）；
+ * 2、内存块在Reset()以后保留复用，稳态下请求路径上没有malloc/free；
+ * 3、某个请求特别大时会申请额外的块，Reset()时超出保留上限的块会被归还，
+ *    避免单个大请求让连接一直占着大块内存。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <assert.h>
+
+// 指向一段不属于自己的字符（一般在Arena或者Buffer里面），相当于C++17的string_view
+struct StrView {
+    const char* data;
+    size_t len;
+
+    constexpr StrView() : data(""), len(0) {}
+    constexpr StrView(const char* d, size_t l) : data(d), len(l) {}
+    constexpr StrView(const char* begin, const char* end) : data(begin), len(end - begin) {}
+
+    bool empty() const { return len == 0; }
+    size_t size() const { return len; }
+    const char* begin() const { return data; }
+    const char* end() const { return data + len; }
+
+    bool operator==(const StrView& s) const {
+        return len == s.len && memcmp(data, s.data, len) == 0;
+    }
+    bool operator!=(const StrView& s) const { return !(*this == s); }
+    bool operator==(const char* s) const { return *this == StrView(s, strlen(s)); }
+    bool operator!=(const char* s) const { return !(*this == s); }
+
+    // HTTP的头部字段名和部分字段值大小写不敏感
+    bool EqualsIgnoreCase(const StrView& s) const;
+    bool EqualsIgnoreCase(const char* s) const { return EqualsIgnoreCase(StrView(s, strlen(s))); }
+
+    // 只在日志、数据库等冷路径上使用，会分配内存
+    std::string ToString() const { return std::string(data, len); }
+};
+
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 4096, size_t maxRetain = 64 * 1024);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // 分配len字节，按align对齐
+    void* Alloc(size_t len, size_t align = alignof(std::max_align_t)) {
+        char* p = AlignUp_(ptr_, align);
+        // 对齐以后p可能已经越过end_，先判断再相减，否则差值转成size_t会变成一个很大的数
+        if(p > end_ || static_cast<size_t>(end_ - p) < len) {
+            p = AlignUp_(NextBlock_(len + align), align);
+        }
+        ptr_ = p + len;
+        return p;
+    }
+
+    // 拷贝一段字符串并在末尾补'\0'，返回的StrView不包含'\0'，但data可以直接当C字符串用
+    StrView CopyStr(const char* str, size_t len) {
+        char* p = static_cast<char*>(Alloc(len + 1, 1));
+        memcpy(p, str, len);
+        p[len] = '\0';
+        return StrView(p, len);
+    }
+    StrView CopyStr(const StrView& s) { return CopyStr(s.data, s.len); }
+
+    // 在Arena上构造一个对象（只能是平凡析构的类型，Reset时不会调用析构函数）
+    template<class T, class... Args>
+    T* New(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena object must be trivially destructible");
+        return new (Alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // 回收本次请求的所有内存（移动指针即可）
+    void Reset();
+
+    size_t BytesUsed() const;       // 当前已分配出去的字节数（统计用）
+    size_t BytesReserved() const { return reserved_; }
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;                // data区的大小
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    static char* AlignUp_(char* p, size_t align) {
+        return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + align - 1) & ~(align - 1));
+    }
+
+    char* NextBlock_(size_t len);   // 当前块不够用，切换到下一块（必要时申请新块）
+    void UseBlock_(Block* block);
+    void FreeBlocks_(Block* block);
+
+    const size_t blockSize_;        // 普通块的大小
+    const size_t maxRetain_;        // Reset后最多保留多少字节的内存块
+    size_t reserved_;               // 当前持有的内存块总大小
+
+    Block* head_;                   // 第一块
+    Block* cur_;                    // 当前正在分配的块
+    char* ptr_;                     // 当前块的分配指针
+    char* end_;                     // 当前块的末尾
+};
+
+#endif //ARENA_H
@@ -1,6 +1,7 @@
 #include "buffer.h"
 #include <iostream>
 #include <memory>
+#include <algorithm>
 
 /********************************************************************************
  * RingBuffer实现用户缓冲区，分三种情况
@@ -63,6 +64,11 @@ const char* Buffer::Peek() const {
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
     readPos_ = (readPos_ + len) % buffer_.size();
+    if(readPos_ == writePos_) {
+        // 数据读完了就回到起点，让后面的数据尽量不绕回（不用像RetrieveAll那样清零）
+        readPos_ = 0;
+        writePos_ = 0;
+    }
 }
 
 //buff.RetrieveUntil(lineEnd + 2);
@@ -78,6 +84,15 @@ void Buffer::RetrieveAll() {
     writePos_ = 0;
 }
 
+void Buffer::Linearize() {
+    if(writePos_ >= readPos_) { return; }
+    // [readPos_, size)和[0, writePos_)两段旋转到一起，之后可读数据为[0, readable)
+    size_t readable = ReadableBytes();
+    std::rotate(buffer_.begin(), buffer_.begin() + readPos_, buffer_.end());
+    readPos_ = 0;
+    writePos_ = readable;
+}
+
 void Buffer::ReadToDst(char* dst, size_t len) {
     //这里需要分成两段
     if(len>ReadableBytes()) len=ReadableBytes();
@@ -212,8 +227,10 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
     }
     // 读出的长度大于Buffer的剩余空间，扩容之后将buff数据复制到里面去
     else {
-        //已经写满了数据，所以writePos_应该更新到
-        Append(buff, len - WritableBytes());
+        //前两块已经写满了数据，先把writePos_移过去，再把溢出到buff的部分追加进来
+        size_t writable = WritableBytes();
+        HasWritten(writable);
+        Append(buff, len - writable);
     }
     // printf("finish Buffer::ReadFd\n");
     return len;
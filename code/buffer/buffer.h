@@ -27,6 +27,8 @@ public:
     void RetrieveUntil(const char* end);
     void RetrieveAll() ;
     
+    void Linearize();   // 可读数据绕回到了头部时，把它挪成连续的一段（解析时需要连续内存）
+
     void ReadToDst(char* dst, size_t len);
     std::string RetrieveAllToStr();
 
@@ -35,6 +37,7 @@ public:
 
     //将指定数据写入Buffer
     void Append(const std::string& str);
+    void Append(const char* str) { Append(str, strlen(str)); }    // 字符串常量不再构造std::string临时对象
     void Append(const char* str, size_t len);
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
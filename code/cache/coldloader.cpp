@@ -0,0 +1,102 @@
+#include "coldloader.h"
+#include <unistd.h>      // sysconf
+#include <sys/mman.h>    // mincore, madvise
+#include <stdint.h>
+#include <algorithm>
+#include "../log/log.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22   // Linux 5.14
+#endif
+
+// mincore一次最多查多少页（结果放在栈上）
+static const size_t MINCORE_PAGES = 1024;
+
+ColdLoader::ColdLoader() : enable_(false), queued_(0), closed_(false) {}
+
+ColdLoader::~ColdLoader() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        closed_ = true;
+    }
+    cond_.notify_all();
+    for(std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+ColdLoader* ColdLoader::Instance() {
+    static ColdLoader loader;
+    return &loader;
+}
+
+void ColdLoader::Init(const ColdLoadConfig& config) {
+    config_ = config;
+    enable_ = config.enable && config.threads > 0 && config.windowBytes > 0;
+    while(enable_ && workers_.size() < static_cast<size_t>(config.threads)) {
+        workers_.emplace_back(&ColdLoader::Work_, this);
+    }
+}
+
+bool ColdLoader::Resident(const char* data, size_t len) {
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(data) + len;
+    unsigned char vec[MINCORE_PAGES];
+    while(begin < end) {
+        size_t bytes = std::min<uintptr_t>(end - begin, MINCORE_PAGES * page);
+        if(mincore(reinterpret_cast<void*>(begin), bytes, vec) != 0) {
+            return true;
+        }
+        for(size_t i = 0; i < (bytes + page - 1) / page; i++) {
+            if(!(vec[i] & 1)) { return false; }
+        }
+        begin += bytes;
+    }
+    return true;
+}
+
+void ColdLoader::Submit(const FileRef& file, const char* data, size_t len, std::function<void()> done) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        queue_.push_back(Job{ file, data, len, std::move(done) });
+        queued_.fetch_add(1, std::memory_order_relaxed);
+    }
+    cond_.notify_one();
+}
+
+void ColdLoader::Work_() {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return closed_ || !queue_.empty(); });
+        if(closed_) {
+            break;
+        }
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        locker.unlock();
+        Load_(job.data, job.len);
+        LOG_DEBUG("cold load %s: %zu bytes at %zu", job.file->path.c_str(), job.len,
+                  static_cast<size_t>(job.data - job.file->data));
+        job.done();
+        job.file.reset();
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        locker.lock();
+    }
+}
+
+// 把映射的这一段读进来：缺页就在这个线程里读盘，工作线程之后发送时直接命中页缓存
+void ColdLoader::Load_(const char* data, size_t len) {
+    static const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(data) + len;
+    if(madvise(reinterpret_cast<void*>(begin), end - begin, MADV_POPULATE_READ) == 0) {
+        return;
+    }
+    // 老内核没有MADV_POPULATE_READ：逐页读一个字节
+    volatile char sink = 0;
+    for(uintptr_t p = begin; p < end; p += page) {
+        sink = *reinterpret_cast<const volatile char*>(std::max(p, reinterpret_cast<uintptr_t>(data)));
+    }
+    (void)sink;
+}
@@ -0,0 +1,69 @@
+#ifndef COLD_LOADER_H
+#define COLD_LOADER_H
+
+/**********************************************************************
+ * -----------------------------ColdLoader-----------------------------
+ *
+ * 冷文件的后台读盘（懒汉式单例）：文件内容不在页缓存里的时候，sendfile、
+ * writev映射的内存都会在工作线程里同步读盘，线程池队列里排在后面的连接
+ * （哪怕只是要一个热点小文件）也跟着等。
+ *
+ * 1、发送大文件之前用mincore检查接下来的一个窗口在不在页缓存里；
+ * 2、不在的话连接暂停发送，把窗口交给这里的几个读盘线程（MADV_POPULATE_READ，
+ *    老内核上逐页访问），工作线程马上去处理别的连接；
+ * 3、读完以后调用提交时给的回调（在读盘线程里），由它把连接重新唤醒。
+ *
+ * 排队的读请求太多（磁盘已经跟不上）时Busy()返回true，连接直接在工作线程里发送。
+ *
+***********************************************************************/
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "filecache.h"
+#include "../config/config.h"
+
+class ColdLoader {
+public:
+    static ColdLoader* Instance();
+
+    void Init(const ColdLoadConfig& config);
+    bool Enabled() const { return enable_; }
+    const ColdLoadConfig& Config() const { return config_; }
+
+    // [data, data + len)的页面是不是都在内存里（页缓存），查不了的时候当作在
+    static bool Resident(const char* data, size_t len);
+    // 读盘队列满了
+    bool Busy() const { return queued_.load(std::memory_order_relaxed) >= config_.maxQueue; }
+    // 后台把file里面的[data, data + len)读进页缓存，完成以后在读盘线程里调用done
+    void Submit(const FileRef& file, const char* data, size_t len, std::function<void()> done);
+
+private:
+    ColdLoader();
+    ~ColdLoader();
+
+    struct Job {
+        FileRef file;       // 读盘期间保证映射还在
+        const char* data;
+        size_t len;
+        std::function<void()> done;
+    };
+
+    void Work_();
+    static void Load_(const char* data, size_t len);
+
+    bool enable_;
+    ColdLoadConfig config_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<Job> queue_;
+    std::atomic<size_t> queued_;
+    bool closed_;
+    std::vector<std::thread> workers_;
+};
+
+#endif //COLD_LOADER_H
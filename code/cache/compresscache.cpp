@@ -0,0 +1,180 @@
+#include "compresscache.h"
+#include <unistd.h>      // sysconf
+#include <sys/mman.h>    // mmap, munmap, mprotect
+#include <zlib.h>
+#include "../log/log.h"
+
+// 等待压缩的文件最多排多少个，排满了这次就不压缩（以后的请求还会再提交）
+static const size_t MAX_QUEUE = 256;
+// 缓存的结果最多多少项（不划算的文件只记一个空结果，不占预算，也要有个上限）
+static const size_t MAX_ENTRIES = 4096;
+
+CompressCache::CompressCache() : enable_(false), bytes_(0), closed_(false) {}
+
+CompressCache::~CompressCache() {
+    if(worker_) {
+        {
+            std::lock_guard<std::mutex> locker(mtx_);
+            closed_ = true;
+        }
+        cond_.notify_all();
+        worker_->join();
+    }
+}
+
+CompressCache* CompressCache::Instance() {
+    static CompressCache cache;
+    return &cache;
+}
+
+void CompressCache::Init(const CompressConfig& config) {
+    config_ = config;
+    enable_ = config.enable;
+    if(enable_ && !worker_) {
+        worker_.reset(new std::thread(&CompressCache::Work_, this));
+    }
+}
+
+// 文本类的资源压缩效果好；图片、音视频、woff字体本身已经压缩过了
+bool CompressCache::CompressibleType_(const StrView& mime) {
+    static const char* const TYPES[] = {
+        "application/json", "application/xhtml+xml", "application/rtf", "image/svg+xml",
+        "image/x-icon", "font/ttf", "font/otf", "application/vnd.ms-fontobject",
+    };
+    if(mime.len > 5 && memcmp(mime.data, "text/", 5) == 0) {
+        return true;
+    }
+    for(const char* type : TYPES) {
+        if(mime == type) { return true; }
+    }
+    return false;
+}
+
+bool CompressCache::Eligible(const FileEntry& source) const {
+    return enable_ && source.fd >= 0 && source.data && source.size >= config_.minBytes
+        && source.size <= config_.maxFileBytes && CompressibleType_(source.mime);
+}
+
+// 路径和ETag（文件版本）的FNV-1a，命中以后还要比较两者
+uint64_t CompressCache::Key_(const FileEntry& source) {
+    uint64_t h = 14695981039346656037ull;
+    for(char c : source.path) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    h ^= '\n';
+    h *= 1099511628211ull;
+    for(char c : source.etag) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+bool CompressCache::Get(const FileRef& source, FileRef* out) {
+    assert(source && out);
+    uint64_t key = Key_(*source);
+    std::lock_guard<std::mutex> locker(mtx_);
+    auto it = index_.find(key);
+    if(it != index_.end() && it->second->path == source->path && it->second->etag == source->etag) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        if(!it->second->file) {
+            return false;       // 压缩不划算
+        }
+        *out = it->second->file;
+        return true;
+    }
+    // 没命中：交给后台线程，同一个版本只排一次
+    if(queue_.size() < MAX_QUEUE && inflight_.insert(key).second) {
+        queue_.push_back(source);
+        cond_.notify_one();
+    }
+    return false;
+}
+
+void CompressCache::Work_() {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return closed_ || !queue_.empty(); });
+        if(closed_) {
+            break;
+        }
+        FileRef source = std::move(queue_.front());
+        queue_.pop_front();
+        locker.unlock();
+        FileRef file = Compress_(*source);
+        locker.lock();
+        Insert_(*source, std::move(file));
+        inflight_.erase(Key_(*source));
+    }
+}
+
+// gzip压缩整个文件，结果放在匿名映射里面（FileEntry析构时munmap），没有明显变小时返回nullptr
+FileRef CompressCache::Compress_(const FileEntry& source) const {
+    z_stream zs = {};
+    if(deflateInit2(&zs, config_.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nullptr;
+    }
+    size_t bound = deflateBound(&zs, source.size);
+    void* mem = mmap(nullptr, bound, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED) {
+        deflateEnd(&zs);
+        return nullptr;
+    }
+    zs.next_in = reinterpret_cast<Bytef*>(source.data);
+    zs.avail_in = source.size;
+    zs.next_out = static_cast<Bytef*>(mem);
+    zs.avail_out = bound;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t len = zs.total_out;
+    deflateEnd(&zs);
+    if(ret != Z_STREAM_END || len * 10 > source.size * 9) {
+        munmap(mem, bound);
+        return nullptr;
+    }
+    // 用不到的整页还给系统，剩下的改成只读
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t used = (len + page - 1) / page * page;
+    size_t mapped = (bound + page - 1) / page * page;
+    if(used < mapped) {
+        munmap(static_cast<char*>(mem) + used, mapped - used);
+    }
+    mprotect(mem, used, PROT_READ);
+
+    std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+    entry->path = source.path;
+    entry->st = source.st;
+    entry->st.st_size = len;
+    entry->data = static_cast<char*>(mem);
+    entry->size = len;
+    entry->mime = source.mime;
+    // 压缩版本是另一个表示，ETag也要不一样
+    entry->etag = source.etag.substr(0, source.etag.size() - 1) + "-gzip\"";
+    entry->lastModified = source.lastModified;
+    entry->sidecars.store(FileEntry::SIDECARS_CHECKED, std::memory_order_relaxed);
+    LOG_DEBUG("compress %s: %zu -> %zu", source.path.c_str(), source.size, len);
+    return entry;
+}
+
+void CompressCache::Insert_(const FileEntry& source, FileRef&& file) {
+    uint64_t key = Key_(source);
+    auto it = index_.find(key);
+    if(it != index_.end()) {
+        bytes_ -= it->second->file ? it->second->file->size : 0;
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+    size_t size = file ? file->size : 0;
+    if(size > config_.cacheBytes) {
+        return;
+    }
+    lru_.push_front(Node{ key, source.path, source.etag, std::move(file) });
+    index_[key] = lru_.begin();
+    bytes_ += size;
+    while(bytes_ > config_.cacheBytes || lru_.size() > MAX_ENTRIES) {
+        Node& last = lru_.back();
+        bytes_ -= last.file ? last.file->size : 0;
+        index_.erase(last.key);
+        lru_.pop_back();
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+/**********************************************************************
+ * ---------------------------CompressCache----------------------------
+ *
+ * 没有预压缩兄弟文件的静态资源，在服务器里面gzip压缩一次并缓存（懒汉式单例）：
+ * 1、按（路径，文件版本，编码）缓存压缩结果，文件版本用ETag（inode、大小、修改
+ *    时间），文件变了自然换一个key，旧版本随LRU淘汰；总大小有预算，超过淘汰最久
+ *    没用的；
+ * 2、请求路径上不压缩：没命中时把文件交给后台线程，这次先发原文件；同一个文件同时
+ *    只压缩一次（正在压缩的key记在inflight_里面）；
+ * 3、压缩结果包装成FileEntry（fd为-1，数据在匿名映射里面），ETag、预拼响应、Range
+ *    这些都和普通文件一样处理；
+ * 4、压缩以后没有明显变小的文件记一个空结果，以后不再尝试。
+ *
+***********************************************************************/
+
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include "filecache.h"
+
+class CompressCache {
+public:
+    static CompressCache* Instance();
+
+    void Init(const CompressConfig& config);
+
+    // 这个文件要不要动态压缩（MIME类型可压缩、大小合适），和有没有压缩好无关
+    bool Eligible(const FileEntry& source) const;
+    // 取出source的gzip版本；还没有的话交给后台线程压缩，这次返回false
+    bool Get(const FileRef& source, FileRef* out);
+
+private:
+    CompressCache();
+    ~CompressCache();
+
+    struct Node {
+        uint64_t key;
+        std::string path;   // 原文件的路径和ETag（key只是哈希）
+        std::string etag;
+        FileRef file;       // nullptr表示压缩了也没有明显变小
+    };
+
+    static uint64_t Key_(const FileEntry& source);
+    static bool CompressibleType_(const StrView& mime);
+    // 后台线程：压缩队列里面的文件
+    void Work_();
+    FileRef Compress_(const FileEntry& source) const;
+    void Insert_(const FileEntry& source, FileRef&& file);
+
+    CompressConfig config_;
+    bool enable_;
+
+    std::mutex mtx_;
+    std::list<Node> lru_;                   // 最近用过的在前面
+    std::unordered_map<uint64_t, std::list<Node>::iterator> index_;
+    size_t bytes_;                          // 缓存的压缩结果一共多少字节
+
+    std::deque<FileRef> queue_;             // 等待压缩的文件
+    std::unordered_set<uint64_t> inflight_;     // 已经在队列里或者正在压缩的key
+    std::condition_variable cond_;
+    bool closed_;
+    std::unique_ptr<std::thread> worker_;
+};
+
+#endif //COMPRESS_CACHE_H
@@ -0,0 +1,466 @@
+#include "filecache.h"
+#include <fcntl.h>       // open
+#include <unistd.h>      // close, read
+#include <dirent.h>      // opendir
+#include <errno.h>
+#include <limits.h>      // PATH_MAX
+#include <string.h>
+#include <time.h>        // gmtime_r, strftime
+#include <sys/mman.h>    // mmap, munmap, mlock, madvise
+#include <algorithm>
+#include <chrono>
+#include <sys/inotify.h>
+#include <zlib.h>        // crc32
+#include "sitearchive.h"
+#include "../http/router.h"
+#include "../log/log.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22   // Linux 5.14
+#endif
+
+// 缓存项需要关注的变化：内容、属性（权限）、删除、移动、新建（新建的子目录也要监视）
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE
+                                 | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// 各个编码的名字和兄弟文件的后缀（下标是ENCODING）
+static const struct {
+    const char* name;
+    const char* suffix;
+} ENCODINGS[ENCODING_COUNT] = {
+    { "br", ".br" },
+    { "gzip", ".gz" },
+};
+
+FileEntry::~FileEntry() {
+    for(auto& p : prebuilt) { delete p.load(std::memory_order_relaxed); }
+    if(image) { return; }       // 站点镜像里面的一段，镜像自己释放
+    if(data) { munmap(data, size); }
+    if(fd >= 0) { close(fd); }
+}
+
+FileCache::FileCache() : enable_(false), precompressed_(false), maxPerShard_(0), prebuiltMaxBytes_(0), notifyFd_(-1), archiveWd_(-1) {}
+
+FileCache::~FileCache() {
+    if(notifyFd_ >= 0) { close(notifyFd_); }
+}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::Init(const char* srcDir, const FileCacheConfig& config) {
+    assert(srcDir);
+    enable_ = config.enable;
+    precompressed_ = config.precompressed;
+    maxPerShard_ = std::max<size_t>(1, config.maxEntries / SHARD_COUNT);
+    prebuiltMaxBytes_ = config.prebuiltMaxBytes;
+    srcDir_ = srcDir;
+    if(!srcDir_.empty() && srcDir_.back() == '/') { srcDir_.pop_back(); }
+    if(config.archive && archivePath_.empty()) {
+        archivePath_ = config.archive;
+        size_t slash = archivePath_.rfind('/');
+        archiveName_ = archivePath_.substr(slash == std::string::npos ? 0 : slash + 1);
+        LoadArchive_();
+    }
+    // 缓存关闭时不监视（资源目录和镜像都是），镜像只在启动时加载一次，换镜像要重启
+    if(!enable_ || notifyFd_ >= 0) { return; }
+    notifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(notifyFd_ < 0) {
+        // 没有inotify就没办法知道文件变了，不能缓存
+        LOG_ERROR("inotify_init1 error: %d, file cache disabled", errno);
+        enable_ = false;
+        return;
+    }
+    WatchTree_(srcDir_, "");
+    if(!archivePath_.empty()) {
+        // 部署时新镜像只能rename过来（sitepack就是这样做的），监视镜像所在目录的IN_MOVED_TO；
+        //  不能原地改写：正在使用的映射会跟着变（截短时访问会SIGBUS），写到一半的镜像也不能加载。
+        //  目录可能已经在监视了（镜像放在资源目录里面），IN_MASK_ADD不会覆盖原来的事件
+        size_t slash = archivePath_.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : archivePath_.substr(0, slash + 1);
+        archiveWd_ = inotify_add_watch(notifyFd_, dir.c_str(), IN_MOVED_TO | IN_MASK_ADD | IN_ONLYDIR);
+        if(archiveWd_ < 0) {
+            LOG_WARN("inotify watch %s error: %d", dir.c_str(), errno);
+        }
+    }
+}
+
+void FileCache::LoadArchive_() {
+    std::shared_ptr<const SiteArchive> archive = SiteArchive::Load(archivePath_, precompressed_);
+    if(!archive) {
+        return;
+    }
+    // 正在发送的响应还引用着旧镜像里面的文件，旧镜像等它们发完再释放
+    std::atomic_store(&archive_, archive);
+    LOG_INFO("site archive %s: %zu files, %zu bytes", archivePath_.c_str(), archive->Count(), archive->Image().size);
+}
+
+size_t FileCache::ArchiveFiles() const {
+    std::shared_ptr<const SiteArchive> archive = std::atomic_load(&archive_);
+    return archive ? archive->Count() : 0;
+}
+
+// inotify不会递归监视子目录，每一层目录单独添加
+void FileCache::WatchTree_(const std::string& dir, const std::string& rel) {
+    int wd = inotify_add_watch(notifyFd_, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if(wd < 0) {
+        LOG_WARN("inotify watch %s error: %d", dir.c_str(), errno);
+        return;
+    }
+    watches_[wd] = rel;
+    DIR* d = opendir(dir.c_str());
+    if(!d) { return; }
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_name[0] == '.') { continue; }
+        std::string child = dir + "/" + ent->d_name;
+        struct stat st;
+        if(stat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            WatchTree_(child, rel + "/" + ent->d_name);
+        }
+    }
+    closedir(d);
+}
+
+void FileCache::ListTree_(const std::string& dir, const std::string& rel,
+                          std::vector<std::pair<size_t, std::string>>* files) {
+    DIR* d = opendir(dir.c_str());
+    if(!d) { return; }
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_name[0] == '.') { continue; }
+        std::string child = dir + "/" + ent->d_name;
+        struct stat st;
+        if(stat(child.c_str(), &st) != 0) { continue; }
+        if(S_ISDIR(st.st_mode)) {
+            ListTree_(child, rel + "/" + ent->d_name, files);
+        } else if(S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)) {
+            files->emplace_back(st.st_size, rel + "/" + ent->d_name);
+        }
+    }
+    closedir(d);
+}
+
+FileCache::WarmupStats FileCache::Warmup(const FileCacheConfig& config) {
+    std::shared_ptr<const SiteArchive> archive = std::atomic_load(&archive_);
+    if(archive) {
+        return WarmupArchive_(*archive, config);
+    }
+    WarmupStats stats;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<size_t, std::string>> files;
+    ListTree_(srcDir_, "", &files);
+    // 小文件（页面、样式、脚本）最可能是热点，同样的预算也能覆盖更多的文件
+    std::sort(files.begin(), files.end());
+
+    // 第一遍：打开、映射，让内核在后台把所有文件读进页缓存
+    std::vector<FileRef> warmed;
+    for(const auto& item : files) {
+        if(warmed.size() >= config.maxEntries || stats.bytes + item.first > config.warmupBytes) {
+            break;
+        }
+        std::string fullPath = srcDir_ + item.second;
+        FileRef file;
+        if(Open(StrView(item.second.data(), item.second.size()),
+                StrView(fullPath.data(), fullPath.size()), &file) != 0) {
+            continue;
+        }
+        if(file->fd >= 0 && file->size > 0) {
+            posix_fadvise(file->fd, file->offset, file->size, POSIX_FADV_WILLNEED);
+        }
+        Sidecars(*file);    // 顺便检查预压缩版本
+        stats.files++;
+        stats.bytes += file->size;
+        warmed.push_back(std::move(file));
+    }
+
+    // 第二遍：等数据读进来并建好页表（第一次发送时不再缺页），预算内的锁在内存里；
+    //  没有缓存的话映射用完就释放了，锁了也没用
+    bool lock = enable_ && config.mlockBytes > 0;
+    for(const FileRef& file : warmed) {
+        if(!file->data) { continue; }
+        if(lock && stats.locked + file->size <= config.mlockBytes) {
+            if(mlock(file->data, file->size) == 0) {
+                stats.locked += file->size;
+                continue;
+            }
+            LOG_WARN("mlock %s error: %d, stop locking", file->path.c_str(), errno);
+            lock = false;
+        }
+        if(madvise(file->data, file->size, MADV_POPULATE_READ) != 0) {
+            // 老内核没有MADV_POPULATE_READ，只能等数据读进页缓存
+            madvise(file->data, file->size, MADV_WILLNEED);
+        }
+    }
+    stats.ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+// 站点镜像是一整个文件：预读、建页表、锁内存都按镜像开头的warmupBytes、mlockBytes做
+FileCache::WarmupStats FileCache::WarmupArchive_(const SiteArchive& archive, const FileCacheConfig& config) {
+    WarmupStats stats;
+    auto start = std::chrono::steady_clock::now();
+    const SiteImage& image = archive.Image();
+    stats.files = archive.Count();
+    stats.bytes = std::min(image.size, config.warmupBytes);
+    posix_fadvise(image.fd, 0, stats.bytes, POSIX_FADV_WILLNEED);
+    size_t lockBytes = std::min(stats.bytes, config.mlockBytes);
+    if(lockBytes > 0) {
+        if(mlock(image.data, lockBytes) == 0) {
+            stats.locked = lockBytes;
+        } else {
+            LOG_WARN("mlock site archive error: %d", errno);
+        }
+    }
+    if(stats.bytes > stats.locked
+            && madvise(image.data + stats.locked, stats.bytes - stats.locked, MADV_POPULATE_READ) != 0) {
+        madvise(image.data + stats.locked, stats.bytes - stats.locked, MADV_WILLNEED);
+    }
+    stats.ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+void FileCache::HandleNotify() {
+    alignas(struct inotify_event) char buf[4096];
+    for(;;) {
+        ssize_t len = read(notifyFd_, buf, sizeof(buf));
+        if(len <= 0) { break; }
+        for(char* p = buf; p < buf + len;) {
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                // 丢了事件，不知道哪些文件变了
+                LOG_WARN("inotify queue overflow, clear file cache");
+                Clear();
+                continue;
+            }
+            if(ev->wd == archiveWd_ && ev->len > 0 && (ev->mask & IN_MOVED_TO)
+                    && archiveName_ == ev->name) {
+                LoadArchive_();
+            }
+            auto it = watches_.find(ev->wd);
+            if(it == watches_.end()) { continue; }
+            if(ev->mask & IN_IGNORED) {
+                watches_.erase(it);
+                continue;
+            }
+            if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // 整个目录没了（或者换了位置），下面的缓存项都不对了
+                Clear();
+                continue;
+            }
+            if(ev->len == 0) { continue; }
+            std::string rel = it->second + "/" + ev->name;
+            if(ev->mask & IN_ISDIR) {
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    WatchTree_(srcDir_ + rel, rel);
+                }
+                if(ev->mask & (IN_MOVED_FROM | IN_MOVED_TO)) {
+                    Clear();
+                }
+                continue;
+            }
+            Invalidate(StrView(rel.data(), rel.size()));
+            // 预压缩的兄弟文件变了，原文件记下的检查结果也要重新来
+            for(const auto& enc : ENCODINGS) {
+                size_t suffixLen = strlen(enc.suffix);
+                if(rel.size() > suffixLen && rel.compare(rel.size() - suffixLen, suffixLen, enc.suffix) == 0) {
+                    Invalidate(StrView(rel.data(), rel.size() - suffixLen));
+                }
+            }
+        }
+    }
+}
+
+const char* FileCache::EncodingName(ENCODING encoding) {
+    return ENCODINGS[encoding].name;
+}
+
+const char* FileCache::EncodingSuffix(ENCODING encoding) {
+    return ENCODINGS[encoding].suffix;
+}
+
+uint32_t FileCache::Fingerprint(const FileEntry& file) {
+    uint64_t fingerprint = file.fingerprint.load(std::memory_order_relaxed);
+    if(!(fingerprint & FileEntry::FINGERPRINT_DONE)) {
+        // 多个线程同时计算的结果是一样的，直接覆盖
+        uLong crc = crc32(0L, Z_NULL, 0);
+        if(file.data) {
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(file.data), file.size);
+        }
+        fingerprint = FileEntry::FINGERPRINT_DONE | static_cast<uint32_t>(crc);
+        file.fingerprint.store(fingerprint, std::memory_order_relaxed);
+    }
+    return static_cast<uint32_t>(fingerprint);
+}
+
+uint8_t FileCache::Sidecars(const FileEntry& source) {
+    uint8_t sidecars = source.sidecars.load(std::memory_order_acquire);
+    if(sidecars & FileEntry::SIDECARS_CHECKED) {
+        return sidecars & ~FileEntry::SIDECARS_CHECKED;
+    }
+    sidecars = 0;
+    if(precompressed_) {
+        for(int i = 0; i < ENCODING_COUNT; i++) {
+            // 比原文件旧的压缩版本可能是原文件修改之前生成的，不能用
+            std::string path = srcDir_ + source.path + ENCODINGS[i].suffix;
+            struct stat st;
+            if(stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)
+                    && (st.st_mtim.tv_sec > source.st.st_mtim.tv_sec
+                        || (st.st_mtim.tv_sec == source.st.st_mtim.tv_sec && st.st_mtim.tv_nsec >= source.st.st_mtim.tv_nsec))) {
+                sidecars |= 1 << i;
+            }
+        }
+    }
+    // 多个线程同时检查的结果是一样的，直接覆盖
+    source.sidecars.store(sidecars | FileEntry::SIDECARS_CHECKED, std::memory_order_release);
+    return sidecars;
+}
+
+int FileCache::OpenSidecar(const FileEntry& source, ENCODING encoding, FileRef* file) {
+    // 完整路径拼在栈上，缓存（或者镜像）命中时不需要分配内存
+    char fullPath[PATH_MAX];
+    const char* suffix = ENCODINGS[encoding].suffix;
+    size_t suffixLen = strlen(suffix);
+    size_t len = srcDir_.size() + source.path.size() + suffixLen;
+    if(len >= sizeof(fullPath)) {
+        return 404;
+    }
+    memcpy(fullPath, srcDir_.data(), srcDir_.size());
+    memcpy(fullPath + srcDir_.size(), source.path.data(), source.path.size());
+    memcpy(fullPath + srcDir_.size() + source.path.size(), suffix, suffixLen + 1);
+    StrView path(fullPath + srcDir_.size(), source.path.size() + suffixLen);
+    if(source.image) {
+        // 镜像里的文件只用同一个镜像里的压缩版本（中途换了镜像的话就不压缩了）
+        std::shared_ptr<const SiteArchive> archive = std::atomic_load(&archive_);
+        if(archive && archive->Find(path, file) && (*file)->image == source.image) {
+            return 0;
+        }
+        file->reset();
+        return 404;
+    }
+    return Open(path, StrView(fullPath, len), file);
+}
+
+// FNV-1a，只用来分片和索引，真正命中还要比较路径
+uint64_t FileCache::Hash_(const StrView& path) {
+    uint64_t h = 14695981039346656037ull;
+    for(char c : path) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+int FileCache::Open(const StrView& path, const StrView& fullPath, FileRef* file) {
+    assert(file);
+    std::shared_ptr<const SiteArchive> archive = std::atomic_load(&archive_);
+    if(archive && archive->Find(path, file)) {
+        return 0;
+    }
+    if(!enable_) {
+        return Load_(path, fullPath, file);
+    }
+    uint64_t hash = Hash_(path);
+    Shard& shard = ShardOf_(hash);
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto it = shard.index.find(hash);
+        if(it != shard.index.end() && StrView((*it->second)->path.data(), (*it->second)->path.size()) == path) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            *file = *it->second;
+            return 0;
+        }
+        generation = shard.generation;
+    }
+    // 没命中：在锁外面打开文件（可能比较慢），再放进缓存
+    int code = Load_(path, fullPath, file);
+    if(code == 0) {
+        Insert_(shard, hash, generation, *file);
+    }
+    return code;
+}
+
+int FileCache::Load_(const StrView& path, const StrView& fullPath, FileRef* file) {
+    int fd = open(fullPath.data, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return (errno == EACCES) ? 403 : 404;
+    }
+    std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+    entry->fd = fd;
+    if(fstat(fd, &entry->st) < 0 || S_ISDIR(entry->st.st_mode)) {
+        return 404;
+    }
+    //S_IROTH是表示该文件只能由其他用户组读，需要确认该文件是“其他用户组”可读的
+    if(!(entry->st.st_mode & S_IROTH)) {
+        return 403;
+    }
+    entry->size = entry->st.st_size;
+    if(entry->size > 0) {
+        // 只读的共享映射，所有连接共用同一份
+        void* mmRet = mmap(nullptr, entry->size, PROT_READ, MAP_SHARED, fd, 0);
+        if(mmRet == MAP_FAILED) {
+            LOG_ERROR("mmap %s error: %d", fullPath.data, errno);
+            return 404;
+        }
+        entry->data = static_cast<char*>(mmRet);
+    }
+    entry->path.assign(path.data, path.len);
+    entry->mime = Router::MimeType(path);
+    // 校验器跟着文件版本走，每个版本只算一次
+    char buf[64];
+    unsigned long long mtimeNS = static_cast<unsigned long long>(entry->st.st_mtim.tv_sec) * 1000000000ull
+                               + entry->st.st_mtim.tv_nsec;
+    int len = snprintf(buf, sizeof(buf), "\"%llx-%llx-%llx\"",
+                       static_cast<unsigned long long>(entry->st.st_ino),
+                       static_cast<unsigned long long>(entry->size), mtimeNS);
+    entry->etag.assign(buf, len);
+    struct tm tm;
+    gmtime_r(&entry->st.st_mtime, &tm);
+    entry->lastModified.assign(buf, strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+    *file = std::move(entry);
+    return 0;
+}
+
+void FileCache::Insert_(Shard& shard, uint64_t hash, uint64_t generation, const FileRef& file) {
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    if(shard.generation != generation) {
+        return;     // 打开的过程中文件可能已经变了，这次的结果只给当前请求用
+    }
+    auto it = shard.index.find(hash);
+    if(it != shard.index.end()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+    shard.lru.push_front(file);
+    shard.index[hash] = shard.lru.begin();
+    while(shard.lru.size() > maxPerShard_) {
+        shard.index.erase(Hash_(StrView(shard.lru.back()->path.data(), shard.lru.back()->path.size())));
+        shard.lru.pop_back();
+    }
+}
+
+void FileCache::Invalidate(const StrView& path) {
+    uint64_t hash = Hash_(path);
+    Shard& shard = ShardOf_(hash);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    shard.generation++;
+    auto it = shard.index.find(hash);
+    if(it != shard.index.end()) {
+        LOG_DEBUG("file cache invalidate %s", (*it->second)->path.c_str());
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+}
+
+void FileCache::Clear() {
+    for(Shard& shard : shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        shard.generation++;
+        shard.index.clear();
+        shard.lru.clear();
+    }
+}
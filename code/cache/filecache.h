@@ -0,0 +1,177 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+/**********************************************************************
+ * -----------------------------FileCache------------------------------
+ *
+ * 静态资源的共享缓存（懒汉式单例），所有工作线程共用：
+ * 1、按资源目录下的相对路径（已经规范化的请求路径）缓存打开的fd、stat信息、
+ *    只读的共享映射和MIME类型，热点文件的请求不需要任何文件系统调用；
+ * 2、缓存项不可变，用shared_ptr引用计数：正在发送的响应各自持有一份引用，
+ *    缓存淘汰或者文件变化以后，最后一个响应发完才会munmap、close，请求
+ *    路径上不再有munmap（也就没有随之而来的TLB shootdown）；
+ * 3、按哈希分成多个分片，每个分片一把锁、一条LRU链，超过容量淘汰最久没用的；
+ * 4、inotify监视整个资源目录（包括子目录），fd注册在主线程的epoll上，文件
+ *    修改、删除、移动时让对应的缓存项失效，事件队列溢出时清空整个缓存。
+ *
+ * 5、小文件还会挂上拼好的完整响应（状态行+响应头+文件内容，见HttpResponse::
+ *    Prebuilt），第一次用到时生成，之后命中只需要把iovec指过去；
+ * 6、预压缩的兄弟文件（file.br、file.gz）有没有、是不是比原文件新，每个文件版本只
+ *    检查一次，结果记在原文件的缓存项上；兄弟文件有变化时原文件的缓存项一起失效。
+ *
+ * 7、配置了站点镜像（见SiteArchive）时先在镜像里面找，镜像里的文件不进LRU；
+ *    新镜像rename到镜像的路径上（部署新版本）以后整个换上新镜像，一次请求只会看到一个版本。
+ *
+ * 缓存关闭时Open()每次都打开、映射一份新的，用完就释放（和以前一样）；也不监视
+ * 资源目录和镜像文件，镜像只在启动时加载一次。
+ *
+***********************************************************************/
+
+#include <sys/stat.h>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../buffer/arena.h"
+#include "../config/config.h"
+
+// 预压缩的兄弟文件，按优先顺序排列
+enum ENCODING {
+    ENCODING_BR,
+    ENCODING_GZIP,
+    ENCODING_COUNT,
+};
+
+struct SiteImage;
+class SiteArchive;
+
+// 一个文件版本的缓存项（创建以后不再修改）
+struct FileEntry {
+    std::string path;       // 相对资源目录的路径（缓存的key）
+    struct stat st;
+    int fd;                 // 只读打开的fd
+    char* data;             // 只读共享映射（空文件为nullptr）
+    size_t size;
+    StrView mime;           // MIME类型（指向Router里面的静态表）
+    std::string etag;       // 强ETag（由inode、大小、修改时间生成，带引号）
+    std::string lastModified;   // 修改时间（HTTP-date）
+    off_t offset;           // 内容在fd里面的偏移（sendfile用），只有站点镜像里面的文件不为0
+    std::shared_ptr<const SiteImage> image;     // 站点镜像里面的文件：fd、data属于镜像，由镜像释放
+
+    // 预先拼好的完整响应，按（状态码，是否keep-alive）分槽，第一次用到时由HttpResponse生成；
+    //  多个线程同时生成时用CAS决定留下哪一份，之后不再修改，随缓存项一起释放
+    static const size_t PREBUILT_SLOTS = 40;
+    mutable std::atomic<const std::string*> prebuilt[PREBUILT_SLOTS];
+    // 可用的预压缩版本（第i位表示ENCODING i），最高位表示已经检查过
+    static const uint8_t SIDECARS_CHECKED = 0x80;
+    mutable std::atomic<uint8_t> sidecars;
+    // 内容指纹（CRC32），FINGERPRINT_DONE位表示已经算过
+    static const uint64_t FINGERPRINT_DONE = 1ull << 32;
+    mutable std::atomic<uint64_t> fingerprint;
+
+    FileEntry() : fd(-1), data(nullptr), size(0), offset(0), sidecars(0), fingerprint(0) {
+        for(auto& p : prebuilt) { p.store(nullptr, std::memory_order_relaxed); }
+    }
+    ~FileEntry();
+    FileEntry(const FileEntry&) = delete;
+    FileEntry& operator=(const FileEntry&) = delete;
+};
+
+typedef std::shared_ptr<const FileEntry> FileRef;
+
+class FileCache {
+public:
+    // 启动预热的结果
+    struct WarmupStats {
+        size_t files = 0;
+        size_t bytes = 0;
+        size_t locked = 0;      // mlock的字节数
+        int64_t ms = 0;
+    };
+
+    static FileCache* Instance();
+
+    // srcDir是资源目录（末尾带'/'），开启缓存时同时开始用inotify监视它
+    void Init(const char* srcDir, const FileCacheConfig& config);
+
+    // 启动预热（Init之后、开始监听之前调用）：遍历资源目录，从小到大打开文件放进缓存，
+    //  预读进页缓存并建好页表，再按预算mlock一部分；没有缓存时只预读
+    WarmupStats Warmup(const FileCacheConfig& config);
+
+    // 取出path（相对路径）对应的文件，fullPath是拼好的完整路径（末尾带'\0'）；
+    //  成功返回0，失败返回应当回复的状态码（404、403）
+    int Open(const StrView& path, const StrView& fullPath, FileRef* file);
+
+    // source可用的预压缩版本（位掩码，见ENCODING），第一次调用时检查，之后直接返回记下的结果
+    uint8_t Sidecars(const FileEntry& source);
+    // 取出source的预压缩版本（和Open()一样经过缓存），成功返回0
+    int OpenSidecar(const FileEntry& source, ENCODING encoding, FileRef* file);
+    // 编码的名字（Accept-Encoding、Content-Encoding里面用的）
+    static const char* EncodingName(ENCODING encoding);
+    // 兄弟文件的后缀
+    static const char* EncodingSuffix(ENCODING encoding);
+    // 文件内容的CRC32（带指纹的URL里面的那一段），第一次调用时计算
+    static uint32_t Fingerprint(const FileEntry& file);
+
+    // 文件不超过这个大小时缓存整个响应（缓存关闭时为0）
+    size_t PrebuiltMaxBytes() const { return enable_ ? prebuiltMaxBytes_ : 0; }
+
+    // 站点镜像里面的文件个数，没有镜像时为0
+    size_t ArchiveFiles() const;
+
+    // inotify的fd（注册到epoll上），-1表示没有监视
+    int NotifyFd() const { return notifyFd_; }
+    // 主线程：inotify可读时调用，处理所有事件
+    void HandleNotify();
+
+    void Invalidate(const StrView& path);
+    void Clear();
+
+private:
+    FileCache();
+    ~FileCache();
+
+    static const size_t SHARD_COUNT = 16;
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<FileRef> lru;     // 最近用过的在前面
+        std::unordered_map<uint64_t, std::list<FileRef>::iterator> index;  // 路径的哈希 -> LRU节点
+        uint64_t generation = 0;    // 每次失效加一，打开文件期间失效过的话结果不放进缓存
+    };
+
+    static uint64_t Hash_(const StrView& path);
+    Shard& ShardOf_(uint64_t hash) { return shards_[hash % SHARD_COUNT]; }
+    static int Load_(const StrView& path, const StrView& fullPath, FileRef* file);
+    void Insert_(Shard& shard, uint64_t hash, uint64_t generation, const FileRef& file);
+
+    void WatchTree_(const std::string& dir, const std::string& rel);
+    // 加载（或者重新加载）站点镜像，失败时保留原来的
+    void LoadArchive_();
+    WarmupStats WarmupArchive_(const SiteArchive& archive, const FileCacheConfig& config);
+    // 资源目录下所有普通文件的（大小，相对路径）
+    void ListTree_(const std::string& dir, const std::string& rel, std::vector<std::pair<size_t, std::string>>* files);
+
+    bool enable_;
+    bool precompressed_;
+    size_t maxPerShard_;
+    size_t prebuiltMaxBytes_;
+    Shard shards_[SHARD_COUNT];
+
+    int notifyFd_;
+    std::string srcDir_;
+    std::unordered_map<int, std::string> watches_;    // inotify的wd -> 目录的相对路径（只在主线程访问）
+
+    std::string archivePath_;
+    std::string archiveName_;                   // 镜像的文件名（镜像所在目录的inotify事件里面比较）
+    int archiveWd_;
+    std::shared_ptr<const SiteArchive> archive_;  // 用std::atomic_load/atomic_store访问，主线程替换
+};
+
+#endif //FILE_CACHE_H
@@ -0,0 +1,134 @@
+#include "sitearchive.h"
+#include <fcntl.h>       // open
+#include <unistd.h>      // close
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>    // mmap, munmap
+#include <algorithm>
+#include "sitepack.h"
+#include "../http/router.h"
+#include "../log/log.h"
+
+SiteImage::~SiteImage() {
+    if(data) { munmap(data, size); }
+    if(fd >= 0) { close(fd); }
+}
+
+std::shared_ptr<const SiteArchive> SiteArchive::Load(const std::string& path, bool precompressed) {
+    std::shared_ptr<SiteImage> image = std::make_shared<SiteImage>();
+    image->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(image->fd < 0 || fstat(image->fd, &st) < 0) {
+        LOG_ERROR("open site archive %s error: %d", path.c_str(), errno);
+        return nullptr;
+    }
+    if(static_cast<size_t>(st.st_size) < sizeof(SitePackHeader)) {
+        LOG_ERROR("site archive %s: too small", path.c_str());
+        return nullptr;
+    }
+    void* mmRet = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, image->fd, 0);
+    if(mmRet == MAP_FAILED) {
+        LOG_ERROR("mmap site archive %s error: %d", path.c_str(), errno);
+        return nullptr;
+    }
+    image->data = static_cast<char*>(mmRet);
+    image->size = st.st_size;
+
+    std::shared_ptr<SiteArchive> archive(new SiteArchive());
+    archive->image_ = std::move(image);
+    if(!archive->Build_(precompressed)) {
+        LOG_ERROR("site archive %s: bad format", path.c_str());
+        return nullptr;
+    }
+    return archive;
+}
+
+bool SiteArchive::Build_(bool precompressed) {
+    const char* base = image_->data;
+    const SitePackHeader* header = reinterpret_cast<const SitePackHeader*>(base);
+    if(memcmp(header->magic, SITEPACK_MAGIC, sizeof(SITEPACK_MAGIC)) != 0 || header->version != SITEPACK_VERSION
+            || header->fileSize != image_->size || header->indexOffset % alignof(SitePackEntry) != 0
+            || header->indexOffset > image_->size
+            || header->count > (image_->size - header->indexOffset) / sizeof(SitePackEntry)
+            || header->stringsOffset > image_->size || header->stringsSize > image_->size - header->stringsOffset) {
+        return false;
+    }
+    const SitePackEntry* index = reinterpret_cast<const SitePackEntry*>(base + header->indexOffset);
+    const char* strings = base + header->stringsOffset;
+    auto validString = [header](uint32_t off, uint32_t len) {
+        return off <= header->stringsSize && len <= header->stringsSize - off;
+    };
+
+    files_.reserve(header->count);
+    for(uint32_t i = 0; i < header->count; i++) {
+        const SitePackEntry& item = index[i];
+        if(item.offset > image_->size || item.size > image_->size - item.offset
+                || !validString(item.pathOff, item.pathLen) || item.pathLen == 0
+                || !validString(item.etagOff, item.etagLen)
+                || !validString(item.lastModifiedOff, item.lastModifiedLen)) {
+            return false;
+        }
+        std::shared_ptr<FileEntry> entry = std::make_shared<FileEntry>();
+        entry->path.assign(strings + item.pathOff, item.pathLen);
+        // 二分查找要求路径严格递增（也就排除了重复的路径）
+        if(!files_.empty() && files_.back()->path >= entry->path) {
+            return false;
+        }
+        memset(&entry->st, 0, sizeof(entry->st));
+        entry->st.st_mode = S_IFREG | (item.mode & 07777);
+        entry->st.st_size = item.size;
+        entry->st.st_ino = i + 1;   // 只用来生成multipart的分隔符
+        entry->st.st_mtim.tv_sec = item.mtimeSec;
+        entry->st.st_mtim.tv_nsec = item.mtimeNsec;
+        entry->image = image_;
+        entry->fd = image_->fd;
+        entry->offset = item.offset;
+        entry->data = item.size > 0 ? image_->data + item.offset : nullptr;
+        entry->size = item.size;
+        entry->mime = Router::MimeType(StrView(entry->path.data(), entry->path.size()));
+        entry->etag.assign(strings + item.etagOff, item.etagLen);
+        entry->lastModified.assign(strings + item.lastModifiedOff, item.lastModifiedLen);
+        files_.push_back(std::move(entry));
+    }
+
+    // 压缩版本的检查结果现在就记下来（和目录里的一样，比原文件旧的不用）
+    for(const FileRef& file : files_) {
+        uint8_t sidecars = 0;
+        for(int i = 0; precompressed && i < ENCODING_COUNT; i++) {
+            std::string path = file->path + FileCache::EncodingSuffix(static_cast<ENCODING>(i));
+            const FileRef* sidecar = Lookup_(StrView(path.data(), path.size()));
+            if(sidecar && ((*sidecar)->st.st_mtim.tv_sec > file->st.st_mtim.tv_sec
+                    || ((*sidecar)->st.st_mtim.tv_sec == file->st.st_mtim.tv_sec
+                        && (*sidecar)->st.st_mtim.tv_nsec >= file->st.st_mtim.tv_nsec))) {
+                sidecars |= 1 << i;
+            }
+        }
+        file->sidecars.store(sidecars | FileEntry::SIDECARS_CHECKED, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+const FileRef* SiteArchive::Lookup_(const StrView& path) const {
+    size_t lo = 0, hi = files_.size();
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const std::string& name = files_[mid]->path;
+        int cmp = memcmp(name.data(), path.data, std::min(name.size(), path.len));
+        if(cmp == 0) {
+            if(name.size() == path.len) { return &files_[mid]; }
+            cmp = name.size() < path.len ? -1 : 1;
+        }
+        if(cmp < 0) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return nullptr;
+}
+
+bool SiteArchive::Find(const StrView& path, FileRef* file) const {
+    const FileRef* found = Lookup_(path);
+    if(!found) {
+        return false;
+    }
+    *file = *found;
+    return true;
+}
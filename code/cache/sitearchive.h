@@ -0,0 +1,55 @@
+#ifndef SITE_ARCHIVE_H
+#define SITE_ARCHIVE_H
+
+/**********************************************************************
+ * ----------------------------SiteArchive-----------------------------
+ *
+ * 只读的站点镜像（格式见sitepack.h）：整个文件只打开、映射一次，每个文件对应
+ * 一个预先建好的FileEntry，data指向映射里面的一段，sendfile用镜像的fd加偏移。
+ * 查找就是在排好序的数组里二分，请求路径上没有任何文件系统调用。
+ *
+ * FileEntry持有SiteImage（映射本身）的引用，换上新镜像以后，旧镜像在最后一个
+ * 响应发完时才munmap、close；SiteArchive自己只是目录，不被FileEntry引用。
+ *
+***********************************************************************/
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "filecache.h"
+
+// 映射进来的镜像文件，站点镜像里面的所有FileEntry共用
+struct SiteImage {
+    int fd = -1;
+    char* data = nullptr;
+    size_t size = 0;
+
+    SiteImage() = default;
+    ~SiteImage();
+    SiteImage(const SiteImage&) = delete;
+    SiteImage& operator=(const SiteImage&) = delete;
+};
+
+class SiteArchive {
+public:
+    // 打开、映射并检查path，precompressed决定要不要记下各个文件的压缩版本；失败返回nullptr
+    static std::shared_ptr<const SiteArchive> Load(const std::string& path, bool precompressed);
+
+    // 取出path（相对路径）对应的文件，没有时返回false
+    bool Find(const StrView& path, FileRef* file) const;
+
+    const SiteImage& Image() const { return *image_; }
+    size_t Count() const { return files_.size(); }
+
+private:
+    SiteArchive() = default;
+
+    // 目录检查通过以后建好每个文件的FileEntry
+    bool Build_(bool precompressed);
+    const FileRef* Lookup_(const StrView& path) const;
+
+    std::shared_ptr<SiteImage> image_;
+    std::vector<FileRef> files_;    // 按路径排序
+};
+
+#endif //SITE_ARCHIVE_H
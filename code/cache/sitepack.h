@@ -0,0 +1,53 @@
+#ifndef SITE_PACK_H
+#define SITE_PACK_H
+
+/**********************************************************************
+ * ------------------------------SitePack------------------------------
+ *
+ * 站点镜像的文件格式（sitepack/打包生成，服务器启动时整个映射进来，见SiteArchive）：
+ *
+ *   [SitePackHeader][文件内容……][SitePackEntry × count][字符串区]
+ *
+ * 1、文件内容按SITEPACK_ALIGN对齐，不小于一页的文件按页对齐（sendfile、madvise、
+ *    mlock都按页处理）；
+ * 2、目录项按路径（字节序）排好，服务器二分查找；路径、ETag、Last-Modified都放在
+ *    字符串区，用（偏移，长度）引用；
+ * 3、压缩版本和普通文件一样是单独的目录项（path.gz、path.br），打包时为没有
+ *    预压缩版本的文本文件生成gzip版本；
+ * 4、整数都是本机字节序，打包和服务要在同一种架构上。
+ *
+***********************************************************************/
+
+#include <cstdint>
+
+static const char SITEPACK_MAGIC[8] = { 'W', 'S', 'P', 'A', 'C', 'K', '\r', '\n' };
+static const uint32_t SITEPACK_VERSION = 1;
+static const uint64_t SITEPACK_ALIGN = 64;
+static const uint64_t SITEPACK_PAGE = 4096;
+
+struct SitePackHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             // 目录项个数
+    uint64_t indexOffset;       // 目录（SitePackEntry数组）的偏移
+    uint64_t stringsOffset;     // 字符串区的偏移
+    uint64_t stringsSize;
+    uint64_t fileSize;          // 整个镜像的大小（用来发现截断的文件）
+};
+
+struct SitePackEntry {
+    uint64_t offset;            // 内容的偏移
+    uint64_t size;
+    int64_t mtimeSec;           // 原文件的修改时间（条件请求用）
+    int64_t mtimeNsec;
+    uint32_t mode;              // 原文件的权限位
+    uint32_t pathOff;           // 相对资源目录的路径（以'/'开头）
+    uint32_t pathLen;
+    uint32_t etagOff;           // 强ETag（带引号）
+    uint32_t etagLen;
+    uint32_t lastModifiedOff;   // HTTP-date
+    uint32_t lastModifiedLen;
+    uint32_t reserved;
+};
+
+#endif //SITE_PACK_H
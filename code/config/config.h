@@ -1 +1,159 @@
+#ifndef CONFIG_H
+#define CONFIG_H
 
+/**********************************************************************
+ * -------------------------------Config-------------------------------
+ *
+ * 服务器的可调参数，都带有默认值；main.cpp里面按需修改以后传给WebServer，
+ * WebServer再把它挂到HttpConn::config上供各个连接使用（只读）。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 请求各阶段的超时时间和大小限制（防止slowloris之类的慢速攻击长期占着连接）
+struct LimitConfig {
+    int idleTimeoutMS = 60000;          // keep-alive连接等待下一个请求的时间（由WebServer的timeoutMS决定）
+    int headerTimeoutMS = 15000;        // 从请求的第一个字节到头部收完
+    int bodyTimeoutMS = 15000;          // 收请求体的基础时间
+    int writeTimeoutMS = 15000;         // 发送响应的基础时间
+    size_t minRateBps = 4096;           // 最低传输速率（字节/秒），请求体和响应按大小额外放宽时间
+    size_t maxHeaderBytes = 8192;       // 请求行+请求头的最大字节数，超过返回431（请求行过长返回414）
+    int maxHeaderCount = 64;            // 请求头的最大行数，超过返回431
+    size_t maxBodyBytes = 1 << 20;      // 请求体的最大字节数，超过返回413（头部收完就拒绝，不读请求体）
+};
+
+// HTTP/2（h2c，明文）的参数
+struct Http2Config {
+    bool enable = true;                     // 是否接受h2c（Upgrade升级和直接发送连接前言两种方式）
+    uint32_t maxConcurrentStreams = 100;    // 同时打开的流的上限
+    uint32_t initialWindowSize = 1 << 20;   // 每个流的接收窗口
+    uint32_t connWindowSize = 16 << 20;     // 整个连接的接收窗口
+    size_t maxOutputBytes = 256 * 1024;     // 一轮处理最多生成多少字节的帧（文件数据会拷贝到写缓冲区）
+};
+
+// WebSocket（/ws）的参数
+struct WebSocketConfig {
+    bool enable = true;                     // 是否接受Upgrade: websocket
+    size_t maxMessageBytes = 1 << 20;       // 一条消息（分片拼起来以后）的上限，超过以1009关闭
+    int pingIntervalMS = 30000;             // 连接空闲这么久以后发送PING（定时器未启用时不发送）
+    int pongTimeoutMS = 10000;              // 发送PING以后这么久没有收到任何数据就关闭连接
+};
+
+// 文件上传（POST /upload，multipart/form-data）的参数
+struct UploadConfig {
+    bool enable = false;                    // 默认关闭（任何客户端都能往磁盘上写文件），需要时在main.cpp里打开
+    const char* dir = "./upload/";          // 上传文件保存的目录（相对于工作目录，启动时创建）
+    size_t maxBodyBytes = 1ul << 30;        // 整个请求体的上限（代替LimitConfig::maxBodyBytes），超过返回413
+    size_t maxFileBytes = 512ul << 20;      // 单个文件的上限
+    size_t maxFieldBytes = 64 * 1024;       // 单个普通字段的上限
+    int maxParts = 32;                      // 部分的个数上限
+    size_t readChunkBytes = 256 * 1024;     // 收请求体时一轮最多读进读缓冲区的字节数（内存占用和上传大小无关）
+    bool splice = true;                     // 文件内容用splice从socket直接搬进文件
+};
+
+// 静态文件缓存（fd、stat信息、只读映射，inotify监视资源目录自动失效）的参数
+struct FileCacheConfig {
+    bool enable = true;                     // 关闭时每个请求都重新打开、映射文件
+    size_t maxEntries = 1024;               // 缓存的文件个数上限（每个文件占一个fd），超过淘汰最久没用的
+    size_t prebuiltMaxBytes = 16 * 1024;    // 不超过这个大小的文件缓存整个响应（keep-alive和close各一份），0表示不缓存
+    bool precompressed = true;              // 客户端接受时发送同目录下预先压缩好的file.br、file.gz
+    const char* archive = nullptr;          // 站点镜像（sitepack打包的文件），设置以后先在镜像里面找，找不到再找资源目录；
+                                            //  开启缓存（enable）时监视镜像文件，新镜像rename过来以后自动加载（不能原地改写）；
+                                            //  关闭缓存时只在启动时加载一次
+    bool warmup = false;                    // 启动时（开始监听之前）把资源目录里的文件打开、映射、预读进内存
+    size_t warmupBytes = 256 << 20;         // 预热的文件一共不超过这么大（从小文件开始，文件个数不超过maxEntries）
+    size_t mlockBytes = 0;                  // 预热时从小到大把文件锁在内存里（mlock），一共不超过这么多，0表示不锁
+};
+
+// 动态压缩（没有预压缩兄弟文件的文本资源，后台gzip一次以后缓存）的参数
+struct CompressConfig {
+    bool enable = true;
+    size_t minBytes = 1024;                 // 小于这个大小的文件不压缩（省下的字节抵不过额外的开销）
+    size_t maxFileBytes = 8 << 20;          // 大于这个大小的文件不压缩（压缩耗时，结果也不适合放在内存里）
+    int level = 6;                          // zlib的压缩级别
+    size_t cacheBytes = 32 << 20;           // 压缩结果的总大小上限，超过淘汰最久没用的
+};
+
+// 响应的发送方式
+struct SendConfig {
+    bool sendfile = true;                   // 大文件用sendfile从fd发送（HTTP/1.x），否则writev映射的内存
+    size_t sendfileMinBytes = 64 * 1024;    // 文件达到这个大小才用sendfile，小文件和响应头一次writev更划算
+    bool nodelay = true;                    // 关闭Nagle（TCP_NODELAY），一次写完的小响应马上发出去
+    bool cork = true;                       // 响应头后面还有文件、或者流水线上还有请求时用TCP_CORK攒成满的报文段
+    int notsentLowat = 128 * 1024;          // TCP_NOTSENT_LOWAT：内核里还没发出去的数据少于这么多才可写，0表示不设置
+    size_t turnBytes = 256 * 1024;          // 一个连接每轮（一次EPOLLOUT）最多写多少字节，用完了重新排队，0表示不限制
+    int turnMicros = 2000;                  // 每轮最多写多长时间（微秒），0表示不限制
+    bool zerocopy = false;                  // 内存里的大响应体（动态压缩的结果、不用sendfile时的文件）用MSG_ZEROCOPY发送
+    size_t zerocopyMinBytes = 1 << 20;      // 剩余的响应体达到这个大小才用零拷贝（锁定页面和完成通知也有开销）
+};
+
+// 限速规则：路径前缀和MIME类型都匹配、响应体又足够大时，这个响应按rateBps发送（每个连接分别计算）
+struct PaceRule {
+    const char* prefix;     // 路径前缀，nullptr表示任意路径
+    const char* mime;       // MIME类型前缀（例如"video/"），nullptr表示任意类型
+    size_t minBytes;        // 响应体达到这个大小才限速
+    size_t rateBps;         // 每秒多少字节
+    size_t burstBytes;      // 开头可以不限速发送的字节数（让播放尽快开始）
+};
+
+// 大文件（音视频、大图片）的发送限速，避免少数下载占满上行带宽
+struct PacingConfig {
+    bool enable = false;                    // 默认关闭（下面的速率只是示例，要按实际带宽在main.cpp里设置以后再打开）
+    bool kernel = true;                     // 默认qdisc是fq时用SO_MAX_PACING_RATE交给内核限速，否则在写调度里用令牌桶
+    size_t connRateBps = 0;                 // 没有规则匹配时每个连接的速率，0表示不限速
+    size_t connBurstBytes = 1 << 20;
+    std::vector<PaceRule> rules = {         // 前面的规则优先
+        { nullptr, "video/", 0, 4 << 20, 4 << 20 },
+        { nullptr, "audio/", 0, 1 << 20, 1 << 20 },
+        { nullptr, "image/", 1 << 20, 8 << 20, 1 << 20 },
+    };
+};
+
+// 缓存策略：路径前缀和后缀都匹配时使用（前面的规则优先），maxAge<0表示可以缓存但每次都要验证（no-cache）
+struct CacheRule {
+    const char* prefix;     // 路径前缀，nullptr表示任意路径
+    const char* suffix;     // 路径后缀（例如".css"），nullptr表示任意后缀
+    int maxAge;             // 秒
+};
+
+// 静态资源的Cache-Control、Expires，以及带内容指纹的URL
+struct CachePolicyConfig {
+    bool enable = true;
+    bool expires = true;                    // 同时发送Expires（给只认HTTP/1.0的缓存）
+    bool fingerprint = false;               // /css/style.<crc32>.css对应/css/style.css，指纹对得上时按immutable缓存一年
+                                            //  （页面里要引用带指纹的URL才有用，默认关闭）
+    std::vector<CacheRule> rules = {
+        { nullptr, ".html", -1 },
+        { nullptr, ".css", 3600 },
+        { nullptr, ".js", 3600 },
+        { "/images/", nullptr, 86400 },
+        { "/fonts/", nullptr, 7 * 86400 },
+    };
+};
+
+// 冷文件：要发送的文件内容不在页缓存里时交给后台线程读进来，工作线程不会因为读盘卡住
+struct ColdLoadConfig {
+    bool enable = true;
+    size_t minBytes = 256 * 1024;           // 文件部分不小于这么大的响应才检查（小文件基本都是缓存里的热点）
+    size_t windowBytes = 1024 * 1024;       // 每次检查、读入多大的一段（每发完一段检查下一段）
+    int threads = 2;                        // 读盘的线程数
+    size_t maxQueue = 256;                  // 排队的读盘请求超过这么多时不再排队，直接在工作线程里发送
+};
+
+struct ServerConfig {
+    LimitConfig limit;
+    Http2Config http2;
+    WebSocketConfig websocket;
+    UploadConfig upload;
+    FileCacheConfig fileCache;
+    CompressConfig compress;
+    SendConfig send;
+    PacingConfig pacing;
+    CachePolicyConfig cachePolicy;
+    ColdLoadConfig coldLoad;
+};
+
+#endif //CONFIG_H
@@ -1,15 +1,45 @@
 #include "httpconn.h"
+#include <algorithm>
+#include <sys/sendfile.h>
+#include <netinet/in.h>      // IP_RECVERR
+#include <linux/errqueue.h>  // sock_extended_err
+#include "tcpstats.h"
+#include "../cache/coldloader.h"
 using namespace std;
 
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
+const ServerConfig* HttpConn::config;
+bool HttpConn::kernelPacing;
 
 bool HttpConn::isET;
 
 HttpConn::HttpConn() { 
     fd_ = -1;
     addr_ = { 0 };
+    iovCnt_ = 0;
+    iov_[0].iov_len = iov_[1].iov_len = 0;
+    fileFd_ = -1;
+    fileOffset_ = 0;
+    fileRemain_ = 0;
+    rangeIdx_ = 0;
+    pendingBytes_ = 0;
+    corked_ = false;
+    responses_ = 0;
+    deficit_ = 0;
+    paceRate_ = paceBurst_ = paceSent_ = 0;
+    paceTokens_ = paceStampUS_ = 0;
+    kernelPaced_ = false;
+    paceWakeMS_ = 0;
+    zcEnabled_ = zcCopied_ = false;
+    zcSeq_ = zcDone_ = 0;
+    coldCheck_ = false;
+    residentEnd_ = coldData_ = nullptr;
+    coldLen_ = 0;
     isClose_ = true;
+    stage_ = IDLE;
+    deadlineMS_ = 0;
+    pingPending_ = false;
 };
 
 HttpConn::~HttpConn() { 
@@ -21,23 +51,92 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    corked_ = false;
+    responses_ = 0;
+    deficit_ = 0;
+    paceRate_ = 0;
+    kernelPaced_ = false;
+    paceWakeMS_ = 0;
+    zcEnabled_ = zcCopied_ = false;
+    zcSeq_ = zcDone_ = 0;
+    coldCheck_ = false;
+    residentEnd_ = coldData_ = nullptr;
+    coldLen_ = 0;
+    if(config->send.nodelay) {
+        int on = 1;
+        setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    // 限制socket里面排队的未发送数据：超过水位时sendmsg/sendfile返回EAGAIN，降到水位以下才有EPOLLOUT，
+    //  慢速客户端下载大文件时内核缓冲区不会越涨越大，数据按对端的接收速度一点点补上去
+    if(config->send.notsentLowat > 0) {
+        setsockopt(fd_, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &config->send.notsentLowat, sizeof(config->send.notsentLowat));
+    }
     // 每一个Http连接都有自己的用户态读写缓冲区
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    arena_.Reset();
+    request_.Init(&arena_, config);
+    h2_.reset();
+    ws_.reset();
+    pingPending_ = false;
+    // 新连接应该马上发请求过来，按请求头的超时时间计算
+    SetStage(READ_HEADER, config->limit.headerTimeoutMS);
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
 void HttpConn::Close() {
-    response_.UnmapFile();  // 解除内存映射
+    fileRemain_ = 0;
+    pendingBytes_ = 0;
+    paceRate_ = 0;
+    kernelPaced_ = false;
+    paceWakeMS_ = 0;        // 还在PaceTimer里面的唤醒作废
+    coldLen_ = 0;
+    zcPins_.clear();        // socket关闭以后收不到完成通知了，内核发送时自己持有页面的引用
+    zcEnabled_ = false;
+    response_.UnmapFile();  // 放弃对文件的引用（sendfile用的fd也属于它）
+    request_.AbortBody();   // 没收完的上传
+    h2_.reset();            // HTTP/2的各个流也有映射的文件
+    ws_.reset();
     if(isClose_ == false){
         isClose_ = true; 
         userCount--;
+        // 发出了多少个带数据的报文段（取不到时为0），和响应数一起用来比较不同的nodelay、cork设置
+        uint32_t segments = 0;
+        if(responses_ > 0) {
+            DataSegmentsOut(fd_, &segments);
+        }
         close(fd_);
-        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d, responses:%zu, segments:%u",
+                 fd_, GetIP(), GetPort(), (int)userCount, responses_, segments);
     }
 }
 
+int64_t HttpConn::NowMS_() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t HttpConn::NowUS_() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int HttpConn::RateTimeoutMS_(int baseMS, size_t bytes) {
+    size_t minRate = config->limit.minRateBps;
+    int64_t ms = baseMS + (minRate > 0 ? static_cast<int64_t>(bytes / minRate) * 1000 : 0);
+    return static_cast<int>(std::min<int64_t>(ms, INT32_MAX));
+}
+
+void HttpConn::SetStage(CONN_STAGE stage, int timeoutMS) {
+    deadlineMS_ = NowMS_() + timeoutMS;
+    stage_ = stage;
+}
+
+int64_t HttpConn::RemainingMS() const {
+    return deadlineMS_ - NowMS_();
+}
+
 int HttpConn::GetFd() const {
     return fd_;
 };
@@ -55,6 +154,9 @@ int HttpConn::GetPort() const {
 }
 
 ssize_t HttpConn::read(int* saveErrno) {
+    if(request_.StreamsBody()) {
+        return ReadBody_(saveErrno);
+    }
     // 一次性读出所有数据
     // printf("start HttpConn::read\n");
     ssize_t len = -1;
@@ -68,26 +170,149 @@ ssize_t HttpConn::read(int* saveErrno) {
     return len;
 }
 
+// 上传的请求体：每轮最多读readChunkBytes，交给process()写进文件以后再读下一块（EPOLLONESHOT重新注册
+//  EPOLLIN时，socket里还有数据的话会再次触发），读缓冲区不会随着上传的大小增长；读缓冲区空着、又正好
+//  在文件内容中间的时候，直接从socket搬进文件
+ssize_t HttpConn::ReadBody_(int* saveErrno) {
+    ssize_t total = 0;
+    while(static_cast<size_t>(total) < config->upload.readChunkBytes) {
+        ssize_t len = 0;
+        if(readBuff_.ReadableBytes() == 0 && request_.CanSpliceBody()) {
+            len = request_.SpliceBody(fd_, saveErrno);
+        }
+        if(len == 0) {
+            len = readBuff_.ReadFd(fd_, saveErrno);
+        }
+        if(len <= 0) {
+            return total > 0 ? total : len;
+        }
+        total += len;
+        if(!isET) { break; }
+    }
+    return total;
+}
+
 ssize_t HttpConn::write(int* saveErrno) {
     ssize_t len = -1;
     //write的每个循环都有3种情况：
     //  （1）第一块没写完；（2）第一块写完，第二块没写完；（3）两块都写完；
+    //  走sendfile的响应只有第一块（响应头），写完以后再用sendfile发送文件；
+    //  206的各段依次放上来（分段头放第一块，文件内容放第二块或者sendfile）
     // 一次性写完数据避免
+    //  响应头后面还有文件或者后续的段，或者流水线上还有下一个请求（HTTP/1.x）时先塞住socket，
+    //  头部、文件和后面的响应攒成满的报文段再发，这一批都发完了再拔掉（最后不满的一段马上发出去）
+    if(config->send.cork && !corked_ && (fileRemain_ > 0 || pendingBytes_ > 0
+            || (!h2_ && !ws_ && readBuff_.ReadableBytes() > 0))) {
+        SetCork_(true);
+    }
+    //  顺便读掉已经到达的零拷贝完成通知，发完的文件尽早释放
+    if(!zcPins_.empty()) {
+        ReapZeroCopy();
+    }
+    //  每轮有字节和时间的额度（差额轮询）：用完了就返回，连接重新注册EPOLLOUT，排到线程池队列的后面，
+    //  一个快速下载大文件的客户端不会一直占着工作线程，其他连接的小请求不用等它
+    const bool budget = config->send.turnBytes > 0;
+    const bool timed = config->send.turnMicros > 0;
+    std::chrono::steady_clock::time_point start;
+    if(budget) {
+        deficit_ += config->send.turnBytes;
+    }
+    if(timed) {
+        start = std::chrono::steady_clock::now();
+    }
+    //  限速的响应（内核不能限速时）：按经过的时间往令牌桶里补充令牌，桶的容量就是允许突发的字节数
+    const bool paced = paceRate_ > 0 && !kernelPacing;
+    if(paced) {
+        int64_t now = NowUS_();
+        paceTokens_ = std::min<int64_t>(paceBurst_,
+            paceTokens_ + (now - paceStampUS_) * static_cast<int64_t>(paceRate_) / 1000000);
+        paceStampUS_ = now;
+    }
+    auto turnOver = [&] {
+        return (budget && deficit_ <= 0) || (paced && paceTokens_ <= 0) || (timed
+            && std::chrono::steady_clock::now() - start >= std::chrono::microseconds(config->send.turnMicros));
+    };
     do {
+        if(paced && paceTokens_ <= 0) { len = 0; break; }   // 令牌还没有补回来
+        if(iov_[0].iov_len + iov_[1].iov_len == 0 && fileRemain_ == 0) {
+            if(pendingBytes_ == 0) { break; } /* 传输结束 */
+            //  206的下一段，放上以后这一轮接着发（不能continue：剩下不到10KB时循环条件不成立，
+            //  这次write什么都没发就返回了len = -1）
+            LoadRange_();
+        }
+        if(iov_[0].iov_len + iov_[1].iov_len == 0) {
+            size_t chunk = std::min(fileRemain_, Allowance_(budget, paced));
+            if(coldCheck_) {
+                // 冷文件：只发已经确认在页缓存里的部分，下一段不在的话先交给ColdLoader读进来，这一轮到此为止
+                chunk = std::min(chunk, ResidentBytes_(response_.File() + (fileOffset_ - response_.FileOffset()), fileRemain_));
+                if(chunk == 0) {
+                    len = 0;
+                    break;
+                }
+            }
+            // sendfile由内核直接从页缓存拷贝到socket，socket缓冲区满时返回EAGAIN，下次从fileOffset_继续
+            len = sendfile(fd_, fileFd_, &fileOffset_, chunk);
+            if(len <= 0) {
+                // 返回0说明文件在发送期间被截短了，响应已经不完整，只能关闭连接
+                *saveErrno = (len == 0) ? EIO : errno;
+                len = -1;
+                break;
+            }
+            fileRemain_ -= len;
+            deficit_ -= len;
+            paceTokens_ -= len;
+            paceSent_ += len;
+            continue;
+        }
         // uio.h提供writev来分散写iov数组里面的数据（这里是将数据写到socket文件描述符中）
         //  写完以后有几种情况：
         //  （1）如果全部数据写入，则直接进入分支2；
         //  （2）如果只写了第一块的一部分，则len<iov[0]_.len，进入分支3
         //  （3）如果写完第一块，但第二块没写完，则先进入分支2，然后两块的len都转换为0;
-        len = writev(fd_, iov_, iovCnt_);//非阻塞
+        //  后面还有数据（sendfile的文件、206的下一段）时带上MSG_MORE，和后面的数据合并成满的报文段一起发出去
+        //  额度不够时只写前面一部分（复制一份iov截短，不动iov_本身）
+        struct iovec iov[2] = { iov_[0], iov_[1] };
+        size_t allowance = Allowance_(budget, paced);
+        if(iov[0].iov_len >= allowance) {
+            iov[0].iov_len = allowance;
+            iov[1].iov_len = 0;
+        } else {
+            iov[1].iov_len = std::min(iov[1].iov_len, allowance - iov[0].iov_len);
+        }
+        if(coldCheck_ && iov[1].iov_len > 0) {
+            iov[1].iov_len = std::min(iov[1].iov_len, ResidentBytes_(static_cast<const char*>(iov_[1].iov_base), iov_[1].iov_len));
+            if(iov[1].iov_len == 0) {
+                len = 0;
+                break;
+            }
+        }
+        int flags = (fileRemain_ > 0 || pendingBytes_ > 0) ? MSG_MORE : 0;
+        //  大的响应体用MSG_ZEROCOPY发送：内核直接引用这些页面，发完以后通过错误队列通知，在那之前文件一直由zcPins_持有；
+        //  写缓冲区发送以后马上会被复用，不能零拷贝，所以响应头先单独发出去（后面还有响应体，带上MSG_MORE）
+        bool zeroCopy = UseZeroCopy_(iov_[1].iov_len);
+        if(zeroCopy && iov[0].iov_len > 0) {
+            iov[1].iov_len = 0;
+            flags |= MSG_MORE;
+            zeroCopy = false;
+        }
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovCnt_;
+        len = sendmsg(fd_, &msg, flags | (zeroCopy ? MSG_ZEROCOPY : 0));//非阻塞
+        if(len < 0 && zeroCopy && errno == ENOBUFS) {
+            // 锁定的页面超过了socket的额度（optmem_max），这一次普通发送
+            zeroCopy = false;
+            len = sendmsg(fd_, &msg, flags);
+        }
+        if(len > 0 && zeroCopy) {
+            PinZeroCopy_();
+        }
         if(len <= 0) {//有可能数据没写完，但是socket的写缓冲区不够位置，返回EAGAIN，所以break
             *saveErrno = errno;
             break;
         }
-        // 这种情况是所有数据都传输结束了
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
         // 第一块的数据已经全部写入到socket中，接着写第二块内存，做相应的处理
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {
+        if(static_cast<size_t>(len) >= iov_[0].iov_len) {
             iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
             iov_[1].iov_len -= (len - iov_[0].iov_len);
             if(iov_[0].iov_len) {
@@ -101,46 +326,416 @@ ssize_t HttpConn::write(int* saveErrno) {
             iov_[0].iov_len -= len; 
             writeBuff_.Retrieve(len);
         }
-    } while(isET || ToWriteBytes() > 10240);//10KB
+        deficit_ -= len;
+        paceTokens_ -= len;
+        paceSent_ += len;
+    } while((isET || ToWriteBytes() > 10240) && !turnOver());//10KB
+    if(ToWriteBytes() == 0 || !budget) {
+        deficit_ = 0;       // 没有要发的数据了，额度不能攒到以后
+    }
+    if(paced && paceTokens_ <= 0 && ToWriteBytes() > 0 && (len >= 0 || *saveErrno == EAGAIN)) {
+        // 令牌用完了：等攒够一小块（20ms的量，不超过桶的容量）再写，避免每次只写几个字节
+        int64_t chunk = std::min<int64_t>(paceBurst_, std::max<size_t>(paceRate_ / 50, 1));
+        int64_t waitMS = ((chunk - paceTokens_) * 1000 + paceRate_ - 1) / paceRate_;
+        paceWakeMS_ = NowMS_() + std::max<int64_t>(waitMS, 1);
+    }
+    else if(paceRate_ > 0 && kernelPacing && !kernelPaced_ && paceSent_ >= paceBurst_) {
+        // 内核限速：突发的部分不限速发出去，之后交给fq按速率发送
+        unsigned int rate = static_cast<unsigned int>(std::min<size_t>(paceRate_, UINT32_MAX - 1));
+        kernelPaced_ = setsockopt(fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) == 0;
+    }
+    if(corked_ && ToWriteBytes() == 0 && readBuff_.ReadableBytes() == 0) {
+        SetCork_(false);
+    }
     return len;
 }
 
+bool HttpConn::UseZeroCopy_(size_t bodyLen) {
+    if(!config->send.zerocopy || zcCopied_ || h2_ || ws_ || bodyLen < config->send.zerocopyMinBytes
+            || !response_.CachedFile()) {
+        return false;
+    }
+    if(!zcEnabled_) {
+        int on = 1;
+        zcEnabled_ = setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+        zcCopied_ = !zcEnabled_;    // 内核不支持
+    }
+    return zcEnabled_;
+}
+
+void HttpConn::PinZeroCopy_() {
+    uint32_t seq = zcSeq_++;
+    const FileRef& file = response_.CachedFile();
+    if(!zcPins_.empty() && zcPins_.back().second == file) {
+        zcPins_.back().first = seq;
+    } else {
+        zcPins_.emplace_back(seq, file);
+    }
+}
+
+bool HttpConn::ReapZeroCopy() {
+    // 每条通知是一段连续的编号[ee_info, ee_data]，TCP按顺序完成
+    char control[128];
+    while(true) {
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;      // EAGAIN：通知都读完了
+        }
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            const struct sock_extended_err* err = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+            if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if(err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zcCopied_ = true;   // 内核退回了拷贝，零拷贝只剩额外的开销
+            }
+            if(static_cast<int32_t>(err->ee_data + 1 - zcDone_) > 0) {
+                zcDone_ = err->ee_data + 1;
+            }
+        }
+    }
+    while(!zcPins_.empty() && static_cast<int32_t>(zcDone_ - zcPins_.front().first) > 0) {
+        zcPins_.pop_front();
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len);
+    return error == 0;
+}
+
+size_t HttpConn::Allowance_(bool budget, bool paced) const {
+    size_t allowance = SIZE_MAX;
+    if(budget) {
+        allowance = std::max<int64_t>(deficit_, 1);
+    }
+    if(paced) {
+        allowance = std::min<size_t>(allowance, std::max<int64_t>(paceTokens_, 1));
+    }
+    return allowance;
+}
+
+void HttpConn::StartPacing_() {
+    StopPacing_();
+    const PacingConfig& pacing = config->pacing;
+    int code = response_.Code();
+    if(!pacing.enable || (code != 200 && code != 206)) {
+        return;
+    }
+    StrView path = request_.path();
+    StrView mime = response_.ContentType();
+    size_t len = response_.ContentLength();
+    paceRate_ = pacing.connRateBps;
+    paceBurst_ = pacing.connBurstBytes;
+    for(const PaceRule& rule : pacing.rules) {
+        if(rule.prefix && (path.len < strlen(rule.prefix) || memcmp(path.data, rule.prefix, strlen(rule.prefix)) != 0)) {
+            continue;
+        }
+        if(rule.mime && (mime.len < strlen(rule.mime) || memcmp(mime.data, rule.mime, strlen(rule.mime)) != 0)) {
+            continue;
+        }
+        if(len < rule.minBytes) {
+            continue;
+        }
+        paceRate_ = rule.rateBps;
+        paceBurst_ = rule.burstBytes;
+        break;
+    }
+    if(paceRate_ > 0) {
+        paceTokens_ = paceBurst_;
+        paceStampUS_ = NowUS_();
+        paceSent_ = 0;
+        LOG_DEBUG("pace %s: %zuB/s, burst %zu", path.data, paceRate_, paceBurst_);
+    }
+}
+
+void HttpConn::StopPacing_() {
+    paceRate_ = 0;
+    paceWakeMS_ = 0;
+    if(kernelPaced_) {
+        // 同一个连接上后面的响应不再限速（~0U表示不限）
+        unsigned int rate = ~0U;
+        setsockopt(fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate));
+        kernelPaced_ = false;
+    }
+}
+
+void HttpConn::Flush() {
+    if(corked_) {
+        SetCork_(false);
+    }
+}
+
+size_t HttpConn::ResidentBytes_(const char* data, size_t remain) {
+    if(data < residentEnd_) {
+        return std::min<size_t>(remain, residentEnd_ - data);
+    }
+    ColdLoader* loader = ColdLoader::Instance();
+    size_t window = std::min(remain, loader->Config().windowBytes);
+    residentEnd_ = data + window;
+    // 读盘队列满了就不排队了，和以前一样在这里等缺页
+    if(ColdLoader::Resident(data, window) || loader->Busy()) {
+        return window;
+    }
+    coldData_ = data;
+    coldLen_ = window;
+    paceWakeMS_ = NowMS_();
+    return 0;
+}
+
+bool HttpConn::TakeColdLoad(FileRef* file, const char** data, size_t* len) {
+    if(coldLen_ == 0) {
+        return false;
+    }
+    *file = response_.CachedFile();
+    *data = coldData_;
+    *len = coldLen_;
+    coldLen_ = 0;
+    return true;
+}
+
+void HttpConn::SetCork_(bool on) {
+    int val = on ? 1 : 0;
+    setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+    corked_ = on;
+}
+
+// 文件的[offset, offset + len)接在响应头后面发送：大的用sendfile，小的直接writev映射的内存
+void HttpConn::SetFileSlice_(size_t offset, size_t len) {
+    // 映射出来的文件才能检查在不在页缓存里，HTTP/2、WebSocket不走这里发送文件
+    coldCheck_ = ColdLoader::Instance()->Enabled() && response_.File() && !h2_ && !ws_
+        && len >= ColdLoader::Instance()->Config().minBytes;
+    residentEnd_ = nullptr;
+    fileRemain_ = 0;
+    iov_[1].iov_len = 0;
+    iovCnt_ = 1;
+    if(len == 0) {
+        return;
+    }
+    if(config->send.sendfile && len >= config->send.sendfileMinBytes && response_.FileFd() >= 0) {
+        fileFd_ = response_.FileFd();
+        fileOffset_ = response_.FileOffset() + offset;
+        fileRemain_ = len;
+    }
+    else if(response_.File()) {
+        iov_[1].iov_base = response_.File() + offset;
+        iov_[1].iov_len = len;
+        iovCnt_ = 2;
+    }
+}
+
+// 放上206的下一段：分段头追加到写缓冲区（上一段发完时写缓冲区是空的），文件部分按大小选择发送方式
+void HttpConn::LoadRange_() {
+    const HttpResponse::Range& range = response_.Ranges()[rangeIdx_++];
+    if(!range.head.empty()) {
+        writeBuff_.Append(range.head.data, range.head.len);
+        iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+        iov_[0].iov_len = writeBuff_.ReadableBytes();
+    }
+    pendingBytes_ -= range.head.len + range.len;
+    SetFileSlice_(range.offset, range.len);
+}
+
 // 处理用户发送过来的请求（数据已经读到readBuffer中）
 //  业务逻辑处理（这里只提供了一个资源访问功能）
+// 返回true表示响应已经准备好，false表示还需要继续读数据
 bool HttpConn::process() {
-    // Step1：初始化请求对象
+    // 已经升级到HTTP/2了，之后都按帧处理
+    if(h2_) {
+        return ProcessHttp2_();
+    }
+    if(ws_) {
+        return ProcessWebSocket_();
+    }
+    // Step1：上一个请求已经处理完了（响应也发送完毕），回收它占用的arena内存，开始新请求
     // printf("start HttpConn::process()\n");
-    request_.Init();
+    if(request_.State() == HttpRequest::FINISH) {
+        arena_.Reset();
+        request_.Init(&arena_, config);
+        SetStage(IDLE, config->limit.idleTimeoutMS);
+    }
     
     // Step2：尝试读取缓冲区的数据并进行相应处理
-    if(readBuff_.ReadableBytes() <= 0) {    // 判断是否有请求数据
+    //  （上传的请求体可能已经全部splice进文件了，读缓冲区是空的也要让parse()收尾）
+    if(readBuff_.ReadableBytes() <= 0 && !request_.StreamsBody()) {    // 判断是否有请求数据
         // printf("No available data, return false\n");
         return false;
     }
-    else if(request_.parse(readBuff_)) {    // 有数据就解析HTTP请求
-        LOG_DEBUG("%s", request_.path().c_str());
-        // 初始化响应对象（返回HTTP状态码：200-OK）
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+    if(stage_ == IDLE) {
+        SetStage(READ_HEADER, config->limit.headerTimeoutMS);
+    }
+    // 新请求以HTTP/2的连接前言开头（prior knowledge），直接切换到HTTP/2
+    if(config->http2.enable && request_.State() == HttpRequest::REQUEST_LINE) {
+        readBuff_.Linearize();
+        int preface = Http2Session::MatchPreface(readBuff_);
+        if(preface == 0) { return false; }      // 还不能确定，等更多数据
+        if(preface > 0) {
+            h2_.reset(new Http2Session(srcDir, config));
+            h2_->Start(writeBuff_);
+            return ProcessHttp2_();
+        }
+    }
+    HttpRequest::HTTP_CODE ret = request_.parse(readBuff_);
+    if(ret == HttpRequest::NO_REQUEST) {    // 请求还不完整，继续等数据
+        if(request_.State() == HttpRequest::BODY && stage_ != READ_BODY) {
+            SetStage(READ_BODY, RateTimeoutMS_(config->limit.bodyTimeoutMS, request_.ContentLength()));
+            if(request_.ExpectContinue()) {
+                // 请求头已经通过检查，告诉客户端可以发请求体了
+                writeBuff_.Append("HTTP/1.1 100 Continue\r\n\r\n");
+                iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+                iov_[0].iov_len = writeBuff_.ReadableBytes();
+                iov_[1].iov_len = 0;
+                iovCnt_ = 1;
+                fileRemain_ = 0;
+                pendingBytes_ = 0;
+                coldCheck_ = false;
+                residentEnd_ = nullptr;
+                StopPacing_();
+                return true;
+            }
+        }
+        return false;
+    }
+    else if(ret == HttpRequest::GET_REQUEST) {  // 解析完成
+        LOG_DEBUG("%s", request_.path().data);
+        // Upgrade: h2c（只升级没有请求体的请求），这个请求改为在HTTP/2的流1上回复
+        if(config->http2.enable && request_.ContentLength() == 0 && request_.version() == "1.1"
+                && request_.HeaderHasToken("Upgrade", "h2c") && request_.HeaderHasToken("Connection", "Upgrade")
+                && request_.HeaderHasToken("Connection", "HTTP2-Settings")) {
+            std::unique_ptr<Http2Session> h2(new Http2Session(srcDir, config));
+            if(h2->StartUpgrade(writeBuff_, request_.GetHeader("HTTP2-Settings"), request_.method(), request_.path())) {
+                h2_ = std::move(h2);
+                return ProcessHttp2_();
+            }
+        }
+        // WebSocket：握手合法就回复101，之后按帧处理；不是握手的请求回复400
+        if(request_.route() && request_.route()->action == RouteAction::WEBSOCKET) {
+            if(IsWebSocketUpgrade_()) {
+                ws_.reset(new WebSocket(&config->websocket));
+                WebSocket::WriteHandshake(writeBuff_, request_.GetHeader("Sec-WebSocket-Key"));
+                return ProcessWebSocket_();
+            }
+            response_.Init(&arena_, srcDir, request_, false, 400);
+        }
+        else {
+            // 初始化响应对象（返回HTTP状态码：200-OK）
+            response_.Init(&arena_, srcDir, request_, request_.IsKeepAlive(), 200);
+        }
     } else {                                // 解析失败
-        // 初始化响应对象（返回HTTP状态码：400-客户端请求错误）
-        response_.Init(srcDir, request_.path(), false, 400);
+        // 初始化响应对象（返回解析时得到的错误码，例如400、414、431），回复完以后关闭连接
+        response_.Init(&arena_, srcDir, request_, false, request_.ErrorCode());
     }
 
-    // Step3：生成响应信息（往writeBuff_中写入响应信息）
-    response_.MakeResponse(writeBuff_);
+    // Step3：生成响应信息
+    response_.Prepare();
+    responses_++;
+    fileRemain_ = 0;
+    pendingBytes_ = 0;
+    // 冷文件检查只属于上一个响应的文件（预先拼好的响应不走SetFileSlice_，不能沿用）
+    coldCheck_ = false;
+    residentEnd_ = nullptr;
+    StartPacing_();
+
+    // 小文件：除了状态行和Date，整个响应已经在文件缓存里面拼好了，一次writev直接发送
+    StrView whole = response_.Prebuilt();
+    if(!whole.empty()) {
+        response_.WriteStatus(writeBuff_);
+        iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+        iov_[0].iov_len = writeBuff_.ReadableBytes();
+        iov_[1].iov_base = const_cast<char*>(whole.data);
+        iov_[1].iov_len = whole.len;
+        iovCnt_ = 2;
+        SetStage(WRITE, RateTimeoutMS_(config->limit.writeTimeoutMS, ToWriteBytes()));
+        LOG_DEBUG("prebuilt response: %zu bytes", iov_[0].iov_len + whole.len);
+        return true;
+    }
 
-    // 响应头
+    // 响应头（往writeBuff_中写入响应信息）
+    response_.WriteHead(writeBuff_);
     iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
     iov_[0].iov_len = writeBuff_.ReadableBytes();
     iovCnt_ = 1;
+    iov_[1].iov_len = 0;
 
-    // 要传输的资源文件（返回mmFile_，而事实上mmFile里面已经在process()过程中完成了mmap）
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+    // 要传输的资源文件（文件缓存里面的只读映射，响应持有引用直到发完）
+    //  大文件改用sendfile从fd直接发送，数据不经过用户态，也不会在用户态触发缺页
+    if(response_.RangeCount() > 0) {
+        // 206：各段按顺序发送，先放上第一段，后面的在write()里面接着放
+        rangeIdx_ = 0;
+        pendingBytes_ = response_.ContentLength();
+        LoadRange_();
+    }
+    else {
+        SetFileSlice_(0, response_.FileLen());
     }
+    SetStage(WRITE, RateTimeoutMS_(config->limit.writeTimeoutMS, ToWriteBytes()));
     
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
+    LOG_DEBUG("filesize:%zu, %d  to %zu%s", response_.FileLen() , iovCnt_, ToWriteBytes(), fileRemain_ ? " (sendfile)" : "");
     return true;
 }
+
+bool HttpConn::ProcessHttp2_() {
+    h2_->Process(readBuff_, writeBuff_);
+    if(writeBuff_.ReadableBytes() == 0) {
+        // 没有要发的数据（等对端的请求或者WINDOW_UPDATE）
+        if(stage_ != IDLE) {
+            SetStage(IDLE, config->limit.idleTimeoutMS);
+        }
+        return false;
+    }
+    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+    iov_[0].iov_len = writeBuff_.ReadableBytes();
+    iov_[1].iov_len = 0;
+    iovCnt_ = 1;
+    fileRemain_ = 0;
+    pendingBytes_ = 0;
+    StopPacing_();
+    SetStage(WRITE, RateTimeoutMS_(config->limit.writeTimeoutMS, ToWriteBytes()));
+    return true;
+}
+
+bool HttpConn::IsWebSocketUpgrade_() const {
+    return config->websocket.enable && request_.method() == "GET" && request_.version() == "1.1"
+        && request_.ContentLength() == 0
+        && request_.HeaderHasToken("Upgrade", "websocket") && request_.HeaderHasToken("Connection", "Upgrade")
+        && request_.GetHeader("Sec-WebSocket-Version") == "13"
+        && WebSocket::IsValidKey(request_.GetHeader("Sec-WebSocket-Key"));
+}
+
+bool HttpConn::ProcessWebSocket_() {
+    // 对端发来了数据（不管是不是PONG），说明连接还活着
+    if(readBuff_.ReadableBytes() > 0) {
+        pingPending_ = false;
+    }
+    ws_->Process(readBuff_, writeBuff_);
+    if(writeBuff_.ReadableBytes() == 0) {
+        SetStage(IDLE, pingPending_ ? config->websocket.pongTimeoutMS : config->websocket.pingIntervalMS);
+        return false;
+    }
+    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+    iov_[0].iov_len = writeBuff_.ReadableBytes();
+    iov_[1].iov_len = 0;
+    iovCnt_ = 1;
+    fileRemain_ = 0;
+    pendingBytes_ = 0;
+    StopPacing_();
+    SetStage(WRITE, RateTimeoutMS_(config->limit.writeTimeoutMS, ToWriteBytes()));
+    return true;
+}
+
+bool HttpConn::SendPing(int timeoutMS) {
+    // IDLE说明写缓冲区已经发完、也没有工作线程在往socket上写，一个完整的PING帧不会和别的帧交错；
+    //  先置标志再发送，避免PONG比标志先到
+    if(pingPending_) {
+        return false;
+    }
+    pingPending_ = true;
+    SetStage(IDLE, timeoutMS);
+    ssize_t len = send(fd_, WebSocket::PING_FRAME, WebSocket::PING_FRAME_LEN, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return len == static_cast<ssize_t>(WebSocket::PING_FRAME_LEN);
+}
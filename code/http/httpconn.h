@@ -3,19 +3,38 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/socket.h>  // send
 #include <arpa/inet.h>   // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY, TCP_CORK
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <utility>
 
 #include "../log/log.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "../config/config.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "../http2/http2session.h"
+#include "../websocket/websocket.h"
 
 // Http连接类，其中封装了请求和响应对象
 class HttpConn {
 public:
+    // 连接当前所处的阶段，每个阶段有自己的超时时间（由WebServer的定时器检查）
+    enum CONN_STAGE {
+        IDLE,           // keep-alive，等待下一个请求
+        READ_HEADER,    // 正在接收请求行和请求头
+        READ_BODY,      // 正在接收请求体
+        WRITE,          // 正在发送响应
+    };
+
     HttpConn();
 
     ~HttpConn();
@@ -38,34 +57,131 @@ public:
     
     bool process();
 
-    int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+    // process()没有生成新的响应（流水线上的下一个请求还不完整）时调用：把塞住的响应发出去
+    void Flush();
+
+    // socket上打开了SO_ZEROCOPY：EPOLLERR可能只是错误队列里的完成通知
+    bool ZeroCopyEnabled() const { return zcEnabled_; }
+    // 读出错误队列里的零拷贝完成通知，释放发送完的文件；socket真的出错了返回false
+    bool ReapZeroCopy();
+
+    // 限速的响应用完了令牌：write()返回以后应当在这个时间（steady_clock毫秒）再写，0表示不需要等
+    int64_t PaceWakeMS() const { return paceWakeMS_; }
+    // write()因为文件接下来的部分不在页缓存里停下来时，取出要读进来的那一段（取一次就清掉）；
+    //  读完以后和限速一样，在PaceWakeMS()的时间（已经过去了）唤醒
+    bool TakeColdLoad(FileRef* file, const char** data, size_t* len);
+    // 主线程在唤醒时间到了以后调用：确认连接还在等这一次唤醒（没有关闭、没有换成别的连接）
+    bool WakePaced(int64_t whenMS) { return paceWakeMS_.compare_exchange_strong(whenMS, 0); }
+
+    size_t ToWriteBytes() const { 
+        return iov_[0].iov_len + iov_[1].iov_len + fileRemain_ + pendingBytes_; 
     }
 
-    //是否为长连接
+    //是否为长连接（以响应为准，出错的请求即使要求keep-alive也会关闭）
+    //  收请求体阶段发出去的只可能是100 Continue，发完还要接着收请求体
+    //  HTTP/2连接一直保持，直到GOAWAY；WebSocket连接一直保持，直到发送CLOSE
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        if(h2_) { return !h2_->IsClosing(); }
+        if(ws_) { return !ws_->IsClosing(); }
+        return stage_ == READ_BODY || response_.IsKeepAlive();
     }
 
+    bool IsClose() const { return isClose_; }
+
+    // 切换阶段，同时设置该阶段的截止时间（只在阶段切换时调用，不会随着每次收发数据刷新）
+    void SetStage(CONN_STAGE stage, int timeoutMS);
+    CONN_STAGE Stage() const { return stage_; }
+    // 距离当前阶段的截止时间还有多少毫秒（已经超时则<=0）
+    int64_t RemainingMS() const;
+
+    // 已经升级成WebSocket（主线程先确认Stage()是IDLE再调用，stage_的原子读写保证能看到ws_）
+    bool IsWebSocket() const { return ws_ != nullptr; }
+    // 主线程的定时器调用：空闲的WebSocket连接直接在socket上发送PING，并把截止时间改为等PONG的时间；
+    //  上一个PING还没有回应（或者发送失败）时返回false，应当关闭连接
+    bool SendPing(int timeoutMS);
+
     static bool isET;                   // 边沿触发
     static const char* srcDir;          // 资源的目录
     static std::atomic<int> userCount;  // 当前总共有多少个客户连接数
+    static const ServerConfig* config;  // 服务器配置（只读）
+    static bool kernelPacing;           // 限速交给内核（SO_MAX_PACING_RATE），否则用令牌桶
     
 private:
-   
+    static int64_t NowMS_();
+    static int64_t NowUS_();
+    // 按最低传输速率放宽超时时间：base + bytes / minRate
+    static int RateTimeoutMS_(int baseMS, size_t bytes);
+    // HTTP/2：处理收到的帧，生成的帧直接放到写缓冲区
+    bool ProcessHttp2_();
+    // 流式接收上传的请求体，每轮只读一块
+    ssize_t ReadBody_(int* saveErrno);
+    // 请求是不是合法的WebSocket握手
+    bool IsWebSocketUpgrade_() const;
+    // WebSocket：处理收到的帧，回复直接放到写缓冲区
+    bool ProcessWebSocket_();
+    // 响应体：文件的一段（或者整个文件）
+    void SetFileSlice_(size_t offset, size_t len);
+    void LoadRange_();
+    void SetCork_(bool on);
+    // 文件接下来的[data, data + remain)里面可以马上发送的字节数（已经确认在页缓存里的部分）；
+    //  下一个窗口不在页缓存里时记下来交给ColdLoader，返回0（这一轮不再发送）
+    size_t ResidentBytes_(const char* data, size_t remain);
+    // 按限速规则决定这个响应的发送速率
+    void StartPacing_();
+    void StopPacing_();
+    // 这一次系统调用最多可以写多少字节（差额轮询的额度和令牌桶里的令牌）
+    size_t Allowance_(bool budget, bool paced) const;
+    // 这一段响应体要不要用MSG_ZEROCOPY发送（第一次用到时打开SO_ZEROCOPY）
+    bool UseZeroCopy_(size_t bodyLen);
+    // 记下刚刚成功的一次零拷贝发送引用的文件
+    void PinZeroCopy_();
+
     int fd_;
     struct  sockaddr_in addr_;
 
     bool isClose_;
+
+    std::atomic<CONN_STAGE> stage_;     // 当前阶段（工作线程修改，主线程的定时器读取）
+    std::atomic<int64_t> deadlineMS_;   // 当前阶段的截止时间（steady_clock，毫秒）
     
     int iovCnt_;            // 可用的（不含数据）分散内存的数量
     struct iovec iov_[2];   // 分散内存
+    int fileFd_;            // 用sendfile发送的文件（文件缓存的fd，由response_持有）
+    off_t fileOffset_;      // 文件下一次从哪里开始发
+    size_t fileRemain_;     // 文件还剩多少字节没发，0表示这个响应不走sendfile
+    size_t rangeIdx_;       // 206：下一个要放上来的段
+    size_t pendingBytes_;   // 206：还没放上来的段一共多少字节（分段头+文件内容）
+    bool corked_;           // socket设置了TCP_CORK，数据攒在内核里还没有发出去
+    size_t responses_;      // 这个连接上回复了多少个响应（HTTP/1.x），关闭时和发出的报文段数一起记进日志
+    int64_t deficit_;       // 发送额度（差额轮询）：每轮加turnBytes，写多少扣多少，超出的部分下一轮先还上
+    size_t paceRate_;       // 当前响应的发送速率（字节/秒），0表示不限速
+    size_t paceBurst_;      // 令牌桶的容量（允许突发的字节数）
+    int64_t paceTokens_;    // 令牌桶里还有多少字节
+    int64_t paceStampUS_;   // 上一次补充令牌的时间
+    size_t paceSent_;       // 当前响应已经发了多少字节（内核限速时，突发部分发完才设置速率）
+    bool kernelPaced_;      // socket上设置了SO_MAX_PACING_RATE
+    std::atomic<int64_t> paceWakeMS_;   // 令牌用完以后等到什么时候再写（工作线程设置，主线程唤醒时清零）
+    bool zcEnabled_;        // socket上打开了SO_ZEROCOPY
+    bool zcCopied_;         // 内核实际上还是拷贝了（例如回环接口）或者不支持，这个连接以后不再用零拷贝
+    uint32_t zcSeq_;        // 成功的MSG_ZEROCOPY发送的次数（内核按这个编号通知完成）
+    uint32_t zcDone_;       // 编号小于它的零拷贝发送都已经完成
+    std::deque<std::pair<uint32_t, FileRef>> zcPins_;   // 零拷贝发送还没有完成的文件（引用它的最后一次发送的编号，文件）
+    bool coldCheck_;        // 当前这一段文件要检查在不在页缓存里（够大，而且没有关掉）
+    const char* residentEnd_;   // 已经确认在页缓存里（或者已经读进来）的位置，发到这里之前不再检查
+    const char* coldData_;  // 要交给ColdLoader读进来的一段
+    size_t coldLen_;
     
     Buffer readBuff_;       // 读(请求)缓冲区，保存请求数据的内容
     Buffer writeBuff_;      // 写(响应)缓冲区，保存响应数据的内容
 
+    Arena arena_;           // 请求级内存池，请求和响应的字符串都从这里分配，每个请求开始时Reset
+
     HttpRequest request_;   // 请求对象
     HttpResponse response_; // 响应对象
+
+    std::unique_ptr<Http2Session> h2_;  // 升级到HTTP/2以后的协议状态（nullptr表示HTTP/1.x）
+    std::unique_ptr<WebSocket> ws_;     // 升级到WebSocket以后的协议状态
+    std::atomic<bool> pingPending_;     // 已经发送了PING，还没有收到对端的任何数据
 };
 
 
@@ -1,228 +1,380 @@
 #include "httprequest.h"
+#include <algorithm>
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
-
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+HttpRequest::HttpRequest() {
+    arena_ = nullptr;
+    limit_ = nullptr;
+    upload_ = nullptr;
+    route_ = nullptr;
+    state_ = REQUEST_LINE;
+    errorCode_ = 0;
+    headerBytes_ = contentLength_ = 0;
+    headerCount_ = 0;
+    expectContinue_ = bodyDiscarded_ = false;
+    header_ = post_ = nullptr;
+    bodyRemaining_ = 0;
+}
 
-// 初始化请求对象信息
-void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+// 初始化请求对象信息（arena由连接在新请求开始时统一Reset，这里只需要把指针清空）
+void HttpRequest::Init(Arena* arena, const ServerConfig* config) {
+    assert(arena && config);
+    arena_ = arena;
+    limit_ = &config->limit;
+    upload_ = &config->upload;
+    method_ = path_ = version_ = body_ = query_ = StrView();
+    route_ = nullptr;
     state_ = REQUEST_LINE; 
-    header_.clear();
-    post_.clear();
+    errorCode_ = 0;
+    headerBytes_ = contentLength_ = 0;
+    headerCount_ = 0;
+    expectContinue_ = bodyDiscarded_ = false;
+    header_ = post_ = nullptr;
+    multipart_.reset();
+    bodyRemaining_ = 0;
 }
 
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    const Field* conn = FindField_(header_, StrView("Connection", 10), true);
+    if(conn && !bodyDiscarded_) {
+        return conn->value.EqualsIgnoreCase("keep-alive") && version_ == "1.1";
     }
     return false;
 }
 
 // 解析HTTP请求的数据
-bool HttpRequest::parse(Buffer& buff) {
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
     // printf("parsing Data\n");
     const char CRLF[] = "\r\n"; // 行结束符
-    if(buff.ReadableBytes() <= 0) {
-        return false;
-    }
-    // buff中有数据可读，并且状态没有到FINISH，就一直解析
-    while(buff.ReadableBytes() && state_ != FINISH) {
+    // 解析时需要[Peek, Peek + ReadableBytes)是连续的内存
+    buff.Linearize();
+    // 状态没有到FINISH，就一直解析，数据不够时返回NO_REQUEST，等收到更多数据再接着解析
+    while(state_ != FINISH) {
+        const char* begin = buff.Peek();
+        const char* end = begin + buff.ReadableBytes();
+        if(state_ == BODY && multipart_) {
+            // 上传的请求体：收到多少解析多少（文件内容直接写进文件），读缓冲区里面最多留下半个分隔符
+            size_t n = std::min(static_cast<size_t>(end - begin), bodyRemaining_);
+            size_t used = multipart_->Feed(begin, n, n == bodyRemaining_);
+            buff.Retrieve(used);
+            bodyRemaining_ -= used;
+            if(multipart_->State() == MultipartParser::FAILED) {
+                int code = multipart_->ErrorCode();
+                multipart_.reset();     // 删掉已经写下的文件
+                return Error_(code);
+            }
+            if(bodyRemaining_ > 0) { return NO_REQUEST; }
+            EndMultipart_();
+            break;
+        }
+        if(state_ == BODY) {
+            // 请求体按Content-Length收齐以后一次性解析
+            if(static_cast<size_t>(end - begin) < contentLength_) { return NO_REQUEST; }
+            SetBody(begin, begin + contentLength_);
+            buff.Retrieve(contentLength_);
+            break;
+        }
         // 获取一行数据，找到缓冲区当前第一个\r\n为结束标志（后两个参数是被查找内容的地址）
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buff.Peek(), lineEnd);//特殊的string构造形式
+        const char* lineEnd = search(begin, end, CRLF, CRLF + 2);
+        size_t consumed = (lineEnd == end ? end - begin : lineEnd + 2 - begin);
+        if(headerBytes_ + consumed > limit_->maxHeaderBytes) {
+            return Error_(state_ == REQUEST_LINE ? 414 : 431);
+        }
+        if(lineEnd == end) { return NO_REQUEST; }   // 一行还没收完
+        headerBytes_ += consumed;
+        // 直接在Buffer上解析[begin, lineEnd)这一行，需要保存的部分才拷贝到arena里面
         switch(state_)
         {
             case REQUEST_LINE:
-                // 解析请求首行
-                if(!ParseRequestLine_(line)) {
-                    return false;
+                // 请求行前面的空行直接忽略
+                if(begin == lineEnd) { break; }
+                // 解析请求首行（同时解析出请求资源路径）
+                if(HTTP_CODE ret = ParseRequestLine_(begin, lineEnd)) {
+                    return ret;
                 }
-                // 解析出请求资源路径
-                ParsePath_();
                 break;
             case HEADERS:
-                // 解析请求头
-                ParseHeader_(line);
-                // 这里是为了处理只有“请求行”和“HEADER”的GET请求报文，如果没有BODY的数据，
-                //  则readbuff剩下\r\n
-                if(buff.ReadableBytes() <= 2) {
-                    state_ = FINISH;
+                // 空行表示头部结束，否则解析一行请求头
+                if(HTTP_CODE ret = (begin == lineEnd ? EndHeaders() : ParseHeader_(begin, lineEnd))) {
+                    return ret;
                 }
                 break;
-            case BODY:
-                // 解析请求体
-                ParseBody_(line);
-                break;
             default:
                 break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; }//说明没数据可读，因为lineEnd找不到数据了
         buff.RetrieveUntil(lineEnd + 2);//剩下2个字符 (\r\n)，所以+2
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    LOG_DEBUG("[%s], [%s], [%s]", method_.data, path_.data, version_.data);
     // printf("parse Data Finish\n");
-    return true;
+    return GET_REQUEST;
+}
+
+// 请求出错：记下响应码，之后这个请求不再继续解析（连接会在回复错误以后关闭）
+HttpRequest::HTTP_CODE HttpRequest::Error_(int code) {
+    errorCode_ = code;
+    state_ = FINISH;
+    LOG_WARN("Bad request: %d", code);
+    return BAD_REQUEST;
 }
 
 void HttpRequest::ParsePath_() {
-    // 如果访问根目录，默认表示访问index.html
-    // 例如 http://192.168.110.111:10000/
-    if(path_ == "/") {
-        path_ = "/index.html"; 
-    }
-    else {
-        // 其他默认的一些页面
-        // 例如 http://192.168.110.111:10000/regist
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
-        }
+    // 查静态路由表（编译期生成的完美哈希），默认页面直接映射到对应的html文件
+    // 例如 http://192.168.110.111:10000/ -> /index.html，/regist -> /register.html
+    route_ = Router::Match(path_);
+    if(route_ && route_->file) {
+        path_ = StrView(route_->file, route_->fileLen);
     }
 }
 
-bool HttpRequest::ParseRequestLine_(const string& line) {
+HttpRequest::HTTP_CODE HttpRequest::ParseRequestLine_(const char* begin, const char* end) {
     // GET / HTTP/1.1
-    //[^ ]*表示除了空格以外的任意多个字符，每个括号匹配一个字段
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
-        return true;
+    // 格式为“方法 空格 路径 空格 HTTP/版本”，方法、路径、版本里面都不能再出现空格
+    const char* sp1 = std::find(begin, end, ' ');
+    const char* sp2 = (sp1 == end) ? end : std::find(sp1 + 1, end, ' ');
+    if(sp2 != end && std::find(sp2 + 1, end, ' ') == end
+            && end - (sp2 + 1) >= 5 && memcmp(sp2 + 1, "HTTP/", 5) == 0) {
+        return SetRequestLine(StrView(begin, sp1), StrView(sp1 + 1, sp2), StrView(sp2 + 6, end));
     }
     LOG_ERROR("RequestLine Error");
-    return false;
+    return Error_(400);
+}
+
+HttpRequest::HTTP_CODE HttpRequest::SetRequestLine(const StrView& method, const StrView& target, const StrView& version) {
+    method_ = arena_->CopyStr(method);
+    version_ = arena_->CopyStr(version);
+    // 在arena的拷贝上原地解码、切分查询串并消除./..，穿越到根目录之外的路径直接拒绝
+    StrView copy = arena_->CopyStr(target);
+    if(!Uri::ParseTarget(const_cast<char*>(copy.data), copy.len, &path_, &query_)) {
+        LOG_WARN("Bad request target: %s", copy.data);
+        path_ = StrView();
+        return Error_(400);
+    }
+    ParsePath_();
+    state_ = HEADERS;
+    return NO_REQUEST;
 }
 
 // Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.9
 // Connection: keep-alive
-void HttpRequest::ParseHeader_(const string& line) {
-    // 使用正则表达式分离出key:value这种配对
-    // 第一个^表示字符串开头，()表示子表达式的开始结束位置，$表示字符串结尾
-    // 第二个^表示取反，?表示匹配前面的子表达式零次或一次，.表示任意字符
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
+// 返回NO_REQUEST表示这一行没问题、继续解析
+HttpRequest::HTTP_CODE HttpRequest::ParseHeader_(const char* begin, const char* end) {
+    // 分离出key:value这种配对，冒号后面最多跳过一个空格
     //注意header会有多行
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+    const char* colon = std::find(begin, end, ':');
+    if(colon == end || colon == begin) {
+        return Error_(400);
     }
-    else {//这里是不匹配的情况，解析到header和body之间的\r\n会出现这种情况
-        state_ = BODY;
+    const char* value = colon + 1;
+    if(value != end && *value == ' ') { value++; }
+    return AddHeader(StrView(begin, colon), StrView(value, end));
+}
+
+HttpRequest::HTTP_CODE HttpRequest::AddHeader(const StrView& key, const StrView& value) {
+    if(++headerCount_ > limit_->maxHeaderCount) {
+        return Error_(431);
     }
+    header_ = arena_->New<Field>(arena_->CopyStr(key), arena_->CopyStr(value), header_);
+    return NO_REQUEST;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
-    ParsePost_();
+// 请求头结束（解析到header和body之间的\r\n），根据Content-Length决定要不要继续收请求体
+HttpRequest::HTTP_CODE HttpRequest::EndHeaders() {
+    StrView te = GetHeader("Transfer-Encoding");
+    if(!te.empty() && !te.EqualsIgnoreCase("identity")) {
+        return Error_(501);     // 不支持chunked的请求体
+    }
+    StrView cl = GetHeader("Content-Length");
+    contentLength_ = 0;
+    for(const char* p = cl.begin(); p != cl.end(); p++) {
+        if(*p < '0' || *p > '9' || contentLength_ > (SIZE_MAX - 9) / 10) {
+            return Error_(400);
+        }
+        contentLength_ = contentLength_ * 10 + (*p - '0');
+    }
+    bool upload = IsUpload_();
+    if(contentLength_ > (upload ? upload_->maxBodyBytes : limit_->maxBodyBytes)) {
+        return Error_(413);     // 请求体过大，不用等它发过来
+    }
+    state_ = (contentLength_ > 0) ? BODY : FINISH;
+    if(upload) {
+        multipart_.reset(new MultipartParser(MultipartParser::Boundary(GetHeader("Content-Type")), upload_));
+        bodyRemaining_ = contentLength_;
+        // HTTP/2可以不带Content-Length（请求体在END_STREAM结束），这时最多收到上传的上限
+        if(cl.empty() && version_ == "2.0") {
+            state_ = BODY;
+            bodyRemaining_ = upload_->maxBodyBytes;
+        }
+    }
+    return CheckExpect_();
+}
+
+// 处理Expect: 100-continue：头部收完就决定要不要这个请求体，要的话让连接先回复100 Continue，
+//  不要的话直接给出最终响应，客户端不会再把请求体发过来
+HttpRequest::HTTP_CODE HttpRequest::CheckExpect_() {
+    StrView expect = GetHeader("Expect");
+    if(expect.empty()) {
+        return NO_REQUEST;
+    }
+    if(!expect.EqualsIgnoreCase("100-continue")) {
+        return Error_(417);
+    }
+    // HTTP/1.0的客户端不认识100 Continue；没有请求体时也没什么可等的
+    if(version_ != "1.1" || state_ != BODY) {
+        return NO_REQUEST;
+    }
+    if(AcceptsBody_()) {
+        expectContinue_ = true;
+    }
+    else {
+        // 这个路由用不到请求体，直接按没有请求体处理，回复完关闭连接（请求体没有读，连接上的数据已经不可用）
+        LOG_DEBUG("Expect: 100-continue rejected, skip body (%zu bytes)", contentLength_);
+        bodyDiscarded_ = true;
+        state_ = FINISH;
+    }
+    return NO_REQUEST;
+}
+
+// 只有登录、注册的表单和上传会用到请求体，其他请求的请求体读了也是丢掉
+bool HttpRequest::AcceptsBody_() const {
+    return IsForm_() || IsUpload_();
+}
+
+bool HttpRequest::IsForm_() const {
+    return method_ == "POST" && route_
+        && (route_->action == RouteAction::LOGIN || route_->action == RouteAction::REGISTER)
+        && GetHeader("Content-Type") == "application/x-www-form-urlencoded";
+}
+
+bool HttpRequest::IsUpload_() const {
+    return upload_->enable && method_ == "POST" && route_ && route_->action == RouteAction::UPLOAD
+        && !MultipartParser::Boundary(GetHeader("Content-Type")).empty();
+}
+
+ssize_t HttpRequest::SpliceBody(int fd, int* saveErrno) {
+    assert(StreamsBody());
+    ssize_t len = multipart_->SpliceFrom(fd, bodyRemaining_, saveErrno);
+    if(len > 0) {
+        bodyRemaining_ -= len;
+    }
+    return len;
+}
+
+// 上传完成：字段和文件（保存的路径）都放到表单数据里面，之后GetPost可以取到
+void HttpRequest::EndMultipart_() {
+    multipart_->Commit();
+    for(const MultipartParser::Part& part : multipart_->Parts()) {
+        post_ = arena_->New<Field>(arena_->CopyStr(part.name.data(), part.name.size()),
+                                   arena_->CopyStr(part.value.data(), part.value.size()), post_);
+    }
+    multipart_.reset();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
 }
 
-// 将十六进制的字符，转换成十进制的整数
-int HttpRequest::ConverHex(char ch) {
-    if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
-    if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
-    return ch;
+size_t HttpRequest::FeedBody(const char* begin, const char* end, bool last) {
+    assert(StreamsBody());
+    size_t n = end - begin;
+    // 带了Content-Length的请求体必须正好是这么长；没带的超过上传的上限返回413
+    bool sized = !GetHeader("Content-Length").empty();
+    if(n > bodyRemaining_ || (last && sized && n != bodyRemaining_)) {
+        multipart_.reset();     // 删掉已经写下的文件
+        Error_(sized ? 400 : 413);
+        return n;
+    }
+    size_t used = multipart_->Feed(begin, n, last);
+    bodyRemaining_ -= used;
+    if(multipart_->State() == MultipartParser::FAILED) {
+        int code = multipart_->ErrorCode();
+        multipart_.reset();
+        Error_(code);
+        return n;
+    }
+    if(last) {
+        EndMultipart_();
+    }
+    return used;
+}
+
+void HttpRequest::SetBody(const char* begin, const char* end) {
+    body_ = arena_->CopyStr(begin, end - begin);
+    LOG_DEBUG("Body:%s, len:%zu", body_.data, body_.len);   // 表单解析会原地改写body_，先打印
+    ParsePost_();
+    state_ = FINISH;
 }
 
 void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if(method_ == "POST" && GetHeader("Content-Type") == "application/x-www-form-urlencoded") {
         // 解析表单信息
         ParseFromUrlencoded_();
-        // 检查请求路径是否为register.html和login.html中的一个，否则不可能有输入用户和密码的数据
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                //根据tag判断表单信息是否来自login的页面
-                bool isLogin = (tag == 1);
-                //根据结果返回html
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
+        // 只有登录和注册的路由才会有输入用户和密码的数据
+        if(IsForm_()) {
+            bool isLogin = (route_->action == RouteAction::LOGIN);
+            LOG_DEBUG("isLogin:%d", isLogin);
+            //根据结果返回html
+            if(UserVerify(GetPost("username"), GetPost("password"), isLogin)) {
+                path_ = StrView("/welcome.html", 13);
+            } 
+            else {
+                path_ = StrView("/error.html", 11);
             }
         }
     }   
 }
 
 void HttpRequest::ParseFromUrlencoded_() {
-    if(body_.size() == 0) { return; }
+    if(body_.len == 0) { return; }
     // 这里的解析格式其实是由Content-Type决定的，前端html页面以表单的形式提交数据，所以
     //  Content-Type为application/x-www-form-urlencoded，其格式为：key1=value1&key2=value2&...
     //  eg. username=zhangsan&password=123
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-    
-    //继续使用switch进行解析
-    for(; i < n; i++) {
-        char ch = body_[i];
-        switch (ch) {
-        case '=':
-            //获取key值
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-        case '+':
-            //该content-type会在传输数据时把空格替换成加号，所以现在要替换回来
-            body_[i] = ' ';
-            break;
-        case '%':
-            // key和value都被前端进行了简单的加密，传输过来的数据就是一串
-            //  带%的码，eg.username=%E9%AB%98%E8&password=123
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-        case '&':
-            //获取value值
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default:
-            break;
+    // key和value都经过了百分号编码（eg.username=%E9%AB%98%E8&password=123），空格被编码成'+'。
+    // body_是arena里面的拷贝（末尾带'\0'），先定位好'&'和'='再原地解码，解码结果末尾补'\0'
+    char* p = const_cast<char*>(body_.data);
+    char* end = p + body_.len;
+    while(p < end) {
+        char* pairEnd = std::find(p, end, '&');
+        char* eq = std::find(p, pairEnd, '=');
+        char* value = (eq == pairEnd) ? pairEnd : eq + 1;
+        size_t keyLen = Uri::UrlDecode(p, eq - p, true);
+        size_t valueLen = Uri::UrlDecode(value, pairEnd - value, true);
+        p[keyLen] = '\0';
+        value[valueLen] = '\0';
+        if(keyLen > 0) {
+            post_ = arena_->New<Field>(StrView(p, keyLen), StrView(value, valueLen), post_);
+            LOG_DEBUG("%s = %s", p, value);
         }
-    }
-    assert(j <= i);//说明数据包有问题
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+        p = pairEnd + 1;
     }
 }
 
 // 用户验证（整合了登录和注册的验证）
-bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+// name和pwd都来自arena，末尾带'\0'，可以直接当C字符串使用
+bool HttpRequest::UserVerify(const StrView& name, const StrView& pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    LOG_INFO("Verify name:%s pwd:%s", name.data, pwd.data);
     MYSQL* sql;
     SqlConnRAII(&sql,  SqlConnPool::Instance());
     assert(sql);//这里太暴力了，正常来说应该进行重试，到达重试次数以后发送一个数据库繁忙的http响应
     
+    // 表单里的值已经URL解码过（%27会变成单引号），拼进SQL之前必须转义；
+    //  超过表里字段长度（char(50)）的用户名、密码直接拒绝
+    static const size_t MAX_FIELD = 50;
+    if(name.len > MAX_FIELD || pwd.len > MAX_FIELD) {
+        SqlConnPool::Instance()->FreeConn(sql);
+        return false;
+    }
+    char nameEsc[MAX_FIELD * 2 + 1];
+    char pwdEsc[MAX_FIELD * 2 + 1];
+    mysql_real_escape_string(sql, nameEsc, name.data, name.len);
+    mysql_real_escape_string(sql, pwdEsc, pwd.data, pwd.len);
+
     bool flag = false;
     unsigned int j = 0;
-    char order[256] = { 0 };        //存放sql命令
+    char order[512] = { 0 };        //存放sql命令
     MYSQL_FIELD *fields = nullptr;  //存放结果集的列信息（行数列数啥的）
     MYSQL_RES *res = nullptr;       //存放结果集
     
     if(!isLogin) { flag = true; }
-    /* 查询用户及密码（正常来说不应该这样写死，容易被SQL注入攻击） */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
+    /* 查询用户及密码（用户名已经转义） */
+    snprintf(order, sizeof(order), "SELECT username, password FROM user WHERE username='%s' LIMIT 1", nameEsc);
     LOG_DEBUG("%s", order);
 
     if(mysql_query(sql, order)) {       //执行mysql命令
@@ -236,10 +388,9 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     //MYSQL_ROW是数组，返回结果集(MYSQL_RES)的当前行的结果（逐行取用），结果不为空则进入判断逻辑
     while(MYSQL_ROW row = mysql_fetch_row(res)) {
         LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
         /* 登录行为 and 用户名未被使用*/
         if(isLogin) {
-            if(pwd == password) { flag = true; }
+            if(pwd == row[1]) { flag = true; }
             else {
                 flag = false;
                 LOG_DEBUG("pwd error!");
@@ -254,8 +405,8 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     /* 注册行为 and 用户名未被使用*/
     if(!isLogin && flag == true) {
         LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
+        bzero(order, sizeof(order));
+        snprintf(order, sizeof(order), "INSERT INTO user(username, password) VALUES('%s','%s')", nameEsc, pwdEsc);
         LOG_DEBUG( "%s", order);
         if(mysql_query(sql, order)) { 
             LOG_DEBUG( "Insert error!");
@@ -268,33 +419,46 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     return flag;
 }
 
-std::string HttpRequest::path() const{
-    return path_;
+// 在单链表中查找字段，找不到返回nullptr
+const HttpRequest::Field* HttpRequest::FindField_(const Field* list, const StrView& key, bool ignoreCase) {
+    for(const Field* f = list; f != nullptr; f = f->next) {
+        if(ignoreCase ? f->key.EqualsIgnoreCase(key) : f->key == key) {
+            return f;
+        }
+    }
+    return nullptr;
 }
 
-std::string& HttpRequest::path(){
-    return path_;
-}
-std::string HttpRequest::method() const {
-    return method_;
+// 请求头字段名大小写不敏感，找不到返回空串
+StrView HttpRequest::GetHeader(const char* key) const {
+    assert(key != nullptr);
+    const Field* f = FindField_(header_, StrView(key, strlen(key)), true);
+    return f ? f->value : StrView();
 }
 
-std::string HttpRequest::version() const {
-    return version_;
+bool HttpRequest::HeaderHasToken(const char* key, const char* token) const {
+    StrView value = GetHeader(key);
+    StrView want(token, strlen(token));
+    const char* p = value.begin();
+    while(p < value.end()) {
+        const char* comma = std::find(p, value.end(), ',');
+        const char* b = p;
+        const char* e = comma;
+        while(b < e && (*b == ' ' || *b == '\t')) { b++; }
+        while(e > b && (e[-1] == ' ' || e[-1] == '\t')) { e--; }
+        if(StrView(b, e).EqualsIgnoreCase(want)) { return true; }
+        p = comma + 1;
+    }
+    return false;
 }
 
-std::string HttpRequest::GetPost(const std::string& key) const {
-    assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
+StrView HttpRequest::GetPost(const StrView& key) const {
+    assert(!key.empty());
+    const Field* f = FindField_(post_, key, false);
+    return f ? f->value : StrView();
 }
 
-std::string HttpRequest::GetPost(const char* key) const {
+StrView HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
-}
\ No newline at end of file
+    return GetPost(StrView(key, strlen(key)));
+}
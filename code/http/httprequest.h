@@ -1,14 +1,17 @@
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
-#include <regex>
+#include <memory>
 #include <errno.h>     
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "../config/config.h"
+#include "uri.h"
+#include "router.h"
+#include "multipart.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
@@ -23,7 +26,8 @@ public:
         FINISH,         // 完成
     };
 
-    //暂时没什么用
+    // parse()的返回值：NO_REQUEST表示请求还不完整，GET_REQUEST表示解析完成，
+    //  BAD_REQUEST表示请求有问题（具体的响应码见ErrorCode()）
     enum HTTP_CODE {
         NO_REQUEST = 0,
         GET_REQUEST,
@@ -35,40 +39,94 @@ public:
         CLOSED_CONNECTION,
     };
     
-    HttpRequest() { Init(); }
+    HttpRequest();
     ~HttpRequest() = default;
 
-    void Init();
-    bool parse(Buffer& buff);
+    // 每个请求开始前调用，请求里面的所有字符串都从arena里面分配
+    void Init(Arena* arena, const ServerConfig* config);
+    // 增量解析：数据不完整时不消耗半行数据，等下一次读到更多数据再继续
+    HTTP_CODE parse(Buffer& buff);
 
-    std::string path() const;
-    std::string& path();
-    std::string method() const;
-    std::string version() const;
-    std::string GetPost(const std::string& key) const;
-    std::string GetPost(const char* key) const;
+    // 已经拆好字段的请求（例如HTTP/2的HEADERS帧）不经过parse()，按顺序调用下面几个函数，
+    //  返回值的含义和parse()一样（NO_REQUEST表示继续）
+    HTTP_CODE SetRequestLine(const StrView& method, const StrView& target, const StrView& version);
+    HTTP_CODE AddHeader(const StrView& key, const StrView& value);
+    HTTP_CODE EndHeaders();
+    void SetBody(const char* begin, const char* end);
+    // 分块交给的上传请求体（HTTP/2的DATA帧，StreamsBody()时调用）：收到一块解析一块，返回用掉的字节数，
+    //  没用掉的部分（不到一个分隔符或者半行头部）要和下一块拼起来再交给这里；last表示请求体到此结束
+    size_t FeedBody(const char* begin, const char* end, bool last);
+
+    PARSE_STATE State() const { return state_; }
+    int ErrorCode() const { return errorCode_; }
+    size_t ContentLength() const { return contentLength_; }
+    // 客户端带了Expect: 100-continue，并且请求已经通过检查，正在等我们回复100 Continue
+    bool ExpectContinue() const { return expectContinue_; }
+
+    // 流式接收的请求体（multipart上传）：不需要整个放进读缓冲区，连接每次只读一块交给parse()
+    bool StreamsBody() const { return state_ == BODY && multipart_ != nullptr; }
+    // 现在可以绕过读缓冲区，把socket上的文件内容直接搬进文件（读缓冲区里面没有剩下的请求体时才能用）
+    bool CanSpliceBody() const { return StreamsBody() && multipart_->CanSplice(); }
+    // 返回搬运的字节数，0表示这次不能splice，应当改为普通的读
+    ssize_t SpliceBody(int fd, int* saveErrno);
+    // 连接关闭时调用：没收完的上传要删掉已经写下的文件
+    void AbortBody() { multipart_.reset(); }
+
+    const StrView& path() const { return path_; }
+    const StrView& query() const { return query_; }
+    const Route* route() const { return route_; }
+    const StrView& method() const { return method_; }
+    const StrView& version() const { return version_; }
+    StrView GetHeader(const char* key) const;
+    // 逗号分隔的头部（Connection、Upgrade等）里面有没有某个值（大小写不敏感）
+    bool HeaderHasToken(const char* key, const char* token) const;
+    StrView GetPost(const StrView& key) const;
+    StrView GetPost(const char* key) const;
 
     bool IsKeepAlive() const;
 
 private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    // 请求头和表单字段的键值对，挂在Arena上的单链表（头插，后出现的同名字段覆盖前面的）
+    struct Field {
+        StrView key;
+        StrView value;
+        Field* next;
+        Field(const StrView& k, const StrView& v, Field* n) : key(k), value(v), next(n) {}
+    };
+
+    HTTP_CODE ParseRequestLine_(const char* begin, const char* end);
+    HTTP_CODE ParseHeader_(const char* begin, const char* end);
+    HTTP_CODE CheckExpect_();
+    bool AcceptsBody_() const;
+    bool IsForm_() const;
+    bool IsUpload_() const;
+    void EndMultipart_();
+    HTTP_CODE Error_(int code);
 
     void ParsePath_();
     void ParsePost_();
     void ParseFromUrlencoded_();
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+    static const Field* FindField_(const Field* list, const StrView& key, bool ignoreCase);
+    static bool UserVerify(const StrView& name, const StrView& pwd, bool isLogin);
 
+    Arena* arena_;          // 当前连接的请求级内存池
+    const LimitConfig* limit_;  // 大小限制
+    const UploadConfig* upload_;    // 上传的参数
     PARSE_STATE state_;     // 解析的状态
-    std::string method_, path_, version_, body_;    // 请求方法，请求路径，协议版本，请求体
-    std::unordered_map<std::string, std::string> header_;   // 请求头
-    std::unordered_map<std::string, std::string> post_;     // post请求表单数据
-
-    static const std::unordered_set<std::string> DEFAULT_HTML;  // 默认的网页
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG; 
-    static int ConverHex(char ch);  // 将十六进制字符转换成十进制整数
+    int errorCode_;         // 解析失败时要回复的状态码
+    size_t headerBytes_;    // 请求行+请求头已经消耗的字节数
+    int headerCount_;       // 请求头的行数
+    size_t contentLength_;  // 请求体长度
+    bool expectContinue_;   // 需要先回复100 Continue才能收到请求体
+    bool bodyDiscarded_;    // 请求体被跳过了（没有读），回复完以后必须关闭连接
+    StrView method_, path_, version_, body_;    // 请求方法，请求路径（已解码并规范化），协议版本，请求体
+    StrView query_;         // 查询串（'?'后面的部分，未解码）
+    const Route* route_;    // 命中的静态路由（没命中为nullptr）
+    Field* header_;         // 请求头
+    Field* post_;           // post请求表单数据
+    std::unique_ptr<MultipartParser> multipart_;    // 上传（multipart/form-data）的请求体解析器
+    size_t bodyRemaining_;  // 流式接收的请求体还有多少字节没收
 };
 
 
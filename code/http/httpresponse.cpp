@@ -1,38 +1,32 @@
 #include "httpresponse.h"
+#include <time.h>        // strptime, timegm
+#include <stdarg.h>
+#include <atomic>
+#include "httprequest.h"
+#include "../cache/compresscache.h"
 
 using namespace std;
 
-// 文件后缀 对应的 MIME-TYPE类型，用在响应头Content-Type中
-const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
-    { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
-    { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
-    { ".mpeg",  "video/mpeg" },
-    { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
-    { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
-};
-
 // 响应状态码对应的描述语
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 408, "Request Timeout" },
+    { 413, "Payload Too Large" },
+    { 414, "URI Too Long" },
+    { 416, "Range Not Satisfiable" },
+    { 417, "Expectation Failed" },
+    { 431, "Request Header Fields Too Large" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented" },
 };
 
+const CachePolicyConfig* HttpResponse::cachePolicy = nullptr;
+
 // 响应码对应的资源路径
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
@@ -40,123 +34,652 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 404, "/404.html" },
 };
 
+// 预先拼好的状态行（"HTTP/1.1 200 OK\r\n"），每个响应只需要一次拷贝
+const unordered_map<int, string> HttpResponse::STATUS_LINE = [] {
+    unordered_map<int, string> lines;
+    for(const auto& status : CODE_STATUS) {
+        lines[status.first] = "HTTP/1.1 " + to_string(status.first) + " " + status.second + "\r\n";
+    }
+    return lines;
+}();
+
+// 状态行和Date后面固定不变的头部，按长连接/短连接各拼一份
+static const char SERVER_CLOSE[] =
+    "Server: WebServer\r\n"
+    "Connection: close\r\n";
+static const char SERVER_KEEP_ALIVE[] =
+    "Server: WebServer\r\n"
+    "Connection: keep-alive\r\n"
+    //这里是写keep-alive的属性，max表示该链接最多还能接收几个http请求就要关闭
+    "keep-alive: max=6, timeout=120\r\n";
+
+// 格式化好的Date头（RFC 7231的IMF-fixdate），每个线程缓存一份，秒数变了才重新格式化
+struct DateLine {
+    time_t sec = -1;
+    char line[48];          // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+    size_t len = 0;
+};
+
+static const DateLine& CurrentDate() {
+    static thread_local DateLine date;
+    time_t now = time(nullptr);
+    if(now != date.sec) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        date.len = strftime(date.line, sizeof(date.line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        date.sec = now;
+    }
+    return date;
+}
+
+// Expires头：和Date一样每个线程缓存、每秒最多格式化一次，不同的max-age按哈希分别缓存（规则一般没几条）
+static StrView ExpiresLine(int maxAge) {
+    struct ExpiresCache {
+        time_t sec = -1;
+        int maxAge = -1;
+        char line[48];      // "Expires: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+        size_t len = 0;
+    };
+    static thread_local ExpiresCache caches[8];
+    time_t now = CurrentDate().sec;
+    ExpiresCache& cache = caches[(static_cast<uint32_t>(maxAge) * 2654435761u) >> 29];
+    if(cache.sec != now || cache.maxAge != maxAge) {
+        time_t expires = now + maxAge;
+        struct tm tm;
+        gmtime_r(&expires, &tm);
+        cache.len = strftime(cache.line, sizeof(cache.line), "Expires: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        cache.sec = now;
+        cache.maxAge = maxAge;
+    }
+    return StrView(cache.line, cache.len);
+}
+
+// 把整数格式化到栈上的临时数组里再追加，避免to_string产生临时对象
+static void AppendNum(Buffer& buff, size_t num) {
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    do {
+        *--p = '0' + num % 10;
+        num /= 10;
+    } while(num);
+    buff.Append(p, digits + sizeof(digits) - p);
+}
+
 HttpResponse::HttpResponse() {
     code_ = -1;
-    path_ = srcDir_ = "";
+    arena_ = nullptr;
+    request_ = nullptr;
+    ranges_ = nullptr;
+    rangeCount_ = rangeBytes_ = 0;
+    encoding_ = nullptr;
+    vary_ = false;
+    maxAge_ = -1;
+    immutable_ = false;
+    srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
 };
 
 HttpResponse::~HttpResponse() {
     UnmapFile();
 }
 
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
-    assert(srcDir != "");
+void HttpResponse::Init(Arena* arena, const char* srcDir, const HttpRequest& request, bool isKeepAlive, int code){
+    assert(arena && srcDir && *srcDir);
     
-    if(mmFile_) { UnmapFile(); }
+    UnmapFile();
 
     code_ = code;
     isKeepAlive_ = isKeepAlive;
-    path_ = path;
+    arena_ = arena;
+    request_ = &request;
+    path_ = request.path();
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    body_ = StrView();
+    ranges_ = nullptr;
+    rangeCount_ = rangeBytes_ = 0;
+    contentRange_ = contentType_ = mime_ = StrView();
+    encoding_ = nullptr;
+    vary_ = false;
+    cacheControl_ = StrView();
+    maxAge_ = -1;
+    immutable_ = false;
+    BuildFilePath_();
+}
+
+// 在arena上拼接出资源的完整路径（文件缓存没命中时用它打开文件）
+void HttpResponse::BuildFilePath_() {
+    size_t dirLen = strlen(srcDir_);
+    char* p = static_cast<char*>(arena_->Alloc(dirLen + path_.len + 1, 1));
+    memcpy(p, srcDir_, dirLen);
+    memcpy(p + dirLen, path_.data, path_.len);
+    p[dirLen + path_.len] = '\0';
+    filePath_ = StrView(p, dirLen + path_.len);
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
+    Prepare();
+    WriteHead(buff);
+}
+
+void HttpResponse::WriteHead(Buffer& buff) {
+    // 封装http数据
+    WriteStatus(buff);
+    AddHeader_(buff);
+    AddContent_(buff);
+}
+
+// 状态行和Date：Date每秒都在变，不能放进预先拼好的响应里
+void HttpResponse::WriteStatus(Buffer& buff) const {
+    auto it = STATUS_LINE.find(code_);
+    if(it != STATUS_LINE.end()) {
+        buff.Append(it->second);
+    } else {
+        buff.Append("HTTP/1.1 400 Bad Request\r\n");
+    }
+    const DateLine& date = CurrentDate();
+    buff.Append(date.line, date.len);
+    if(maxAge_ >= 0 && cachePolicy && cachePolicy->expires) {
+        StrView expires = ExpiresLine(maxAge_);
+        buff.Append(expires.data, expires.len);
+    }
+}
+
+StrView HttpResponse::Date() {
+    const DateLine& date = CurrentDate();
+    return StrView(date.line + 6, date.len - 8);
+}
+
+// 能放进预先拼好的响应的状态码（正常的文件、304和几个错误页面）
+int HttpResponse::PrebuiltSlot_() const {
+    int slot;
+    switch(code_) {
+        case 200: slot = 0; break;
+        case 304: slot = 1; break;
+        case 400: slot = 2; break;
+        case 403: slot = 3; break;
+        case 404: slot = 4; break;
+        default: return -1;
+    }
+    // 同一个压缩文件可能直接被请求，也可能作为预压缩版本发送，两种响应头不一样；
+    //  通过带指纹的URL访问时Cache-Control也不一样
+    return slot * 8 + (immutable_ ? 4 : 0) + (encoding_ ? 2 : 0) + (isKeepAlive_ ? 1 : 0);
+}
+
+StrView HttpResponse::Prebuilt() {
+    int slot = PrebuiltSlot_();
+    if(slot < 0 || !body_.empty() || !file_ || FileLen() > FileCache::Instance()->PrebuiltMaxBytes()
+            || FileCache::Instance()->PrebuiltMaxBytes() == 0) {
+        return StrView();
+    }
+    std::atomic<const string*>& cached = file_->prebuilt[slot];
+    const string* resp = cached.load(std::memory_order_acquire);
+    if(!resp) {
+        // 第一次用到：和WriteHead写出同样的响应头（状态行和Date除外），后面接上文件内容；
+        //  它属于缓存项而不是这个请求（比请求活得久），所以在堆上分配，每个缓存项每个槽只分配一次
+        Buffer head(256);
+        AddHeader_(head);
+        AddContent_(head);
+        string* built = new string(head.Peek(), head.ReadableBytes());
+        if(FileLen() > 0) {
+            built->append(file_->data, file_->size);
+        }
+        if(cached.compare_exchange_strong(resp, built, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            resp = built;
+        } else {
+            delete built;       // 别的线程已经放进去了一份，用它的
+        }
+    }
+    return StrView(resp->data(), resp->size());
+}
+
+void HttpResponse::Prepare(size_t maxRanges) {
     //Step1：判断请求的资源文件是否存在（路径是否合理）
     // eg.index.html
     //  /home/ljq/WebServer-master/resources/index.html
-    //  stat函数获取文件的信息并存放到Buffer里面，然后检查该文件的权限模式，
-    //  其实st_mode就是一个unsigned int（linux里面的drwxrwxrwx）
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
-        //没找到资源
-        code_ = 404;
+    //  从文件缓存里面取出文件（没命中时由缓存打开、检查权限并映射），
+    //  热点文件不需要任何文件系统调用
+    if(code_ >= 400) {
+        //请求本身有问题（例如解析失败、路径越界），保留调用者给的错误码，不去找资源
+        if(CODE_STATUS.count(code_) == 0) {
+            //除了本身已经准备好的状态，其余的全部回应Bad_Request
+            code_ = 400;
+        }
     }
-    else if(!(mmFileStat_.st_mode & S_IROTH)) {
-        //S_IROTH是表示该文件只能由其他用户组读，需要确认该文件是“其他用户组”可读的
-        //禁止该用户访问
-        code_ = 403;
+    else if(ResolveFingerprint_()) {
+        //带内容指纹的路径，已经换成了真正的文件（指纹对得上），不用先拿原路径去磁盘上白找一次
+    }
+    else if(int err = FileCache::Instance()->Open(path_, filePath_, &file_)) {
+        //没找到资源（404）或者禁止该用户访问（403）
+        code_ = err;
     }
     else if(code_ == -1) { 
         //数据处理成功
         code_ = 200; 
     }
+    //客户端接受压缩的话换成预压缩的版本（后面的条件请求、Range都针对实际发送的文件）
+    if(code_ == 200) {
+        Negotiate_();
+    }
+    //客户端缓存的版本还是最新的：只回复响应头，不发送文件
+    if(code_ == 200 && NotModified_()) {
+        code_ = 304;
+    }
+    //只要文件的一部分（206），或者要的部分都在文件外面（416）
+    else if(code_ == 200) {
+        code_ = ParseRange_(maxRanges);
+    }
+    if(code_ == 200 || code_ == 206 || code_ == 304) {
+        CachePolicy_();
+    }
+    //Step2：错误码换成对应的错误页面
     ErrorHtml_();
-    // 封装http数据
-    AddStateLine_(buff);
-    AddHeader_(buff);
-    AddContent_(buff);
-    AddEmptyLine_(buff);
+    OpenContent_();
+}
+
+// 文件名里面扩展名前的".<8位十六进制>"是内容指纹（/css/style.1a2b3c4d.css）：去掉它找到真正的文件，
+//  指纹和文件内容的CRC32一致时才算找到；找不到、或者指纹对不上时返回false，路径保持原样，
+//  由调用者按原路径去找（内容变了的旧URL仍然是404，真的叫这个名字的文件也照样能访问）
+bool HttpResponse::ResolveFingerprint_() {
+    if(!cachePolicy || !cachePolicy->fingerprint) {
+        return false;
+    }
+    const char* begin = path_.data;
+    const char* end = path_.data + path_.len;
+    const char* base = end;
+    while(base > begin && base[-1] != '/') { base--; }
+    const char* ext = end;
+    while(ext > base && *ext != '.') { ext--; }
+    // 至少要有"x.<8位>.ext"
+    if(*ext != '.' || ext - base < 10 || ext[-9] != '.') {
+        return false;
+    }
+    uint32_t fingerprint = 0;
+    for(const char* p = ext - 8; p < ext; p++) {
+        int digit;
+        if(*p >= '0' && *p <= '9') { digit = *p - '0'; }
+        else if(*p >= 'a' && *p <= 'f') { digit = *p - 'a' + 10; }
+        else { return false; }
+        fingerprint = fingerprint << 4 | digit;
+    }
+    // 去掉指纹的路径放到arena上
+    size_t headLen = ext - 9 - begin;
+    size_t tailLen = end - ext;
+    char* p = static_cast<char*>(arena_->Alloc(headLen + tailLen, 1));
+    memcpy(p, begin, headLen);
+    memcpy(p + headLen, ext, tailLen);
+    StrView path = path_, filePath = filePath_;
+    path_ = StrView(p, headLen + tailLen);
+    BuildFilePath_();
+    FileRef file;
+    if(FileCache::Instance()->Open(path_, filePath_, &file) != 0 || FileCache::Fingerprint(*file) != fingerprint) {
+        path_ = path;
+        filePath_ = filePath;
+        return false;
+    }
+    file_ = std::move(file);
+    if(code_ == -1) {
+        code_ = 200;
+    }
+    immutable_ = true;
+    return true;
+}
+
+// 按路径选择缓存策略（带指纹的URL内容不会变，永久缓存）
+void HttpResponse::CachePolicy_() {
+    if(!cachePolicy || !cachePolicy->enable) {
+        return;
+    }
+    if(immutable_) {
+        cacheControl_ = StrView("public, max-age=31536000, immutable", 35);
+        maxAge_ = 31536000;
+        return;
+    }
+    for(const CacheRule& rule : cachePolicy->rules) {
+        size_t prefixLen = rule.prefix ? strlen(rule.prefix) : 0;
+        size_t suffixLen = rule.suffix ? strlen(rule.suffix) : 0;
+        if(path_.len < prefixLen || memcmp(path_.data, rule.prefix, prefixLen) != 0
+                || path_.len < suffixLen || memcmp(path_.data + path_.len - suffixLen, rule.suffix, suffixLen) != 0) {
+            continue;
+        }
+        if(rule.maxAge < 0) {
+            cacheControl_ = StrView("no-cache", 8);
+        } else {
+            cacheControl_ = Format_("max-age=%d", rule.maxAge);
+            maxAge_ = rule.maxAge;
+        }
+        return;
+    }
 }
 
 char* HttpResponse::File() {
-    return mmFile_;
+    return (file_ && code_ != 304) ? file_->data : nullptr;
 }
 
 size_t HttpResponse::FileLen() const {
-    return mmFileStat_.st_size;
+    return (file_ && code_ != 304) ? file_->size : 0;
+}
+
+const char* HttpResponse::Content() {
+    if(!body_.empty()) { return body_.data; }
+    char* file = File();
+    return (file && rangeCount_ == 1) ? file + ranges_[0].offset : file;
+}
+
+StrView HttpResponse::ETag() const {
+    if(!file_ || (code_ != 200 && code_ != 206 && code_ != 304)) { return StrView(); }
+    return StrView(file_->etag.data(), file_->etag.size());
+}
+
+StrView HttpResponse::LastModified() const {
+    if(!file_ || (code_ != 200 && code_ != 206 && code_ != 304)) { return StrView(); }
+    return StrView(file_->lastModified.data(), file_->lastModified.size());
+}
+
+// 条件请求（RFC 7232）：有If-None-Match时只看它，否则看If-Modified-Since（只比较到秒）
+bool HttpResponse::NotModified_() const {
+    if(!request_ || !file_ || request_->method() != "GET") {
+        return false;
+    }
+    StrView inm = request_->GetHeader("If-None-Match");
+    if(!inm.empty()) {
+        return MatchETag_(inm, StrView(file_->etag.data(), file_->etag.size()));
+    }
+    StrView ims = request_->GetHeader("If-Modified-Since");
+    if(ims.empty() || ims.len >= 64) {
+        return false;
+    }
+    // 浏览器一般原样带回Last-Modified，先直接比较字符串，不一样再按日期解析
+    if(ims == StrView(file_->lastModified.data(), file_->lastModified.size())) {
+        return true;
+    }
+    char date[64];
+    memcpy(date, ims.data, ims.len);
+    date[ims.len] = '\0';
+    struct tm tm = {};
+    const char* end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end != '\0') {
+        return false;       // 不认识的日期格式当作没有这个头
+    }
+    return file_->st.st_mtime <= timegm(&tm);
+}
+
+// If-None-Match是逗号分隔的ETag列表（或者"*"），按弱比较：忽略W/前缀
+bool HttpResponse::MatchETag_(const StrView& list, const StrView& etag) {
+    const char* p = list.begin();
+    while(p < list.end()) {
+        while(p < list.end() && (*p == ' ' || *p == '\t' || *p == ',')) { p++; }
+        const char* begin = p;
+        while(p < list.end() && *p != ',') { p++; }
+        const char* end = p;
+        while(end > begin && (end[-1] == ' ' || end[-1] == '\t')) { end--; }
+        StrView tag(begin, end);
+        if(tag == "*") { return true; }
+        if(tag.len > 2 && tag.data[0] == 'W' && tag.data[1] == '/') {
+            tag = StrView(tag.data + 2, tag.len - 2);
+        }
+        if(tag == etag) { return true; }
+    }
+    return false;
 }
 
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        const string& errPath = CODE_PATH.find(code_)->second;
+        path_ = StrView(errPath.data(), errPath.size());
+        BuildFilePath_();
+        file_.reset();
+        FileCache::Instance()->Open(path_, filePath_, &file_);
+    }
+}
+
+void HttpResponse::Negotiate_() {
+    mime_ = file_->mime;
+    uint8_t sidecars = FileCache::Instance()->Sidecars(*file_);
+    // 没有预压缩版本的文本资源用后台压缩好的gzip版本
+    bool dynamic = (sidecars == 0) && CompressCache::Instance()->Eligible(*file_);
+    if(sidecars == 0 && !dynamic) {
+        return;
+    }
+    vary_ = true;
+    StrView accept = request_ ? request_->GetHeader("Accept-Encoding") : StrView();
+    if(accept.empty()) {
+        return;
+    }
+    if(dynamic) {
+        FileRef compressed;
+        if(AcceptsEncoding_(accept, FileCache::EncodingName(ENCODING_GZIP))
+                && CompressCache::Instance()->Get(file_, &compressed)) {
+            file_ = std::move(compressed);
+            encoding_ = FileCache::EncodingName(ENCODING_GZIP);
+        }
+        return;
+    }
+    for(int i = 0; i < ENCODING_COUNT; i++) {
+        ENCODING encoding = static_cast<ENCODING>(i);
+        if((sidecars & (1 << i)) && AcceptsEncoding_(accept, FileCache::EncodingName(encoding))) {
+            FileRef sidecar;
+            if(FileCache::Instance()->OpenSidecar(*file_, encoding, &sidecar) == 0) {
+                file_ = std::move(sidecar);
+                encoding_ = FileCache::EncodingName(encoding);
+                return;
+            }
+        }
+    }
+}
+
+// Accept-Encoding里面有没有coding（q=0表示不接受），"*"代表所有没有单独列出来的编码
+bool HttpResponse::AcceptsEncoding_(const StrView& accept, const char* coding) {
+    bool star = false;
+    const char* p = accept.begin();
+    while(p < accept.end()) {
+        while(p < accept.end() && (*p == ' ' || *p == '\t' || *p == ',')) { p++; }
+        const char* begin = p;
+        while(p < accept.end() && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') { p++; }
+        StrView name(begin, p);
+        // 参数里面只关心q，q的值全是0（0、0.0、0.000）表示不接受
+        bool zero = false;
+        while(p < accept.end() && *p != ',') {
+            if((*p == 'q' || *p == 'Q') && p + 1 < accept.end() && p[1] == '=') {
+                p += 2;
+                zero = true;
+                while(p < accept.end() && (*p == '0' || *p == '.')) { p++; }
+                if(p < accept.end() && *p >= '1' && *p <= '9') { zero = false; }
+                continue;
+            }
+            p++;
+        }
+        if(name.EqualsIgnoreCase(coding)) {
+            return !zero;
+        }
+        if(name == "*") {
+            star = !zero;
+        }
     }
+    return star;
 }
 
-// 添加响应状态行
-void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
+// If-Range：客户端手里那部分的版本和现在的文件一样才能只发一部分（ETag用强比较，日期要完全一致）
+bool HttpResponse::IfRangeMatches_() const {
+    StrView ifRange = request_->GetHeader("If-Range");
+    if(ifRange.empty()) {
+        return true;
+    }
+    if(ifRange.data[0] == '"') {
+        return ifRange == StrView(file_->etag.data(), file_->etag.size());
+    }
+    return ifRange == StrView(file_->lastModified.data(), file_->lastModified.size());
+}
+
+// 解析Range（RFC 7233，只支持bytes），返回200（没有Range、语法不对、If-Range不匹配）、206或者416；
+//  206时各段放在arena上
+int HttpResponse::ParseRange_(size_t maxRanges) {
+    if(!request_ || !file_ || request_->method() != "GET") {
+        return 200;
+    }
+    StrView range = request_->GetHeader("Range");
+    if(range.len < 6 || !StrView(range.data, 6).EqualsIgnoreCase("bytes=") || !IfRangeMatches_()) {
+        return 200;
+    }
+    const size_t size = file_->size;
+    Range specs[MAX_RANGES];
+    size_t count = 0;
+    bool seen = false;
+    const char* p = range.data + 6;
+    while(p < range.end()) {
+        while(p < range.end() && (*p == ' ' || *p == '\t' || *p == ',')) { p++; }
+        if(p == range.end()) { break; }
+        // 一段：first-last、first-或者-suffix
+        size_t first = 0, last = 0;
+        int firstDigits = 0, lastDigits = 0;
+        while(p < range.end() && *p >= '0' && *p <= '9' && firstDigits < 19) {
+            first = first * 10 + (*p++ - '0');
+            firstDigits++;
+        }
+        if(p == range.end() || *p != '-') { return 200; }
+        p++;
+        while(p < range.end() && *p >= '0' && *p <= '9' && lastDigits < 19) {
+            last = last * 10 + (*p++ - '0');
+            lastDigits++;
+        }
+        while(p < range.end() && (*p == ' ' || *p == '\t')) { p++; }
+        if(p < range.end() && *p != ',') { return 200; }
+        if(firstDigits == 0 && lastDigits == 0) { return 200; }
+        if(firstDigits > 0 && lastDigits > 0 && last < first) { return 200; }
+        seen = true;
+        if(firstDigits == 0) {
+            // 最后suffix个字节
+            if(last == 0 || size == 0) { continue; }
+            first = (last >= size) ? 0 : size - last;
+            last = size - 1;
+        }
+        else {
+            if(first >= size) { continue; }     // 这一段在文件外面
+            last = (lastDigits == 0 || last >= size) ? size - 1 : last;
+        }
+        if(count == maxRanges) {
+            return 200;     // 段数太多，直接回复整个文件
+        }
+        specs[count].head = StrView();
+        specs[count].offset = first;
+        specs[count].len = last - first + 1;
+        count++;
     }
-    else {
-        //除了本身已经准备好的状态，其余的全部回应Bad_Request
-        code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+    if(!seen) {
+        return 200;
     }
-    //协议版本(HTTP/1.1)-空格-状态码-状态码描述-\r\n
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    if(count == 0) {
+        contentRange_ = Format_("bytes */%zu", size);
+        return 416;
+    }
+    if(count == 1) {
+        ranges_ = arena_->New<Range>(specs[0]);
+        rangeCount_ = 1;
+        rangeBytes_ = specs[0].len;
+        contentRange_ = Format_("bytes %zu-%zu/%zu", specs[0].offset, specs[0].offset + specs[0].len - 1, size);
+        return 206;
+    }
+    // 多段：multipart/byteranges，每段前面是分段头，最后是结束分隔符；文件内容仍然直接从文件发送
+    static std::atomic<unsigned long long> boundarySeq(0);
+    StrView boundary = Format_("%016llx%08llx", static_cast<unsigned long long>(file_->st.st_ino),
+                               static_cast<unsigned long long>(++boundarySeq));
+    contentType_ = Format_("multipart/byteranges; boundary=%s", boundary.data);
+    ranges_ = static_cast<Range*>(arena_->Alloc(sizeof(Range) * (count + 1), alignof(Range)));
+    rangeBytes_ = 0;
+    for(size_t i = 0; i < count; i++) {
+        ranges_[i] = specs[i];
+        ranges_[i].head = Format_("\r\n--%s\r\nContent-Type: %.*s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n",
+                                  boundary.data, static_cast<int>(mime_.len), mime_.data,
+                                  specs[i].offset, specs[i].offset + specs[i].len - 1, size);
+        rangeBytes_ += ranges_[i].head.len + ranges_[i].len;
+    }
+    ranges_[count].head = Format_("\r\n--%s--\r\n", boundary.data);
+    ranges_[count].offset = 0;
+    ranges_[count].len = 0;
+    rangeBytes_ += ranges_[count].head.len;
+    rangeCount_ = count + 1;
+    return 206;
+}
+
+// 在arena上格式化一个字符串（末尾带'\0'）
+StrView HttpResponse::Format_(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+    if(len < 0) { return StrView(); }
+    char* p = static_cast<char*>(arena_->Alloc(len + 1, 1));
+    va_start(args, fmt);
+    vsnprintf(p, len + 1, fmt, args);
+    va_end(args);
+    return StrView(p, len);
 }
 
 // 添加响应头
 void HttpResponse::AddHeader_(Buffer& buff) {
-    buff.Append("Connection: ");//key
     if(isKeepAlive_) {
-        //每个头部都是一行
-        buff.Append("keep-alive\r\n");//value
-        //这里是写keep-alive的属性，max表示该链接最多还能接收几个http请求就要关闭
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
-    } else{
-        buff.Append("close\r\n");
+        buff.Append(SERVER_KEEP_ALIVE, sizeof(SERVER_KEEP_ALIVE) - 1);
+    } else {
+        buff.Append(SERVER_CLOSE, sizeof(SERVER_CLOSE) - 1);
+    }
+    //304没有响应体，也不需要描述响应体的头部
+    if(code_ != 304) {
+        StrView type = GetFileType_();
+        buff.Append("Content-type: ", 14);
+        buff.Append(type.data, type.len);
+        buff.Append("\r\nContent-length: ", 18);
+        AppendNum(buff, ContentLength());
+        buff.Append("\r\n");
+        if(encoding_) {
+            buff.Append("Content-Encoding: ");
+            buff.Append(encoding_);
+            buff.Append("\r\n");
+        }
+    }
+    if(vary_) {
+        buff.Append("Vary: Accept-Encoding\r\n");
+    }
+    if(!contentRange_.empty()) {
+        buff.Append("Content-Range: ");
+        buff.Append(contentRange_.data, contentRange_.len);
+        buff.Append("\r\n");
+    }
+    if(!cacheControl_.empty()) {
+        buff.Append("Cache-Control: ", 15);
+        buff.Append(cacheControl_.data, cacheControl_.len);
+        buff.Append("\r\n", 2);
+    }
+    //校验器，浏览器下次带着它们来问文件有没有变
+    StrView etag = ETag();
+    if(!etag.empty()) {
+        buff.Append("ETag: ");
+        buff.Append(etag.data, etag.len);
+        buff.Append("\r\nLast-Modified: ");
+        StrView lastModified = LastModified();
+        buff.Append(lastModified.data, lastModified.len);
+        buff.Append("\r\nAccept-Ranges: bytes\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
 }
 
-// 添加响应体
+// 添加响应体：文件通过iov_[1]直接从映射的内存发送，这里只需要写生成的页面
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) { 
-        ErrorContent(buff, "File NotFound!");
-        return; 
+    AddEmptyLine_(buff);
+    if(!body_.empty()) {
+        buff.Append(body_.data, body_.len);
     }
+}
 
-    /* 将文件映射到内存提高文件的访问速度 
-        MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    //下次再访问则无需陷入内核态，减少系统调用次数
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
-        return; 
+// 检查要发送的文件（缓存里面已经映射好了），文件不可用时生成一个简单的错误页面
+void HttpResponse::OpenContent_() {
+    if(code_ >= 400 && CODE_PATH.count(code_) == 0) {
+        // 没有对应错误页面的状态码，直接生成一个简单的页面
+        ErrorContent_(StatusText(code_));
+        return;
+    }
+    if(!file_) {
+        ErrorContent_("File NotFound!");
+        return;
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    //这里两个\r\n是因为Header结束了
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n");
+    LOG_DEBUG("file path %s", filePath_.data);
 }
 
 // 添加空行
@@ -164,42 +687,43 @@ void HttpResponse::AddEmptyLine_(Buffer& buff) {
     buff.Append("\r\n");
 }
 
-// 解除内存映射
+// 放弃对文件的引用（映射由文件缓存统一管理，最后一个引用释放时才解除）
 void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
-    }
+    file_.reset();
 }
 
-string HttpResponse::GetFileType_() {
-    /* 判断文件类型 */
-    string::size_type idx = path_.find_last_of('.');
-    if(idx == string::npos) {
-        return "text/plain";
+// 判断文件类型（扩展名查编译期生成的MIME表）
+StrView HttpResponse::GetFileType_() const {
+    if(!body_.empty()) {
+        return StrView("text/html", 9);     // ErrorContent_生成的页面
+    }
+    if(!contentType_.empty()) {
+        return contentType_;                // 多段206
     }
-    string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    if(!mime_.empty()) {
+        return mime_;                       // 预压缩版本也按原文件的类型
     }
-    return "text/plain";
+    return file_ ? file_->mime : Router::MimeType(path_);
 }
 
-void HttpResponse::ErrorContent(Buffer& buff, string message) 
-{
-    string body;
-    string status;
-    body += "<html><title>Error</title>";
-    body += "<body bgcolor=\"ffffff\">";
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    } else {
-        status = "Bad Request";
-    }
-    body += to_string(code_) + " : " + status  + "\n";
-    body += "<p>" + message + "</p>";
-    body += "<hr><em>TinyWebServer</em></body></html>";
+const char* HttpResponse::StatusText(int code) {
+    auto it = CODE_STATUS.find(code);
+    return (it != CODE_STATUS.end()) ? it->second.c_str() : "Bad Request";
+}
 
-    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+// 生成错误页面，放在arena上（生命周期和这次请求一样）
+void HttpResponse::ErrorContent_(const char* message) 
+{
+    file_.reset();
+    char* body = static_cast<char*>(arena_->Alloc(512, 1));
+    int len = snprintf(body, 512,
+                       "<html><title>Error</title>"
+                       "<body bgcolor=\"ffffff\">"
+                       "%d : %s\n"
+                       "<p>%s</p>"
+                       "<hr><em>TinyWebServer</em></body></html>",
+                       code_, StatusText(code_), message);
+    if(len < 0) { len = 0; }
+    if(len >= 512) { len = 511; }
+    body_ = StrView(body, len);
 }
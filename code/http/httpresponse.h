@@ -2,50 +2,132 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
-#include <fcntl.h>       // open
-#include <unistd.h>      // close
-#include <sys/stat.h>    // stat
-#include <sys/mman.h>    // mmap, munmap
 
 #include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "../cache/filecache.h"
+#include "router.h"
 #include "../log/log.h"
 
+class HttpRequest;
+
 class HttpResponse {
 public:
+    // 206的一段：文件里面的[offset, offset + len)，多段（multipart/byteranges）时前面还有这一段的分段头；
+    //  多段时最后多一项，只有结束分隔符
+    struct Range {
+        StrView head;
+        size_t offset;
+        size_t len;
+    };
+
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    // 路径等字符串都从arena里面分配，arena由连接在下一个请求开始时统一回收；
+    //  request在Prepare()之前都要有效（条件请求等需要看请求头）
+    void Init(Arena* arena, const char* srcDir, const HttpRequest& request, bool isKeepAlive = false, int code = -1);
+    // 确定状态码并准备好响应体（映射文件或者生成错误页面），然后按HTTP/1.x格式写出响应头
     void MakeResponse(Buffer& buff);
+    // 只做MakeResponse的第一步，供HTTP/2等自己编码响应头的协议使用；
+    //  Range里面的段数超过maxRanges时忽略Range，回复整个文件
+    void Prepare(size_t maxRanges = MAX_RANGES);
+    // MakeResponse的第二步：按HTTP/1.x格式写出状态行和响应头（文件内容不写）
+    void WriteHead(Buffer& buff);
+    // 只写状态行和Date头
+    void WriteStatus(Buffer& buff) const;
+    // Prepare以后调用：小文件返回文件缓存里面拼好的响应（除状态行和Date以外的响应头和文件内容），
+    //  先WriteStatus再发送它即可，不需要WriteHead；不能使用时返回空
+    StrView Prebuilt();
     void UnmapFile();
     char* File();
     size_t FileLen() const;
-    void ErrorContent(Buffer& buff, std::string message);
+    // 要发送的缓存文件（零拷贝发送时由连接另外持有，直到内核通知发送完成）
+    const FileRef& CachedFile() const { return file_; }
+    // 文件缓存里面打开的fd（sendfile用），没有文件时为-1
+    int FileFd() const { return file_ ? file_->fd : -1; }
+    // 文件内容在FileFd()里面的起始偏移（站点镜像里面的文件不为0）
+    off_t FileOffset() const { return file_ ? file_->offset : 0; }
     int Code() const { return code_; }
+    bool IsKeepAlive() const { return isKeepAlive_; }
+    StrView ContentType() const { return GetFileType_(); }
+    // 没有文件可发时（错误码没有对应的页面、文件打不开）生成的响应体，否则为空
+    const StrView& Body() const { return body_; }
+    // 响应体的长度（文件、文件的若干段或者生成的页面）
+    size_t ContentLength() const {
+        return !body_.empty() ? body_.len : (rangeCount_ > 0 ? rangeBytes_ : FileLen());
+    }
+    // 响应体的起始位置（生成的页面、文件，或者单段206的那一段），多段206不能用
+    const char* Content();
+    // 206的各段（不是206时RangeCount()为0）
+    const Range* Ranges() const { return ranges_; }
+    size_t RangeCount() const { return rangeCount_; }
+    // Content-Range头（206和416才有）
+    const StrView& ContentRange() const { return contentRange_; }
+    // 发送的预压缩版本（Content-Encoding），发送原文件时为nullptr
+    const char* ContentEncoding() const { return encoding_; }
+    bool VaryEncoding() const { return vary_; }
+    // Cache-Control头（缓存策略没有匹配的规则时为空）
+    const StrView& CacheControl() const { return cacheControl_; }
+    // 文件的校验器（200、206和304才有，否则为空）
+    StrView ETag() const;
+    StrView LastModified() const;
+    static const char* StatusText(int code);
+    // 当前时间（Date头的值），每秒最多格式化一次
+    static StrView Date();
+
+    static const size_t MAX_RANGES = 16;    // 一个请求最多要多少段（防止用大量的小段放大开销）
+    static const CachePolicyConfig* cachePolicy;    // 缓存策略（WebServer设置，nullptr表示不发送缓存相关的头部）
 
 private:
     //用于封装HTTP响应报文的三个函数
-    void AddStateLine_(Buffer &buff);
     void AddHeader_(Buffer &buff);
     void AddContent_(Buffer &buff);
     void AddEmptyLine_(Buffer &buff);
 
     void ErrorHtml_();
-    std::string GetFileType_();
+    void OpenContent_();
+    void ErrorContent_(const char* message);
+    void BuildFilePath_();
+    StrView GetFileType_() const;
+    int PrebuiltSlot_() const;
+    bool NotModified_() const;
+    static bool MatchETag_(const StrView& list, const StrView& etag);
+    bool IfRangeMatches_() const;
+    void Negotiate_();
+    static bool AcceptsEncoding_(const StrView& accept, const char* coding);
+    int ParseRange_(size_t maxRanges);
+    bool ResolveFingerprint_();
+    void CachePolicy_();
+    StrView Format_(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
 
     int code_;                  // 响应状态码
     bool isKeepAlive_;          // 是否保持连接
 
-    std::string path_;          // 资源的路径
-    std::string srcDir_;        // 资源的根目录--"/home/ljq/WebServer-master"
+    Arena* arena_;              // 请求级内存池
+    const HttpRequest* request_;    // 对应的请求（只在Prepare()里面使用）
+    StrView path_;              // 资源的路径
+    StrView filePath_;          // 资源的完整路径（srcDir_ + path_，末尾带'\0'）
+    const char* srcDir_;        // 资源的根目录--"/home/ljq/WebServer-master"
     
-    char* mmFile_;              // 文件内存映射的指针
-    struct stat mmFileStat_;    // 文件的状态信息
+    FileRef file_;              // 要发送的文件（文件缓存里面的映射，持有引用直到响应发完）
+    StrView body_;              // ErrorContent_生成的页面（在arena上）
+
+    Range* ranges_;             // 206的各段（在arena上）
+    size_t rangeCount_;
+    size_t rangeBytes_;         // 206的响应体一共多少字节（多段时包括分段头和结束分隔符）
+    StrView contentRange_;      // Content-Range的值
+    StrView contentType_;       // 多段206的Content-Type（multipart/byteranges; boundary=...）
+    StrView mime_;              // 请求的文件的MIME类型（发送预压缩版本时file_是压缩文件）
+    const char* encoding_;      // 发送的预压缩版本的Content-Encoding，nullptr表示原文件
+    bool vary_;                 // 文件有预压缩版本（或者会动态压缩），响应随Accept-Encoding变化
+    StrView cacheControl_;      // Cache-Control的值
+    int maxAge_;                // Expires按这个算，<0表示不发送Expires
+    bool immutable_;            // 通过带内容指纹的URL访问（永久缓存）
 
-    //用于封装http的content-type，用于将后缀映射为http中对应的类型字段
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;  // 后缀 - 类型
     static const std::unordered_map<int, std::string> CODE_STATUS;    // 状态码 - 描述 
     static const std::unordered_map<int, std::string> CODE_PATH;      // 状态码 - 路径
+    static const std::unordered_map<int, std::string> STATUS_LINE;    // 状态码 - 拼好的状态行
 };
 
 
@@ -0,0 +1,391 @@
+#include "multipart.h"
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>       // open, splice
+#include <unistd.h>      // write, close, unlink, pipe2
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>  // recv
+#include "../log/log.h"
+
+static const size_t MAX_PART_HEADER = 8192;    // 一个部分的头部（Content-Disposition等）的上限
+static const size_t MAX_FILENAME = 64;          // 保存时最多保留原文件名的多少个字符
+static const size_t PEEK_LEN = 65536;           // 一次splice最多搬运的字节数（管道默认容量）
+
+MultipartParser::MultipartParser(const StrView& boundary, const UploadConfig* config)
+    : config_(config), state_(PREAMBLE), errorCode_(0), headerBytes_(0),
+      fileFd_(-1), isFile_(false), committed_(false), started_(false) {
+    assert(config && !boundary.empty());
+    pipe_[0] = pipe_[1] = config->splice ? -1 : -2;
+    delim_ = "\r\n--";
+    delim_.append(boundary.data, boundary.len);
+    // Horspool：文本窗口最后一个字符在分隔符里面（不算最后一位）最靠右的位置决定能跳多远
+    size_t m = delim_.size();
+    std::fill(skip_, skip_ + 256, m);
+    for(size_t i = 0; i + 1 < m; i++) {
+        skip_[static_cast<unsigned char>(delim_[i])] = m - 1 - i;
+    }
+    part_.size = 0;
+}
+
+MultipartParser::~MultipartParser() {
+    if(fileFd_ >= 0) { close(fileFd_); }
+    if(pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+    if(!committed_) {
+        for(const std::string& path : paths_) {
+            unlink(path.c_str());
+        }
+        if(!paths_.empty()) {
+            LOG_WARN("Upload incomplete, removed %zu file(s)", paths_.size());
+        }
+    }
+}
+
+// multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW
+StrView MultipartParser::Boundary(const StrView& contentType) {
+    const char* end = contentType.end();
+    const char* semi = std::find(contentType.begin(), end, ';');
+    StrView type(contentType.begin(), semi);
+    while(!type.empty() && (type.end()[-1] == ' ' || type.end()[-1] == '\t')) { type.len--; }
+    if(!type.EqualsIgnoreCase("multipart/form-data")) {
+        return StrView();
+    }
+    const char* p = semi;
+    while(p < end) {
+        p++;
+        while(p < end && (*p == ' ' || *p == '\t')) { p++; }
+        const char* next = std::find(p, end, ';');
+        const char* eq = std::find(p, next, '=');
+        if(eq != next && StrView(p, eq).EqualsIgnoreCase("boundary")) {
+            const char* b = eq + 1;
+            const char* e = next;
+            while(e > b && (e[-1] == ' ' || e[-1] == '\t')) { e--; }
+            if(e - b >= 2 && *b == '"' && e[-1] == '"') { b++; e--; }
+            // RFC 2046：1~70个字符
+            if(e - b < 1 || e - b > 70) { return StrView(); }
+            return StrView(b, e);
+        }
+        p = next;
+    }
+    return StrView();
+}
+
+size_t MultipartParser::Feed(const char* data, size_t len, bool last) {
+    size_t used = 0;
+    while(used < len && state_ != FAILED) {
+        size_t n = 0;
+        switch(state_) {
+            case PREAMBLE:      n = FeedPreamble_(data + used, len - used); break;
+            case AFTER_DELIM:   n = FeedAfterDelim_(data + used, len - used); break;
+            case HEADERS:       n = FeedHeaders_(data + used, len - used); break;
+            case DATA:          n = FeedData_(data + used, len - used); break;
+            case DONE:          n = len - used; break;      // 结束分隔符后面的内容忽略
+            default:            break;
+        }
+        if(n == 0) { break; }   // 剩下的不够判断，等更多数据
+        used += n;
+    }
+    if(last && state_ != DONE && state_ != FAILED) {
+        Fail_(400);             // 请求体结束了，但是没有结束分隔符
+    }
+    return used;
+}
+
+size_t MultipartParser::FeedPreamble_(const char* data, size_t len) {
+    // 请求体一般直接以"--boundary"开头（第一个分隔符前面没有CRLF）
+    if(!started_) {
+        size_t need = delim_.size() - 2;
+        size_t n = std::min(len, need);
+        if(memcmp(data, delim_.data() + 2, n) == 0) {
+            if(n < need) { return 0; }
+            started_ = true;
+            state_ = AFTER_DELIM;
+            return need;
+        }
+        started_ = true;
+    }
+    size_t pos = Search_(data, len);
+    if(pos < len) {
+        state_ = AFTER_DELIM;
+        return pos + delim_.size();
+    }
+    return SafeLen_(data, len);     // 前言直接丢掉
+}
+
+size_t MultipartParser::FeedAfterDelim_(const char* data, size_t len) {
+    if(len < 2) { return 0; }
+    if(data[0] == '-' && data[1] == '-') {
+        state_ = DONE;
+        return 2;
+    }
+    // 分隔符和CRLF之间允许有空白
+    size_t i = 0;
+    while(i < len && (data[i] == ' ' || data[i] == '\t')) { i++; }
+    if(len - i < 2) {
+        return (i > MAX_PART_HEADER) ? Fail_(400) : 0;
+    }
+    if(data[i] != '\r' || data[i + 1] != '\n') {
+        return Fail_(400);
+    }
+    if(!BeginPart_()) { return 0; }
+    state_ = HEADERS;
+    return i + 2;
+}
+
+size_t MultipartParser::FeedHeaders_(const char* data, size_t len) {
+    const char CRLF[] = "\r\n";
+    const char* end = data + len;
+    const char* lineEnd = std::search(data, end, CRLF, CRLF + 2);
+    size_t consumed = (lineEnd == end) ? len : lineEnd + 2 - data;
+    if(headerBytes_ + consumed > MAX_PART_HEADER) {
+        return Fail_(400);
+    }
+    if(lineEnd == end) { return 0; }
+    headerBytes_ += consumed;
+    if(lineEnd == data) {
+        // 空行：头部结束
+        if(part_.name.empty()) {
+            return Fail_(400);
+        }
+        if(isFile_ && !part_.filename.empty() && !OpenFile_()) {
+            return 0;
+        }
+        state_ = DATA;
+        return consumed;
+    }
+    const char* colon = std::find(data, lineEnd, ':');
+    if(colon == lineEnd) {
+        return Fail_(400);
+    }
+    if(StrView(data, colon).EqualsIgnoreCase("Content-Disposition")) {
+        const char* v = colon + 1;
+        while(v < lineEnd && (*v == ' ' || *v == '\t')) { v++; }
+        ParseDisposition_(StrView(v, lineEnd));
+    }
+    return consumed;
+}
+
+size_t MultipartParser::FeedData_(const char* data, size_t len) {
+    size_t pos = Search_(data, len);
+    if(pos < len) {
+        if(!PartData_(data, pos) || !EndPart_()) { return 0; }
+        state_ = AFTER_DELIM;
+        return pos + delim_.size();
+    }
+    size_t safe = SafeLen_(data, len);
+    if(!PartData_(data, safe)) { return 0; }
+    return safe;
+}
+
+bool MultipartParser::BeginPart_() {
+    if(parts_.size() >= static_cast<size_t>(config_->maxParts)) {
+        Fail_(413);
+        return false;
+    }
+    part_.name.clear();
+    part_.filename.clear();
+    part_.value.clear();
+    part_.size = 0;
+    isFile_ = false;
+    headerBytes_ = 0;
+    return true;
+}
+
+bool MultipartParser::PartData_(const char* data, size_t len) {
+    if(len == 0) { return true; }
+    part_.size += len;
+    if(part_.size > (isFile_ ? config_->maxFileBytes : config_->maxFieldBytes)) {
+        Fail_(413);
+        return false;
+    }
+    if(!isFile_) {
+        part_.value.append(data, len);
+        return true;
+    }
+    // 没有选择文件（filename为空）时内容直接丢掉
+    while(fileFd_ >= 0 && len > 0) {
+        ssize_t n = write(fileFd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Upload write error: %d", errno);
+            Fail_(500);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool MultipartParser::EndPart_() {
+    if(isFile_) {
+        if(fileFd_ < 0) {
+            return true;    // 空文件名，什么都没有保存
+        }
+        close(fileFd_);
+        fileFd_ = -1;
+        LOG_INFO("Upload %s -> %s, %zu bytes", part_.filename.c_str(), part_.value.c_str(), part_.size);
+    }
+    parts_.push_back(part_);
+    return true;
+}
+
+// form-data; name="file"; filename="a.txt"
+void MultipartParser::ParseDisposition_(const StrView& value) {
+    const char* p = value.begin();
+    const char* end = value.end();
+    while(p < end) {
+        const char* next = std::find(p, end, ';');
+        const char* eq = std::find(p, next, '=');
+        if(eq != next) {
+            const char* k = p;
+            while(k < eq && (*k == ' ' || *k == '\t')) { k++; }
+            StrView key(k, eq);
+            std::string val;
+            const char* v = eq + 1;
+            if(v < end && *v == '"') {
+                // 带引号的值里面可能有';'，要找到配对的引号
+                for(v++; v < end && *v != '"'; v++) {
+                    if(*v == '\\' && v + 1 < end) { v++; }
+                    val.push_back(*v);
+                }
+                next = std::find(v, end, ';');
+            }
+            else {
+                val.assign(v, next);
+            }
+            if(key.EqualsIgnoreCase("name")) {
+                part_.name = val;
+            }
+            else if(key.EqualsIgnoreCase("filename")) {
+                part_.filename = val;
+                isFile_ = true;
+            }
+        }
+        p = (next < end) ? next + 1 : end;
+    }
+}
+
+bool MultipartParser::OpenFile_() {
+    // 只保留原文件名最后一段里面的安全字符，再加上时间和序号，保证不会越出上传目录、不会覆盖已有文件
+    static std::atomic<unsigned> seq(0);
+    const std::string& src = part_.filename;
+    size_t slash = src.find_last_of("/\\");
+    std::string base = src.substr(slash == std::string::npos ? 0 : slash + 1);
+    std::string safe;
+    for(char c : base) {
+        if(safe.size() >= MAX_FILENAME) { break; }
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                  || c == '.' || c == '-' || c == '_';
+        safe.push_back(ok ? c : '_');
+    }
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "%ld-%u-", static_cast<long>(time(nullptr)), seq++);
+    std::string path = config_->dir;
+    if(!path.empty() && path.back() != '/') { path.push_back('/'); }
+    path += prefix;
+    path += safe;
+    fileFd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fileFd_ < 0) {
+        LOG_ERROR("Upload open %s error: %d", path.c_str(), errno);
+        Fail_(500);
+        return false;
+    }
+    paths_.push_back(path);
+    part_.value = path;
+    return true;
+}
+
+size_t MultipartParser::Fail_(int code) {
+    if(state_ != FAILED) {
+        LOG_WARN("Multipart error: %d", code);
+    }
+    state_ = FAILED;
+    errorCode_ = code;
+    if(fileFd_ >= 0) {
+        close(fileFd_);
+        fileFd_ = -1;
+    }
+    return 0;
+}
+
+size_t MultipartParser::Search_(const char* data, size_t len) const {
+    const size_t m = delim_.size();
+    const char* pat = delim_.data();
+    const char lastChar = pat[m - 1];
+    size_t i = 0;
+    while(i + m <= len) {
+        char c = data[i + m - 1];
+        if(c == lastChar && memcmp(data + i, pat, m - 1) == 0) {
+            return i;
+        }
+        i += skip_[static_cast<unsigned char>(c)];
+    }
+    return len;
+}
+
+size_t MultipartParser::SafeLen_(const char* data, size_t len) const {
+    // 分隔符以'\r'开头，只需要检查末尾m-1个字节里面的'\r'
+    size_t m = delim_.size();
+    size_t start = len > m - 1 ? len - (m - 1) : 0;
+    const char* p = static_cast<const char*>(memchr(data + start, '\r', len - start));
+    while(p) {
+        size_t rest = data + len - p;
+        if(memcmp(p, delim_.data(), rest) == 0) {
+            return p - data;
+        }
+        p = static_cast<const char*>(memchr(p + 1, '\r', rest - 1));
+    }
+    return len;
+}
+
+ssize_t MultipartParser::SpliceFrom(int sockFd, size_t maxLen, int* saveErrno) {
+    if(!CanSplice()) { return 0; }
+    if(pipe_[0] == -1 && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        pipe_[0] = pipe_[1] = -2;
+        return 0;
+    }
+    // 先偷看socket里面的数据（不取走），确定分隔符之前有多少字节可以直接搬进文件
+    char peek[PEEK_LEN];
+    ssize_t n = recv(sockFd, peek, std::min(maxLen, sizeof(peek)), MSG_PEEK | MSG_DONTWAIT);
+    if(n <= 0) {
+        return 0;       // 没有数据或者连接关闭，交给普通的读去处理
+    }
+    size_t pos = Search_(peek, n);
+    size_t safe = (pos < static_cast<size_t>(n)) ? pos : SafeLen_(peek, n);
+    if(safe == 0 || part_.size + safe > config_->maxFileBytes) {
+        return 0;
+    }
+    size_t moved = 0;
+    while(moved < safe) {
+        ssize_t in = splice(sockFd, nullptr, pipe_[1], nullptr, safe - moved, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(in <= 0) {
+            if(in < 0 && errno == EINVAL) {
+                // 这个socket或者内核不支持splice，以后都走普通的读
+                close(pipe_[0]);
+                close(pipe_[1]);
+                pipe_[0] = pipe_[1] = -2;
+            }
+            *saveErrno = errno;
+            break;
+        }
+        for(ssize_t left = in; left > 0;) {
+            ssize_t out = splice(pipe_[0], nullptr, fileFd_, nullptr, left, SPLICE_F_MOVE);
+            if(out <= 0) {
+                if(out < 0 && errno == EINTR) { continue; }
+                // 数据已经从socket上取走了，写不进文件的话这个请求只能失败
+                LOG_ERROR("Upload splice error: %d", errno);
+                part_.size += moved;
+                Fail_(500);
+                return moved + (in - left);
+            }
+            left -= out;
+        }
+        moved += in;
+    }
+    part_.size += moved;
+    return moved;
+}
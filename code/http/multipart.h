@@ -0,0 +1,109 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+/**********************************************************************
+ * ---------------------------MultipartParser--------------------------
+ *
+ * multipart/form-data请求体（RFC 7578）的流式解析，用于/upload：
+ * 1、请求体不需要完整地放在内存里，收到多少喂多少（Feed），半个分隔符或者
+ *    半行头部留在读缓冲区里，等下一批数据；
+ * 2、分隔符（"\r\n--" + boundary）用Boyer-Moore-Horspool查找，boundary
+ *    一般有几十个字符，绝大多数位置一次就能跳过整个分隔符的长度；
+ * 3、文件部分边收边写到上传目录（文件名由服务器生成，只保留原文件名里面
+ *    安全的字符），普通字段收在内存里（有大小限制）；
+ * 4、处于文件内容中间并且读缓冲区是空的时候，SpliceFrom()先用MSG_PEEK在
+ *    socket上找分隔符，分隔符之前的部分用splice经过管道直接搬进文件，
+ *    不再经过读缓冲区；
+ * 5、每个部分都有大小限制，超过返回413；请求没有完整结束（出错、连接断开）
+ *    时已经写下的文件全部删除。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "../buffer/arena.h"
+#include "../config/config.h"
+
+class MultipartParser {
+public:
+    enum STATE {
+        PREAMBLE,       // 第一个分隔符之前
+        AFTER_DELIM,    // 刚收完分隔符，后面是"--"（结束）或者"\r\n"（下一个部分）
+        HEADERS,        // 部分的头部
+        DATA,           // 部分的内容
+        DONE,           // 收到了结束分隔符
+        FAILED,
+    };
+
+    // 一个部分（字段或者文件）的解析结果
+    struct Part {
+        std::string name;       // 字段名
+        std::string filename;   // 客户端给的文件名（普通字段为空）
+        std::string value;      // 普通字段的值；文件部分是保存下来的路径
+        size_t size;            // 内容的字节数
+    };
+
+    MultipartParser(const StrView& boundary, const UploadConfig* config);
+    ~MultipartParser();
+
+    MultipartParser(const MultipartParser&) = delete;
+    MultipartParser& operator=(const MultipartParser&) = delete;
+
+    // 从Content-Type里面取出boundary参数，没有或者不合法时返回空
+    static StrView Boundary(const StrView& contentType);
+
+    // 解析[data, data + len)，返回消耗的字节数；last表示请求体到此为止（不会再有数据）
+    size_t Feed(const char* data, size_t len, bool last);
+    // 正在接收文件内容时，直接把socket上分隔符之前的数据splice到文件里面，最多maxLen字节；
+    //  返回搬运的字节数，返回0表示这次不能splice（数据不够判断、分隔符就在前面），应当改为普通的读
+    ssize_t SpliceFrom(int sockFd, size_t maxLen, int* saveErrno);
+    // 现在能不能调用SpliceFrom
+    bool CanSplice() const { return state_ == DATA && fileFd_ >= 0 && pipe_[0] != -2; }
+
+    // 请求体已经完整收到，保留写下的文件
+    void Commit() { committed_ = true; }
+
+    STATE State() const { return state_; }
+    int ErrorCode() const { return errorCode_; }
+    const std::vector<Part>& Parts() const { return parts_; }
+
+private:
+    size_t FeedPreamble_(const char* data, size_t len);
+    size_t FeedAfterDelim_(const char* data, size_t len);
+    size_t FeedHeaders_(const char* data, size_t len);
+    size_t FeedData_(const char* data, size_t len);
+
+    bool BeginPart_();
+    bool PartData_(const char* data, size_t len);
+    bool EndPart_();
+    void ParseDisposition_(const StrView& value);
+    bool OpenFile_();
+    size_t Fail_(int code);
+
+    // 在[data, data + len)里面查找分隔符，没有返回len
+    size_t Search_(const char* data, size_t len) const;
+    // 末尾可能是分隔符开头的那一段的起始位置（需要留到下次再判断）
+    size_t SafeLen_(const char* data, size_t len) const;
+
+    const UploadConfig* config_;
+    std::string delim_;         // "\r\n--" + boundary
+    size_t skip_[256];          // Horspool的跳转表
+
+    STATE state_;
+    int errorCode_;
+    size_t headerBytes_;        // 当前部分的头部已经收了多少字节
+
+    Part part_;                 // 正在接收的部分
+    int fileFd_;                // 正在写的文件，-1表示不是文件（或者文件名为空，丢弃内容）
+    bool isFile_;
+    bool committed_;
+    bool started_;              // 已经检查过请求体的开头
+    int pipe_[2];               // splice用的管道，第一次用的时候创建；-2表示不支持splice
+
+    std::vector<Part> parts_;
+    std::vector<std::string> paths_;    // 已经创建的文件，没有Commit时析构会删除
+};
+
+#endif //MULTIPART_H
@@ -0,0 +1,174 @@
+#include "router.h"
+
+namespace {
+
+// 扩展名 -> MIME类型，用在响应头Content-Type中
+struct MimeEntry {
+    const char* suffix;
+    size_t len;
+    const char* type;
+    size_t typeLen;
+
+    constexpr MimeEntry(const char* s, const char* t)
+        : suffix(s), len(Route::ConstStrlen(s)), type(t), typeLen(Route::ConstStrlen(t)) {}
+};
+
+// 新增路由只需要在这里加一行
+constexpr Route ROUTES[] = {
+    // 默认页面
+    { "/",              RouteMatch::EXACT,  RouteAction::FILE,     "/index.html" },
+    { "/index",         RouteMatch::EXACT,  RouteAction::FILE,     "/index.html" },
+    { "/welcome",       RouteMatch::EXACT,  RouteAction::FILE,     "/welcome.html" },
+    { "/video",         RouteMatch::EXACT,  RouteAction::FILE,     "/video.html" },
+    { "/picture",       RouteMatch::EXACT,  RouteAction::FILE,     "/picture.html" },
+    // 表单页面：GET返回页面本身，POST交给对应的处理函数
+    { "/register",      RouteMatch::EXACT,  RouteAction::REGISTER, "/register.html" },
+    { "/register.html", RouteMatch::EXACT,  RouteAction::REGISTER, "/register.html" },
+    { "/login",         RouteMatch::EXACT,  RouteAction::LOGIN,    "/login.html" },
+    { "/login.html",    RouteMatch::EXACT,  RouteAction::LOGIN,    "/login.html" },
+    { "/upload",        RouteMatch::EXACT,  RouteAction::UPLOAD,   "/upload.html" },
+    // WebSocket（回显）
+    { "/ws",            RouteMatch::EXACT,  RouteAction::WEBSOCKET, nullptr },
+    // 静态资源目录
+    { "/css/",          RouteMatch::PREFIX, RouteAction::FILE,     nullptr },
+    { "/js/",           RouteMatch::PREFIX, RouteAction::FILE,     nullptr },
+    { "/fonts/",        RouteMatch::PREFIX, RouteAction::FILE,     nullptr },
+    { "/images/",       RouteMatch::PREFIX, RouteAction::FILE,     nullptr },
+    { "/video/",        RouteMatch::PREFIX, RouteAction::FILE,     nullptr },
+};
+
+constexpr MimeEntry MIME_TYPES[] = {
+    { ".html",  "text/html" },
+    { ".xml",   "text/xml" },
+    { ".xhtml", "application/xhtml+xml" },
+    { ".txt",   "text/plain" },
+    { ".rtf",   "application/rtf" },
+    { ".pdf",   "application/pdf" },
+    { ".word",  "application/msword" },
+    { ".png",   "image/png" },
+    { ".gif",   "image/gif" },
+    { ".jpg",   "image/jpeg" },
+    { ".jpeg",  "image/jpeg" },
+    { ".ico",   "image/x-icon" },
+    { ".svg",   "image/svg+xml" },
+    { ".webp",  "image/webp" },
+    { ".au",    "audio/basic" },
+    { ".mp3",   "audio/mpeg" },
+    { ".mpeg",  "video/mpeg" },
+    { ".mpg",   "video/mpeg" },
+    { ".avi",   "video/x-msvideo" },
+    { ".mp4",   "video/mp4" },
+    { ".webm",  "video/webm" },
+    { ".gz",    "application/x-gzip" },
+    { ".tar",   "application/x-tar" },
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
+    { ".json",  "application/json" },
+    { ".woff",  "font/woff" },
+    { ".woff2", "font/woff2" },
+    { ".ttf",   "font/ttf" },
+    { ".otf",   "font/otf" },
+    { ".eot",   "application/vnd.ms-fontobject" },
+};
+
+constexpr StrView DEFAULT_MIME("text/plain", 10);
+
+constexpr bool Indexed(const Route& r) { return r.match == RouteMatch::EXACT; }
+constexpr bool Indexed(const MimeEntry&) { return true; }
+constexpr const char* KeyOf(const Route& r) { return r.pattern; }
+constexpr const char* KeyOf(const MimeEntry& m) { return m.suffix; }
+constexpr size_t KeyLen(const Route& r) { return r.len; }
+constexpr size_t KeyLen(const MimeEntry& m) { return m.len; }
+
+// 编译期生成的完美哈希索引：不断尝试seed，直到表里所有参与索引的key都落在不同的槽里，
+// slot[h]记录key在表中的下标（-1表示空槽）
+template<size_t SLOTS>
+struct PerfectIndex {
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of two");
+    static const uint32_t MAX_SEED = 1 << 12;
+
+    uint32_t seed;
+    int16_t slot[SLOTS];
+
+    template<class T, size_t N>
+    constexpr explicit PerfectIndex(const T (&table)[N]) : seed(0), slot{} {
+        static_assert(N < SLOTS, "too many keys for the slot count");
+        for(; seed < MAX_SEED; seed++) {
+            for(size_t i = 0; i < SLOTS; i++) { slot[i] = -1; }
+            bool collide = false;
+            for(size_t i = 0; i < N && !collide; i++) {
+                if(!Indexed(table[i])) { continue; }
+                size_t h = Router::Hash(KeyOf(table[i]), KeyLen(table[i]), seed) & (SLOTS - 1);
+                if(slot[h] >= 0) { collide = true; }
+                else { slot[h] = static_cast<int16_t>(i); }
+            }
+            if(!collide) { break; }
+        }
+    }
+
+    // 找不到种子（一般是表里有重复的key）时为false
+    constexpr bool ok() const { return seed < MAX_SEED; }
+
+    template<class T, size_t N>
+    const T* Find(const T (&table)[N], const char* key, size_t len) const {
+        int idx = slot[Router::Hash(key, len, seed) & (SLOTS - 1)];
+        if(idx < 0) { return nullptr; }
+        const T& e = table[idx];
+        return (KeyLen(e) == len && memcmp(KeyOf(e), key, len) == 0) ? &e : nullptr;
+    }
+};
+
+// 前缀路由的下标，编译期按长度从长到短排好，第一个命中的就是最长前缀
+template<size_t N>
+struct PrefixList {
+    int16_t idx[N];
+    size_t count;
+
+    constexpr explicit PrefixList(const Route (&table)[N]) : idx{}, count(0) {
+        for(size_t i = 0; i < N; i++) {
+            if(table[i].match != RouteMatch::PREFIX) { continue; }
+            size_t j = count++;
+            while(j > 0 && table[idx[j - 1]].len < table[i].len) {
+                idx[j] = idx[j - 1];
+                j--;
+            }
+            idx[j] = static_cast<int16_t>(i);
+        }
+    }
+};
+
+constexpr size_t ROUTE_NUM = sizeof(ROUTES) / sizeof(ROUTES[0]);
+
+constexpr PerfectIndex<32> EXACT_INDEX(ROUTES);
+static_assert(EXACT_INDEX.ok(), "duplicate exact routes in ROUTES");
+
+constexpr PerfectIndex<128> MIME_INDEX(MIME_TYPES);
+static_assert(MIME_INDEX.ok(), "duplicate suffix in MIME_TYPES");
+
+constexpr PrefixList<ROUTE_NUM> PREFIX_ROUTES(ROUTES);
+
+} // namespace
+
+const Route* Router::Match(const StrView& path) {
+    const Route* route = EXACT_INDEX.Find(ROUTES, path.data, path.len);
+    if(route) { return route; }
+    for(size_t i = 0; i < PREFIX_ROUTES.count; i++) {
+        const Route& r = ROUTES[PREFIX_ROUTES.idx[i]];
+        if(path.len >= r.len && memcmp(path.data, r.pattern, r.len) == 0) {
+            return &r;
+        }
+    }
+    return nullptr;
+}
+
+StrView Router::MimeType(const StrView& path) {
+    // 只看最后一段里面的最后一个'.'
+    const char* dot = nullptr;
+    for(const char* p = path.end(); p != path.begin(); ) {
+        if(*--p == '.') { dot = p; break; }
+        if(*p == '/') { break; }
+    }
+    if(dot == nullptr) { return DEFAULT_MIME; }
+    const MimeEntry* m = MIME_INDEX.Find(MIME_TYPES, dot, path.end() - dot);
+    return m ? StrView(m->type, m->typeLen) : DEFAULT_MIME;
+}
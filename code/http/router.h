@@ -0,0 +1,78 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+/**********************************************************************
+ * ------------------------------Router--------------------------------
+ *
+ * 静态路由表：所有路由都写在router.cpp的ROUTES里面（一张表），分三种匹配：
+ * 1、EXACT：精确匹配，例如"/login" -> "/login.html"，或者交给表单处理函数；
+ * 2、PREFIX：前缀匹配，例如"/css/"，按最长前缀生效；
+ * 3、后缀（扩展名）：MIME_TYPES，用于Content-type。
+ *
+ * 精确匹配和扩展名匹配都是在编译期生成的完美哈希（constexpr遍历种子，直到
+ * 所有key落到不同的槽里），运行时只需要算一次哈希、比较一次字符串；新增
+ * 路由只需要在表里加一行，哈希冲突会在编译期通过static_assert报出来。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include "../buffer/arena.h"
+
+// 路由命中以后要做的事情
+enum class RouteAction {
+    FILE,       // 返回静态文件（file为空时就是请求路径本身）
+    LOGIN,      // 登录表单（POST）
+    REGISTER,   // 注册表单（POST）
+    WEBSOCKET,  // WebSocket（只接受Upgrade: websocket的GET请求）
+    UPLOAD,     // 文件上传（POST multipart/form-data，流式写到上传目录）
+};
+
+enum class RouteMatch {
+    EXACT,
+    PREFIX,
+};
+
+struct Route {
+    const char* pattern;    // 路径或者路径前缀
+    size_t len;
+    RouteMatch match;
+    RouteAction action;
+    const char* file;       // 对应的资源文件（相对资源目录），nullptr表示使用请求路径
+    size_t fileLen;
+
+    constexpr Route(const char* p, RouteMatch m, RouteAction a, const char* f)
+        : pattern(p), len(ConstStrlen(p)), match(m), action(a),
+          file(f), fileLen(f ? ConstStrlen(f) : 0) {}
+
+    static constexpr size_t ConstStrlen(const char* s) {
+        size_t n = 0;
+        while(s[n]) { n++; }
+        return n;
+    }
+};
+
+class Router {
+public:
+    // 先精确匹配，再按最长前缀匹配，都没命中返回nullptr（按请求路径找静态文件）
+    static const Route* Match(const StrView& path);
+
+    // 根据扩展名返回MIME类型，未知类型返回text/plain
+    static StrView MimeType(const StrView& path);
+
+    // 编译期/运行期共用的FNV-1a哈希，seed用来寻找无冲突的完美哈希；
+    // FNV的低位只和输入的低位有关，取模之前再做一次混合，让高位也参与进来
+    static constexpr uint32_t Hash(const char* s, size_t len, uint32_t seed) {
+        uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+        for(size_t i = 0; i < len; i++) {
+            h ^= static_cast<unsigned char>(s[i]);
+            h *= 16777619u;
+        }
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        return h;
+    }
+};
+
+#endif //ROUTER_H
@@ -0,0 +1,17 @@
+#include "tcpstats.h"
+#include <stddef.h>      // offsetof
+#include <sys/socket.h>  // getsockopt
+#include <netinet/in.h>  // IPPROTO_TCP
+#include <linux/tcp.h>   // TCP_INFO, struct tcp_info
+
+bool DataSegmentsOut(int fd, uint32_t* segs) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    // 老内核返回的结构体短一些，长度不够说明没有这一项
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0
+            || len < offsetof(struct tcp_info, tcpi_data_segs_out) + sizeof(info.tcpi_data_segs_out)) {
+        return false;
+    }
+    *segs = info.tcpi_data_segs_out;
+    return true;
+}
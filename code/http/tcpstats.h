@@ -0,0 +1,21 @@
+#ifndef TCP_STATS_H
+#define TCP_STATS_H
+
+/**********************************************************************
+ * ------------------------------TcpStats------------------------------
+ *
+ * 从内核的TCP_INFO里面取连接的发送统计，用来衡量发送策略（TCP_NODELAY、
+ * TCP_CORK）的效果：一个连接一共发出了多少个带数据的报文段，除以回复的
+ * 响应数就是每个响应平均用了几个包（压测脚本见webbench-1.5/sendbench.sh）。
+ *
+ * 单独放在一个文件里：带tcpi_data_segs_out的struct tcp_info在<linux/tcp.h>
+ * 里面，它和httpconn.h用的<netinet/tcp.h>不能同时包含。
+ *
+***********************************************************************/
+
+#include <cstdint>
+
+// fd上已经发出的带数据的报文段数（包括重传）；内核太老（4.6以前）没有这一项时返回false
+bool DataSegmentsOut(int fd, uint32_t* segs);
+
+#endif //TCP_STATS_H
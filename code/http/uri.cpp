@@ -0,0 +1,122 @@
+#include "uri.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool Uri::ParseTarget(char* target, size_t len, StrView* path, StrView* query) {
+    assert(target && path && query);
+    // 只支持origin-form，例如 /index.html?a=1
+    if(len == 0 || target[0] != '/') {
+        return false;
+    }
+    if(IsCanonical_(target, target + len)) {
+        *path = StrView(target, len);
+        *query = StrView();
+        return true;
+    }
+    return Normalize_(target, target + len, path, query);
+}
+
+bool Uri::IsCanonical_(const char* begin, const char* end) {
+    // begin[0]已经确认是'/'，从第二个字符开始检查，每个字符都要和它前一个字符一起看
+    const char* p = begin + 1;
+#ifdef __SSE2__
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i question = _mm_set1_epi8('?');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i zero = _mm_setzero_si128();
+    for(; end - p >= 16; p += 16) {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p - 1));
+        // 需要走慢速路径的情况：'%'、'?'、'\0'，以及'/'后面紧跟'.'或者'/'
+        __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(cur, percent), _mm_cmpeq_epi8(cur, question));
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(cur, zero));
+        __m128i afterSlash = _mm_or_si128(_mm_cmpeq_epi8(cur, dot), _mm_cmpeq_epi8(cur, slash));
+        bad = _mm_or_si128(bad, _mm_and_si128(_mm_cmpeq_epi8(prev, slash), afterSlash));
+        if(_mm_movemask_epi8(bad)) {
+            return false;
+        }
+    }
+#endif
+    for(; p < end; p++) {
+        char c = *p;
+        if(c == '%' || c == '?' || c == '\0') { return false; }
+        if(p[-1] == '/' && (c == '.' || c == '/')) { return false; }
+    }
+    return true;
+}
+
+// 调用者保证target末尾（end处）还有一个字节可写，用来放'\0'
+bool Uri::Normalize_(char* begin, char* end, StrView* path, StrView* query) {
+    *query = StrView();
+    char* w = begin + 1;        // 写指针（解码和规范化只会让结果变短，可以原地写）
+    char* seg = w;              // 当前段的起始位置（紧跟在'/'后面）
+    const char* r = begin + 1;  // 读指针
+    for(;; r++) {
+        bool atEnd = (r == end || *r == '?');
+        if(!atEnd) {
+            char c = *r;
+            if(c == '%') {
+                // 路径里面的%必须是合法的两位十六进制，解码出'\0'也不行（会截断文件名）
+                if(end - r < 3) { return false; }
+                int hi = HexValue(r[1]), lo = HexValue(r[2]);
+                if(hi < 0 || lo < 0 || (hi | lo) == 0) { return false; }
+                c = static_cast<char>(hi * 16 + lo);
+                r += 2;
+            }
+            else if(c == '\0') {
+                return false;
+            }
+            if(c != '/') {
+                *w++ = c;
+                continue;
+            }
+        }
+        // 走到这里说明一个段结束了（遇到'/'或者路径结束），检查是不是"."或者".."
+        size_t segLen = w - seg;
+        if(segLen == 1 && seg[0] == '.') {
+            w = seg;                            // 丢掉"."
+        }
+        else if(segLen == 2 && seg[0] == '.' && seg[1] == '.') {
+            if(seg == begin + 1) {
+                return false;                   // 越过根目录了
+            }
+            w = seg - 1;                        // 回到上一段末尾的'/'
+            while(*(w - 1) != '/') { w--; }     // 再回到上一段的开头，相当于丢掉上一段
+            seg = w;
+        }
+        else if(segLen > 0 && !atEnd) {
+            *w++ = '/';                         // 普通的段，保留分隔符（空段即"//"直接合并）
+            seg = w;
+        }
+        if(atEnd) { break; }
+    }
+    if(r != end) {
+        *query = StrView(r + 1, end);
+    }
+    *w = '\0';
+    *path = StrView(begin, w);
+    return true;
+}
+
+size_t Uri::UrlDecode(char* str, size_t len, bool plusAsSpace) {
+    char* w = str;
+    const char* r = str;
+    const char* end = str + len;
+    while(r < end) {
+        char c = *r;
+        int hi, lo;
+        if(c == '%' && end - r >= 3 && (hi = HexValue(r[1])) >= 0 && (lo = HexValue(r[2])) >= 0) {
+            c = static_cast<char>(hi * 16 + lo);
+            r += 3;
+        }
+        else {
+            if(c == '+' && plusAsSpace) { c = ' '; }
+            r++;
+        }
+        *w++ = c;
+    }
+    return w - str;
+}
@@ -0,0 +1,49 @@
+#ifndef URI_H
+#define URI_H
+
+/**********************************************************************
+ * --------------------------------Uri---------------------------------
+ *
+ * 请求目标（request-target）的解码与规范化：
+ * 1、按'?'切分出路径和查询串（查询串保持原样，交给具体业务解析）；
+ * 2、路径里面的%XX解码，%00和非法的%序列直接拒绝；
+ * 3、合并"//"，消除"."和".."段，".."越过根目录时拒绝（防止../穿越到
+ *    资源目录外面）；
+ * 4、绝大多数静态资源的路径不含'%'、'?'，也没有以'.'开头的段，用SSE2一
+ *    次扫描确认以后直接返回，不做任何改写。
+ *
+ * 解码和规范化都是原地进行的（结果只会变短），调用者需要传入可写的内存
+ * （一般是arena上的拷贝）。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include "../buffer/arena.h"
+
+class Uri {
+public:
+    // 解析请求目标，成功时path指向规范化后的路径（以'/'开头，末尾补'\0'），
+    // query指向'?'后面的原始查询串；失败返回false（应当回复400）
+    static bool ParseTarget(char* target, size_t len, StrView* path, StrView* query);
+
+    // 原地解码application/x-www-form-urlencoded格式的字符串，返回解码后的长度；
+    // plusAsSpace为true时把'+'还原成空格，非法的%序列原样保留
+    static size_t UrlDecode(char* str, size_t len, bool plusAsSpace);
+
+    // 十六进制字符转换成数值，不是十六进制字符时返回-1
+    static int HexValue(char ch) {
+        if(ch >= '0' && ch <= '9') return ch - '0';
+        if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+        if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+        return -1;
+    }
+
+private:
+    // 快速路径：路径里面没有'%'、'?'、"//"，也没有以'.'开头的段，即已经是规范形式
+    static bool IsCanonical_(const char* begin, const char* end);
+
+    // 慢速路径：一次遍历完成解码、切分和规范化
+    static bool Normalize_(char* begin, char* end, StrView* path, StrView* query);
+};
+
+#endif //URI_H
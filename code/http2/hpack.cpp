@@ -0,0 +1,424 @@
+#include "hpack.h"
+#include <algorithm>
+
+/* ---------------------------------Huffman--------------------------------- */
+
+// RFC 7541附录B里面每个符号（0~255，256是EOS）的码长；这张码表是规范Huffman编码，
+//  码长相同的符号按符号值从小到大连续编码，码字可以完全由码长推导出来
+static const uint8_t HUFFMAN_BITS[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+     6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+     5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+    13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+     7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+    15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+     6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+static const int HUFFMAN_MAX_BITS = 30;
+static const uint16_t HUFFMAN_EOS = 256;
+
+namespace {
+// 由码长推导出来的编码/解码表
+struct HuffmanCode {
+    uint32_t code[257];                     // 每个符号的码字（右对齐）
+    uint32_t first[HUFFMAN_MAX_BITS + 1];   // 每种码长的第一个码字
+    uint32_t count[HUFFMAN_MAX_BITS + 1];   // 每种码长的符号个数
+    uint32_t offset[HUFFMAN_MAX_BITS + 1];  // 每种码长的第一个符号在symbols里面的位置
+    uint16_t symbols[257];                  // 按(码长, 符号值)排好序的符号
+
+    HuffmanCode() {
+        memset(count, 0, sizeof(count));
+        for(int s = 0; s < 257; s++) { count[HUFFMAN_BITS[s]]++; }
+        uint32_t next = 0, pos = 0;
+        for(int len = 1; len <= HUFFMAN_MAX_BITS; len++) {
+            first[len] = next;
+            offset[len] = pos;
+            next = (next + count[len]) << 1;
+            pos += count[len];
+        }
+        uint32_t fill[HUFFMAN_MAX_BITS + 1];
+        memcpy(fill, first, sizeof(fill));
+        for(int s = 0; s < 257; s++) {
+            int len = HUFFMAN_BITS[s];
+            code[s] = fill[len];
+            symbols[offset[len] + (fill[len] - first[len])] = s;
+            fill[len]++;
+        }
+    }
+
+    static const HuffmanCode& Instance() {
+        static const HuffmanCode table;
+        return table;
+    }
+};
+}
+
+bool Huffman::Decode(const uint8_t* data, size_t len, Arena* arena, StrView* out) {
+    const HuffmanCode& t = HuffmanCode::Instance();
+    // 最短的码字是5位，解码以后最多是原来的8/5
+    char* dst = static_cast<char*>(arena->Alloc(len * 8 / 5 + 1, 1));
+    char* w = dst;
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint64_t acc = 0;       // 还没解码的位（右对齐，只有低bits位有效）
+    int bits = 0;
+    for(;;) {
+        while(bits < HUFFMAN_MAX_BITS && p < end) {
+            acc = (acc << 8) | *p++;
+            bits += 8;
+        }
+        if(bits == 0) { break; }
+        // 取出最前面的30位，不够的用1补齐（填充位就是EOS的前缀）
+        uint32_t peek = (bits >= HUFFMAN_MAX_BITS)
+                        ? static_cast<uint32_t>(acc >> (bits - HUFFMAN_MAX_BITS))
+                        : static_cast<uint32_t>((acc << (HUFFMAN_MAX_BITS - bits)) | ((1u << (HUFFMAN_MAX_BITS - bits)) - 1));
+        peek &= (1u << HUFFMAN_MAX_BITS) - 1;
+        int n = 5;
+        uint32_t code = 0;
+        for(; n <= HUFFMAN_MAX_BITS; n++) {
+            code = peek >> (HUFFMAN_MAX_BITS - n);
+            if(code - t.first[n] < t.count[n]) { break; }
+        }
+        if(n > bits) {
+            // 剩下的只能是填充：少于8位并且全是1
+            uint64_t mask = (1ull << bits) - 1;
+            if(bits >= 8 || (acc & mask) != mask) { return false; }
+            break;
+        }
+        uint16_t sym = t.symbols[t.offset[n] + (code - t.first[n])];
+        if(sym == HUFFMAN_EOS) { return false; }
+        *w++ = static_cast<char>(sym);
+        bits -= n;
+        acc &= (1ull << bits) - 1;
+    }
+    *w = '\0';
+    *out = StrView(dst, w);
+    return true;
+}
+
+size_t Huffman::EncodedLen(const StrView& str) {
+    size_t bits = 0;
+    for(char c : str) { bits += HUFFMAN_BITS[static_cast<uint8_t>(c)]; }
+    return (bits + 7) / 8;
+}
+
+void Huffman::Encode(const StrView& str, Buffer& out) {
+    const HuffmanCode& t = HuffmanCode::Instance();
+    char tmp[256];
+    size_t n = 0;
+    uint64_t acc = 0;
+    int bits = 0;
+    for(char c : str) {
+        uint8_t s = static_cast<uint8_t>(c);
+        acc = (acc << HUFFMAN_BITS[s]) | t.code[s];
+        bits += HUFFMAN_BITS[s];
+        while(bits >= 8) {
+            bits -= 8;
+            tmp[n++] = static_cast<char>(acc >> bits);
+            if(n == sizeof(tmp)) { out.Append(tmp, n); n = 0; }
+        }
+        acc &= (1ull << bits) - 1;
+    }
+    if(bits > 0) {
+        // 最后不满一个字节的部分用1填充
+        tmp[n++] = static_cast<char>((acc << (8 - bits)) | ((1u << (8 - bits)) - 1));
+    }
+    out.Append(tmp, n);
+}
+
+/* --------------------------------HpackTable-------------------------------- */
+
+#define HPACK_ENTRY(n, v) { StrView(n, sizeof(n) - 1), StrView(v, sizeof(v) - 1) }
+
+// RFC 7541附录A
+static const StrView STATIC_TABLE[HpackTable::STATIC_COUNT][2] = {
+    HPACK_ENTRY(":authority", ""),
+    HPACK_ENTRY(":method", "GET"),
+    HPACK_ENTRY(":method", "POST"),
+    HPACK_ENTRY(":path", "/"),
+    HPACK_ENTRY(":path", "/index.html"),
+    HPACK_ENTRY(":scheme", "http"),
+    HPACK_ENTRY(":scheme", "https"),
+    HPACK_ENTRY(":status", "200"),
+    HPACK_ENTRY(":status", "204"),
+    HPACK_ENTRY(":status", "206"),
+    HPACK_ENTRY(":status", "304"),
+    HPACK_ENTRY(":status", "400"),
+    HPACK_ENTRY(":status", "404"),
+    HPACK_ENTRY(":status", "500"),
+    HPACK_ENTRY("accept-charset", ""),
+    HPACK_ENTRY("accept-encoding", "gzip, deflate"),
+    HPACK_ENTRY("accept-language", ""),
+    HPACK_ENTRY("accept-ranges", ""),
+    HPACK_ENTRY("accept", ""),
+    HPACK_ENTRY("access-control-allow-origin", ""),
+    HPACK_ENTRY("age", ""),
+    HPACK_ENTRY("allow", ""),
+    HPACK_ENTRY("authorization", ""),
+    HPACK_ENTRY("cache-control", ""),
+    HPACK_ENTRY("content-disposition", ""),
+    HPACK_ENTRY("content-encoding", ""),
+    HPACK_ENTRY("content-language", ""),
+    HPACK_ENTRY("content-length", ""),
+    HPACK_ENTRY("content-location", ""),
+    HPACK_ENTRY("content-range", ""),
+    HPACK_ENTRY("content-type", ""),
+    HPACK_ENTRY("cookie", ""),
+    HPACK_ENTRY("date", ""),
+    HPACK_ENTRY("etag", ""),
+    HPACK_ENTRY("expect", ""),
+    HPACK_ENTRY("expires", ""),
+    HPACK_ENTRY("from", ""),
+    HPACK_ENTRY("host", ""),
+    HPACK_ENTRY("if-match", ""),
+    HPACK_ENTRY("if-modified-since", ""),
+    HPACK_ENTRY("if-none-match", ""),
+    HPACK_ENTRY("if-range", ""),
+    HPACK_ENTRY("if-unmodified-since", ""),
+    HPACK_ENTRY("last-modified", ""),
+    HPACK_ENTRY("link", ""),
+    HPACK_ENTRY("location", ""),
+    HPACK_ENTRY("max-forwards", ""),
+    HPACK_ENTRY("proxy-authenticate", ""),
+    HPACK_ENTRY("proxy-authorization", ""),
+    HPACK_ENTRY("range", ""),
+    HPACK_ENTRY("referer", ""),
+    HPACK_ENTRY("refresh", ""),
+    HPACK_ENTRY("retry-after", ""),
+    HPACK_ENTRY("server", ""),
+    HPACK_ENTRY("set-cookie", ""),
+    HPACK_ENTRY("strict-transport-security", ""),
+    HPACK_ENTRY("transfer-encoding", ""),
+    HPACK_ENTRY("user-agent", ""),
+    HPACK_ENTRY("vary", ""),
+    HPACK_ENTRY("via", ""),
+    HPACK_ENTRY("www-authenticate", ""),
+};
+
+#undef HPACK_ENTRY
+
+HpackTable::HpackTable(size_t maxSize) : size_(0), maxSize_(maxSize) {}
+
+bool HpackTable::Get(size_t index, StrView* name, StrView* value) const {
+    if(index == 0) { return false; }
+    if(index <= STATIC_COUNT) {
+        *name = STATIC_TABLE[index - 1][0];
+        *value = STATIC_TABLE[index - 1][1];
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if(index >= entries_.size()) { return false; }
+    const auto& e = entries_[index];
+    *name = StrView(e.first.data(), e.first.size());
+    *value = StrView(e.second.data(), e.second.size());
+    return true;
+}
+
+void HpackTable::Add(const StrView& name, const StrView& value) {
+    size_t need = name.len + value.len + ENTRY_OVERHEAD;
+    if(need > maxSize_) {
+        // 比整张表还大：清空动态表，这一项也不加入
+        entries_.clear();
+        size_ = 0;
+        return;
+    }
+    Evict_(need);
+    entries_.emplace_front(name.ToString(), value.ToString());
+    size_ += need;
+}
+
+void HpackTable::SetMaxSize(size_t maxSize) {
+    maxSize_ = maxSize;
+    Evict_(0);
+}
+
+void HpackTable::Evict_(size_t need) {
+    while(!entries_.empty() && size_ + need > maxSize_) {
+        const auto& e = entries_.back();
+        size_ -= e.first.size() + e.second.size() + ENTRY_OVERHEAD;
+        entries_.pop_back();
+    }
+}
+
+size_t HpackTable::Find(const StrView& name, const StrView& value, bool* nameOnly) const {
+    size_t nameIndex = 0;
+    for(size_t i = 0; i < STATIC_COUNT; i++) {
+        if(STATIC_TABLE[i][0] == name) {
+            if(STATIC_TABLE[i][1] == value) {
+                *nameOnly = false;
+                return i + 1;
+            }
+            if(!nameIndex) { nameIndex = i + 1; }
+        }
+    }
+    for(size_t i = 0; i < entries_.size(); i++) {
+        const auto& e = entries_[i];
+        if(StrView(e.first.data(), e.first.size()) == name) {
+            if(StrView(e.second.data(), e.second.size()) == value) {
+                *nameOnly = false;
+                return STATIC_COUNT + 1 + i;
+            }
+            if(!nameIndex) { nameIndex = STATIC_COUNT + 1 + i; }
+        }
+    }
+    *nameOnly = (nameIndex != 0);
+    return nameIndex;
+}
+
+/* -------------------------------HpackDecoder------------------------------- */
+
+HpackDecoder::HpackDecoder(size_t maxTableSize) : table_(maxTableSize), maxTableSize_(maxTableSize) {}
+
+bool HpackDecoder::DecodeInt(const uint8_t*& p, const uint8_t* end, int prefix, uint64_t* value) {
+    if(p >= end) { return false; }
+    uint64_t mask = (1u << prefix) - 1;
+    uint64_t v = *p++ & mask;
+    if(v < mask) {
+        *value = v;
+        return true;
+    }
+    for(int shift = 0; p < end && shift <= 56; shift += 7) {
+        uint8_t b = *p++;
+        v += static_cast<uint64_t>(b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HpackDecoder::DecodeString_(const uint8_t*& p, const uint8_t* end, Arena* arena, StrView* out) {
+    if(p >= end) { return false; }
+    bool huffman = (*p & 0x80) != 0;
+    uint64_t len;
+    if(!DecodeInt(p, end, 7, &len) || len > static_cast<uint64_t>(end - p)) { return false; }
+    if(huffman) {
+        if(!Huffman::Decode(p, len, arena, out)) { return false; }
+    }
+    else {
+        *out = arena->CopyStr(reinterpret_cast<const char*>(p), len);
+    }
+    p += len;
+    return true;
+}
+
+bool HpackDecoder::Decode(const uint8_t* data, size_t len, Arena* arena, Field** fields) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    Field** tail = fields;
+    *fields = nullptr;
+    bool fieldSeen = false;
+    while(p < end) {
+        uint8_t b = *p;
+        uint64_t index;
+        StrView name, value;
+        if(b & 0x80) {
+            // 索引字段：名字和值都在表里
+            if(!DecodeInt(p, end, 7, &index) || !table_.Get(index, &name, &value)) { return false; }
+            // 动态表的项随时可能被淘汰，拷贝一份到arena上
+            name = arena->CopyStr(name);
+            value = arena->CopyStr(value);
+        }
+        else if((b & 0xe0) == 0x20) {
+            // 动态表大小更新，只能出现在头部块的开头
+            if(!DecodeInt(p, end, 5, &index) || index > maxTableSize_ || fieldSeen) { return false; }
+            table_.SetMaxSize(index);
+            continue;
+        }
+        else {
+            // 字面值字段：01（加入动态表）、0000（不加入）、0001（永不加入）
+            bool incremental = (b & 0xc0) == 0x40;
+            if(!DecodeInt(p, end, incremental ? 6 : 4, &index)) { return false; }
+            if(index) {
+                StrView unused;
+                if(!table_.Get(index, &name, &unused)) { return false; }
+                name = arena->CopyStr(name);
+            }
+            else if(!DecodeString_(p, end, arena, &name)) {
+                return false;
+            }
+            if(!DecodeString_(p, end, arena, &value)) { return false; }
+            if(incremental) { table_.Add(name, value); }
+        }
+        fieldSeen = true;
+        *tail = arena->New<Field>(name, value);
+        tail = &(*tail)->next;
+    }
+    return true;
+}
+
+/* -------------------------------HpackEncoder------------------------------- */
+
+HpackEncoder::HpackEncoder(size_t maxTableSize)
+    : table_(maxTableSize), maxTableSize_(maxTableSize), sizeUpdate_(false) {}
+
+void HpackEncoder::SetMaxTableSize(size_t size) {
+    size_t newSize = std::min(size, maxTableSize_);
+    if(newSize != table_.MaxSize()) {
+        table_.SetMaxSize(newSize);
+        sizeUpdate_ = true;
+    }
+}
+
+void HpackEncoder::BeginBlock(Buffer& out) {
+    if(sizeUpdate_) {
+        EncodeInt(table_.MaxSize(), 5, 0x20, out);
+        sizeUpdate_ = false;
+    }
+}
+
+void HpackEncoder::EncodeInt(uint64_t value, int prefix, uint8_t flags, Buffer& out) {
+    uint8_t buf[16];
+    size_t n = 0;
+    uint64_t mask = (1u << prefix) - 1;
+    if(value < mask) {
+        buf[n++] = flags | static_cast<uint8_t>(value);
+    }
+    else {
+        buf[n++] = flags | static_cast<uint8_t>(mask);
+        value -= mask;
+        while(value >= 0x80) {
+            buf[n++] = static_cast<uint8_t>(value & 0x7f) | 0x80;
+            value >>= 7;
+        }
+        buf[n++] = static_cast<uint8_t>(value);
+    }
+    out.Append(buf, n);
+}
+
+void HpackEncoder::EncodeString_(const StrView& str, Buffer& out) {
+    size_t huffLen = Huffman::EncodedLen(str);
+    if(huffLen < str.len) {
+        EncodeInt(huffLen, 7, 0x80, out);
+        Huffman::Encode(str, out);
+    }
+    else {
+        EncodeInt(str.len, 7, 0x00, out);
+        out.Append(str.data, str.len);
+    }
+}
+
+void HpackEncoder::Encode(const StrView& name, const StrView& value, Buffer& out, bool indexing) {
+    bool nameOnly = false;
+    size_t index = table_.Find(name, value, &nameOnly);
+    if(index && !nameOnly) {
+        EncodeInt(index, 7, 0x80, out);
+        return;
+    }
+    EncodeInt(index, indexing ? 6 : 4, indexing ? 0x40 : 0x00, out);
+    if(!index) { EncodeString_(name, out); }
+    EncodeString_(value, out);
+    if(indexing) { table_.Add(name, value); }
+}
@@ -0,0 +1,106 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+/**********************************************************************
+ * -------------------------------HPACK--------------------------------
+ *
+ * HTTP/2的头部压缩（RFC 7541）：
+ * 1、HpackTable：静态表（61项）+ 动态表，两端各自维护一份，靠按顺序编解码
+ *    保持同步，所以同一个连接上的头部块必须严格按收发顺序处理；
+ * 2、HpackDecoder：解码对端发来的头部块，字段的字符串都放在调用者给的
+ *    arena上（一般是流自己的arena），动态表里的字符串由表自己保存；
+ * 3、HpackEncoder：编码响应头，能命中静态表/动态表就只发索引，否则按字面
+ *    值发送并加入动态表（content-length这类每次都不一样的值不入表）；
+ * 4、Huffman：规范Huffman编码，码表只需要记录每个符号的码长，码字在第一
+ *    次使用时按规范编码的规则推导出来。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include "../buffer/arena.h"
+#include "../buffer/buffer.h"
+
+class Huffman {
+public:
+    // 解码失败（出现EOS、填充超过7位或者不全是1）返回false
+    static bool Decode(const uint8_t* data, size_t len, Arena* arena, StrView* out);
+    static size_t EncodedLen(const StrView& str);
+    static void Encode(const StrView& str, Buffer& out);
+};
+
+class HpackTable {
+public:
+    static const size_t STATIC_COUNT = 61;
+    static const size_t ENTRY_OVERHEAD = 32;    // 每项额外计入的大小
+
+    explicit HpackTable(size_t maxSize = 4096);
+
+    // 索引从1开始，先是静态表，再是动态表（最新加入的在前面）
+    bool Get(size_t index, StrView* name, StrView* value) const;
+    void Add(const StrView& name, const StrView& value);
+    void SetMaxSize(size_t maxSize);
+    size_t MaxSize() const { return maxSize_; }
+
+    // 返回名字和值都匹配的索引；只有名字匹配时返回名字的索引并把*nameOnly置为true；都没有返回0
+    size_t Find(const StrView& name, const StrView& value, bool* nameOnly) const;
+
+private:
+    void Evict_(size_t need);
+
+    std::deque<std::pair<std::string, std::string>> entries_;
+    size_t size_;
+    size_t maxSize_;
+};
+
+class HpackDecoder {
+public:
+    // 解码结果按头部块里面的顺序挂在单链表上
+    struct Field {
+        StrView name;
+        StrView value;
+        Field* next;
+        Field(const StrView& n, const StrView& v) : name(n), value(v), next(nullptr) {}
+    };
+
+    explicit HpackDecoder(size_t maxTableSize = 4096);
+
+    // 解码一个完整的头部块（HEADERS + CONTINUATION拼起来），失败返回false（COMPRESSION_ERROR）
+    bool Decode(const uint8_t* data, size_t len, Arena* arena, Field** fields);
+
+    // 前缀整数（RFC 7541 5.1），prefix是第一个字节里面可用的位数
+    static bool DecodeInt(const uint8_t*& p, const uint8_t* end, int prefix, uint64_t* value);
+
+private:
+    bool DecodeString_(const uint8_t*& p, const uint8_t* end, Arena* arena, StrView* out);
+
+    HpackTable table_;
+    size_t maxTableSize_;   // 我们在SETTINGS_HEADER_TABLE_SIZE里面允许的上限
+};
+
+class HpackEncoder {
+public:
+    explicit HpackEncoder(size_t maxTableSize = 4096);
+
+    // 对端的SETTINGS_HEADER_TABLE_SIZE，下一个头部块开头会带上动态表大小更新
+    void SetMaxTableSize(size_t size);
+    // 每个头部块开头调用（需要的话写出动态表大小更新）
+    void BeginBlock(Buffer& out);
+    // indexing为false时按字面值发送且不加入动态表
+    void Encode(const StrView& name, const StrView& value, Buffer& out, bool indexing = true);
+
+    // flags是第一个字节里面前缀以外的高位
+    static void EncodeInt(uint64_t value, int prefix, uint8_t flags, Buffer& out);
+
+private:
+    void EncodeString_(const StrView& str, Buffer& out);
+
+    HpackTable table_;
+    size_t maxTableSize_;   // 自己愿意使用的上限
+    bool sizeUpdate_;       // 还没有通知对端动态表大小的变化
+};
+
+#endif //HPACK_H
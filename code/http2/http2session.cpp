@@ -0,0 +1,675 @@
+#include "http2session.h"
+#include <algorithm>
+
+// 帧的标志位
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+static const size_t FRAME_HEADER_LEN = 9;
+static const size_t DEFAULT_FRAME_SIZE = 16384;     // 我们不修改SETTINGS_MAX_FRAME_SIZE，收到的帧不能超过它
+static const size_t MAX_DATA_FRAME = 65536;         // 对端允许更大的帧时，DATA帧也不超过这个大小（轮转更均匀）
+static const int64_t DEFAULT_WINDOW = 65535;
+static const int64_t MAX_WINDOW = 0x7fffffff;
+static const size_t MAX_HEADER_BLOCK = 64 * 1024;   // 一个头部块（压缩后）的上限
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+// std::min按引用取参数，C++14里类内初始化的静态常量这样用还需要一个定义（-O0时不内联会链接失败）
+const size_t Http2Session::PREFACE_LEN;
+
+static uint32_t ReadU32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+         | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+// HTTP2-Settings使用base64url编码（不带填充），顺便兼容普通的base64
+static bool Base64UrlDecode(const StrView& in, std::string* out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for(char c : in) {
+        int v;
+        if(c >= 'A' && c <= 'Z') { v = c - 'A'; }
+        else if(c >= 'a' && c <= 'z') { v = c - 'a' + 26; }
+        else if(c >= '0' && c <= '9') { v = c - '0' + 52; }
+        else if(c == '-' || c == '+') { v = 62; }
+        else if(c == '_' || c == '/') { v = 63; }
+        else if(c == '=') { break; }
+        else { return false; }
+        acc = (acc << 6) | v;
+        bits += 6;
+        if(bits >= 8) {
+            bits -= 8;
+            out->push_back(static_cast<char>(acc >> bits));
+            acc &= (1u << bits) - 1;
+        }
+    }
+    return true;
+}
+
+Http2Session::Stream::Stream(uint32_t sid, int64_t sendWin, int64_t recvWin)
+    : id(sid), remoteClosed(false), responded(false), queued(false),
+      sendWindow(sendWin), recvWindow(recvWin), recvConsumed(0),
+      data(nullptr), dataLen(0), dataSent(0) {}
+
+int Http2Session::MatchPreface(const Buffer& buff) {
+    size_t n = std::min(buff.ReadableBytes(), PREFACE_LEN);
+    if(memcmp(buff.Peek(), PREFACE, n) != 0) {
+        return -1;
+    }
+    return n == PREFACE_LEN ? 1 : 0;
+}
+
+Http2Session::Http2Session(const char* srcDir, const ServerConfig* config)
+    : srcDir_(srcDir), config_(config),
+      prefaceReceived_(false), settingsReceived_(false), goaway_(false), peerGoaway_(false),
+      lastStreamId_(0), headerStream_(0), headerFlags_(0), scratch_(1024),
+      connSendWindow_(DEFAULT_WINDOW), connRecvWindow_(config->http2.connWindowSize), connRecvConsumed_(0),
+      peerInitialWindow_(DEFAULT_WINDOW), peerMaxFrameSize_(DEFAULT_FRAME_SIZE), block_(256) {
+    assert(srcDir && config);
+}
+
+Http2Session::~Http2Session() = default;
+
+void Http2Session::Start(Buffer& out) {
+    WriteSettings_(out);
+    // 连接窗口不能通过SETTINGS修改，只能用WINDOW_UPDATE放大
+    if(config_->http2.connWindowSize > DEFAULT_WINDOW) {
+        WriteWindowUpdate_(out, 0, config_->http2.connWindowSize - DEFAULT_WINDOW);
+    }
+}
+
+bool Http2Session::StartUpgrade(Buffer& out, const StrView& settings, const StrView& method, const StrView& path) {
+    std::string payload;
+    if(!Base64UrlDecode(settings, &payload) || payload.size() % 6 != 0) {
+        LOG_WARN("Bad HTTP2-Settings: %s", settings.ToString().c_str());
+        return false;
+    }
+    out.Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    Start(out);
+    // HTTP2-Settings相当于对端的第一个SETTINGS帧，不需要ACK
+    if(!ApplySettings_(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), out)) {
+        return true;
+    }
+    // 升级前的请求成为流1，对端已经发完了（半关闭）
+    lastStreamId_ = 1;
+    Stream* stream = new Stream(1, peerInitialWindow_, config_->http2.initialWindowSize);
+    streams_[1].reset(stream);
+    stream->request.Init(&stream->arena, config_);
+    if(stream->request.SetRequestLine(method, path, StrView("1.1", 3)) == HttpRequest::NO_REQUEST) {
+        stream->request.EndHeaders();
+    }
+    EndStream_(stream, out);
+    return true;
+}
+
+void Http2Session::Process(Buffer& in, Buffer& out) {
+    // 帧直接在读缓冲区上解析，需要连续的内存
+    in.Linearize();
+    if(!prefaceReceived_ && !goaway_ && in.ReadableBytes() > 0) {
+        int match = MatchPreface(in);
+        if(match < 0) {
+            ConnError_(PROTOCOL_ERROR, "bad connection preface", out);
+        }
+        else if(match > 0) {
+            in.Retrieve(PREFACE_LEN);
+            prefaceReceived_ = true;
+        }
+    }
+    while(prefaceReceived_ && !goaway_ && in.ReadableBytes() >= FRAME_HEADER_LEN) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(in.Peek());
+        size_t len = (static_cast<size_t>(p[0]) << 16) | (static_cast<size_t>(p[1]) << 8) | p[2];
+        uint8_t type = p[3];
+        uint8_t flags = p[4];
+        uint32_t sid = ReadU32(p + 5) & 0x7fffffff;
+        if(len > DEFAULT_FRAME_SIZE) {
+            ConnError_(FRAME_SIZE_ERROR, "frame too large", out);
+            break;
+        }
+        if(in.ReadableBytes() < FRAME_HEADER_LEN + len) {
+            break;      // 帧还没收完
+        }
+        bool ok = (!settingsReceived_ && type != SETTINGS)
+                  ? ConnError_(PROTOCOL_ERROR, "first frame is not SETTINGS", out)
+                  : HandleFrame_(type, flags, sid, p + FRAME_HEADER_LEN, len, out);
+        in.Retrieve(FRAME_HEADER_LEN + len);
+        if(!ok) { break; }
+    }
+    if(!goaway_) {
+        Schedule_(out);
+    }
+}
+
+bool Http2Session::HandleFrame_(uint8_t type, uint8_t flags, uint32_t sid,
+                                const uint8_t* payload, size_t len, Buffer& out) {
+    // 头部块没收完之前只能出现同一个流的CONTINUATION
+    if(headerStream_ && (type != CONTINUATION || sid != headerStream_)) {
+        return ConnError_(PROTOCOL_ERROR, "expect CONTINUATION", out);
+    }
+    switch(type) {
+        case DATA:
+            return OnData_(flags, sid, payload, len, out);
+        case HEADERS:
+            return OnHeaders_(flags, sid, payload, len, out);
+        case CONTINUATION:
+            if(!headerStream_) {
+                return ConnError_(PROTOCOL_ERROR, "unexpected CONTINUATION", out);
+            }
+            headerBlock_.append(reinterpret_cast<const char*>(payload), len);
+            if(headerBlock_.size() > MAX_HEADER_BLOCK) {
+                return ConnError_(PROTOCOL_ERROR, "header block too large", out);
+            }
+            return (flags & FLAG_END_HEADERS) ? OnHeaderBlock_(out) : true;
+        case PRIORITY:
+            // 不做优先级调度，所有流轮流发送
+            if(sid == 0) { return ConnError_(PROTOCOL_ERROR, "PRIORITY on stream 0", out); }
+            if(len != 5) { ResetStream_(sid, FRAME_SIZE_ERROR, out); }
+            return true;
+        case RST_STREAM:
+            if(sid == 0 || sid > lastStreamId_) { return ConnError_(PROTOCOL_ERROR, "RST_STREAM on idle stream", out); }
+            if(len != 4) { return ConnError_(FRAME_SIZE_ERROR, "bad RST_STREAM", out); }
+            CloseStream_(sid);
+            return true;
+        case SETTINGS:
+            if(sid != 0) { return ConnError_(PROTOCOL_ERROR, "SETTINGS on stream", out); }
+            return OnSettings_(flags, payload, len, out);
+        case PUSH_PROMISE:
+            return ConnError_(PROTOCOL_ERROR, "PUSH_PROMISE from client", out);
+        case PING:
+            if(sid != 0) { return ConnError_(PROTOCOL_ERROR, "PING on stream", out); }
+            if(len != 8) { return ConnError_(FRAME_SIZE_ERROR, "bad PING", out); }
+            if(!(flags & FLAG_ACK)) {
+                WriteFrameHeader_(out, 8, PING, FLAG_ACK, 0);
+                out.Append(payload, 8);
+            }
+            return true;
+        case GOAWAY:
+            if(sid != 0) { return ConnError_(PROTOCOL_ERROR, "GOAWAY on stream", out); }
+            // 不再接受新的流，已经打开的流处理完以后关闭连接
+            LOG_INFO("Peer GOAWAY, error code: %u", len >= 8 ? ReadU32(payload + 4) : 0);
+            peerGoaway_ = true;
+            return true;
+        case WINDOW_UPDATE:
+            return OnWindowUpdate_(sid, payload, len, out);
+        default:
+            return true;        // 未知类型的帧直接忽略
+    }
+}
+
+bool Http2Session::OnData_(uint8_t flags, uint32_t sid, const uint8_t* payload, size_t len, Buffer& out) {
+    if(sid == 0) {
+        return ConnError_(PROTOCOL_ERROR, "DATA on stream 0", out);
+    }
+    // 流量控制按整个帧的负载计算（包括填充）
+    if(static_cast<int64_t>(len) > connRecvWindow_) {
+        return ConnError_(FLOW_CONTROL_ERROR, "connection window exceeded", out);
+    }
+    connRecvWindow_ -= len;
+    connRecvConsumed_ += len;
+    // 连接窗口用掉一半以后一次性归还，不用每个帧都回复WINDOW_UPDATE
+    if(connRecvConsumed_ >= config_->http2.connWindowSize / 2) {
+        WriteWindowUpdate_(out, 0, connRecvConsumed_);
+        connRecvWindow_ += connRecvConsumed_;
+        connRecvConsumed_ = 0;
+    }
+
+    const uint8_t* p = payload;
+    const uint8_t* end = payload + len;
+    if(flags & FLAG_PADDED) {
+        if(p == end || *p >= len) { return ConnError_(PROTOCOL_ERROR, "bad padding", out); }
+        end -= *p++;
+    }
+    Stream* stream = FindStream_(sid);
+    if(!stream) {
+        if(sid > lastStreamId_) { return ConnError_(PROTOCOL_ERROR, "DATA on idle stream", out); }
+        ResetStream_(sid, STREAM_CLOSED, out);
+        return true;
+    }
+    if(stream->remoteClosed) {
+        ResetStream_(sid, STREAM_CLOSED, out);
+        return true;
+    }
+    if(static_cast<int64_t>(len) > stream->recvWindow) {
+        ResetStream_(sid, FLOW_CONTROL_ERROR, out);
+        return true;
+    }
+    stream->recvWindow -= len;
+    if(!stream->responded && stream->request.StreamsBody()) {
+        FeedUpload_(stream, reinterpret_cast<const char*>(p), reinterpret_cast<const char*>(end), false);
+        if(int code = stream->request.ErrorCode()) {
+            Respond_(stream, code, out);
+            return true;
+        }
+    }
+    else if(!stream->responded) {
+        if(stream->body.size() + (end - p) > config_->limit.maxBodyBytes) {
+            Respond_(stream, 413, out);     // 回复完会直接重置这个流，不再收请求体
+            return true;
+        }
+        stream->body.append(reinterpret_cast<const char*>(p), end - p);
+    }
+    if(flags & FLAG_END_STREAM) {
+        EndStream_(stream, out);
+        return true;
+    }
+    stream->recvConsumed += len;
+    if(stream->recvConsumed >= config_->http2.initialWindowSize / 2) {
+        WriteWindowUpdate_(out, sid, stream->recvConsumed);
+        stream->recvWindow += stream->recvConsumed;
+        stream->recvConsumed = 0;
+    }
+    return true;
+}
+
+bool Http2Session::OnHeaders_(uint8_t flags, uint32_t sid, const uint8_t* payload, size_t len, Buffer& out) {
+    if(sid == 0 || !(sid & 1)) {
+        return ConnError_(PROTOCOL_ERROR, "bad stream id", out);
+    }
+    const uint8_t* p = payload;
+    const uint8_t* end = payload + len;
+    if(flags & FLAG_PADDED) {
+        if(p == end || *p >= len) { return ConnError_(PROTOCOL_ERROR, "bad padding", out); }
+        end -= *p++;
+    }
+    if(flags & FLAG_PRIORITY) {
+        if(end - p < 5) { return ConnError_(FRAME_SIZE_ERROR, "bad HEADERS priority", out); }
+        p += 5;
+    }
+    if(!FindStream_(sid)) {
+        if(sid <= lastStreamId_) {
+            return ConnError_(STREAM_CLOSED, "HEADERS on closed stream", out);
+        }
+        lastStreamId_ = sid;
+        // 超过并发上限（或者对端已经GOAWAY）的流不创建，头部块照样解码以后拒绝
+        if(!peerGoaway_ && streams_.size() < config_->http2.maxConcurrentStreams) {
+            Stream* stream = new Stream(sid, peerInitialWindow_, config_->http2.initialWindowSize);
+            streams_[sid].reset(stream);
+            stream->request.Init(&stream->arena, config_);
+        }
+    }
+    headerStream_ = sid;
+    headerFlags_ = flags;
+    headerBlock_.assign(reinterpret_cast<const char*>(p), end - p);
+    return (flags & FLAG_END_HEADERS) ? OnHeaderBlock_(out) : true;
+}
+
+// 头部块收完了：先解码（不管这个流还要不要，都必须解码来保持动态表同步），再交给HttpRequest
+bool Http2Session::OnHeaderBlock_(Buffer& out) {
+    uint32_t sid = headerStream_;
+    headerStream_ = 0;
+    Stream* stream = FindStream_(sid);
+    Arena* arena = &scratch_;
+    if(stream) {
+        arena = &stream->arena;
+    }
+    else {
+        scratch_.Reset();
+    }
+    HpackDecoder::Field* fields = nullptr;
+    bool ok = decoder_.Decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()), headerBlock_.size(), arena, &fields);
+    headerBlock_.clear();
+    if(!ok) {
+        return ConnError_(COMPRESSION_ERROR, "HPACK decode failed", out);
+    }
+    if(!stream) {
+        ResetStream_(sid, REFUSED_STREAM, out);
+        return true;
+    }
+    if(stream->remoteClosed) {
+        ResetStream_(sid, STREAM_CLOSED, out);
+        return true;
+    }
+    if(stream->request.State() != HttpRequest::REQUEST_LINE) {
+        // 请求体后面的trailer，内容不需要，但必须带END_STREAM
+        if(!(headerFlags_ & FLAG_END_STREAM)) {
+            ResetStream_(sid, PROTOCOL_ERROR, out);
+        }
+        else {
+            EndStream_(stream, out);
+        }
+        return true;
+    }
+
+    // 伪头部必须在普通头部前面，:method、:scheme、:path必须有
+    StrView method, path, scheme, authority;
+    bool regular = false, malformed = false;
+    for(const HpackDecoder::Field* f = fields; f; f = f->next) {
+        if(f->name.len > 0 && f->name.data[0] == ':') {
+            if(regular) { malformed = true; }
+            else if(f->name == ":method") { method = f->value; }
+            else if(f->name == ":path") { path = f->value; }
+            else if(f->name == ":scheme") { scheme = f->value; }
+            else if(f->name == ":authority") { authority = f->value; }
+            else { malformed = true; }
+        }
+        else {
+            regular = true;
+            // HTTP/2里面不允许出现连接相关的头部
+            if(f->name == "connection") { malformed = true; }
+        }
+    }
+    if(malformed || method.empty() || path.empty() || scheme.empty()) {
+        ResetStream_(sid, PROTOCOL_ERROR, out);
+        return true;
+    }
+    HttpRequest::HTTP_CODE ret = stream->request.SetRequestLine(method, path, StrView("2.0", 3));
+    if(ret == HttpRequest::NO_REQUEST && !authority.empty()) {
+        ret = stream->request.AddHeader(StrView("host", 4), authority);
+    }
+    for(const HpackDecoder::Field* f = fields; f && ret == HttpRequest::NO_REQUEST; f = f->next) {
+        if(f->name.data[0] != ':') {
+            ret = stream->request.AddHeader(f->name, f->value);
+        }
+    }
+    if(ret == HttpRequest::NO_REQUEST) {
+        ret = stream->request.EndHeaders();
+    }
+    LOG_DEBUG("h2 stream %u: %s %s", sid, stream->request.method().data, stream->request.path().data);
+    if(ret == HttpRequest::BAD_REQUEST) {
+        Respond_(stream, stream->request.ErrorCode(), out);
+    }
+    else if(headerFlags_ & FLAG_END_STREAM) {
+        EndStream_(stream, out);
+    }
+    return true;
+}
+
+bool Http2Session::OnSettings_(uint8_t flags, const uint8_t* payload, size_t len, Buffer& out) {
+    if(flags & FLAG_ACK) {
+        return len == 0 ? true : ConnError_(FRAME_SIZE_ERROR, "SETTINGS ACK with payload", out);
+    }
+    if(len % 6 != 0) {
+        return ConnError_(FRAME_SIZE_ERROR, "bad SETTINGS", out);
+    }
+    if(!ApplySettings_(payload, len, out)) {
+        return false;
+    }
+    settingsReceived_ = true;
+    WriteFrameHeader_(out, 0, SETTINGS, FLAG_ACK, 0);
+    return true;
+}
+
+bool Http2Session::ApplySettings_(const uint8_t* payload, size_t len, Buffer& out) {
+    for(size_t i = 0; i + 6 <= len; i += 6) {
+        uint16_t id = (payload[i] << 8) | payload[i + 1];
+        uint32_t value = ReadU32(payload + i + 2);
+        switch(id) {
+            case 0x1:   // SETTINGS_HEADER_TABLE_SIZE
+                encoder_.SetMaxTableSize(value);
+                break;
+            case 0x2:   // SETTINGS_ENABLE_PUSH（我们不推送）
+                if(value > 1) { return ConnError_(PROTOCOL_ERROR, "bad ENABLE_PUSH", out); }
+                break;
+            case 0x4: { // SETTINGS_INITIAL_WINDOW_SIZE，已经打开的流的窗口按差值调整
+                if(value > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR, "bad INITIAL_WINDOW_SIZE", out); }
+                int64_t delta = static_cast<int64_t>(value) - peerInitialWindow_;
+                peerInitialWindow_ = value;
+                for(auto& it : streams_) {
+                    Stream* stream = it.second.get();
+                    stream->sendWindow += delta;
+                    if(stream->sendWindow > MAX_WINDOW) {
+                        return ConnError_(FLOW_CONTROL_ERROR, "stream window overflow", out);
+                    }
+                    if(stream->sendWindow > 0 && stream->responded && stream->dataSent < stream->dataLen) {
+                        Enqueue_(stream);
+                    }
+                }
+                break;
+            }
+            case 0x5:   // SETTINGS_MAX_FRAME_SIZE
+                if(value < DEFAULT_FRAME_SIZE || value > 0xffffff) {
+                    return ConnError_(PROTOCOL_ERROR, "bad MAX_FRAME_SIZE", out);
+                }
+                peerMaxFrameSize_ = value;
+                break;
+            default:    // SETTINGS_MAX_CONCURRENT_STREAMS等对我们没有影响，未知的直接忽略
+                break;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::OnWindowUpdate_(uint32_t sid, const uint8_t* payload, size_t len, Buffer& out) {
+    if(len != 4) {
+        return ConnError_(FRAME_SIZE_ERROR, "bad WINDOW_UPDATE", out);
+    }
+    uint32_t increment = ReadU32(payload) & 0x7fffffff;
+    if(sid == 0) {
+        if(increment == 0) { return ConnError_(PROTOCOL_ERROR, "zero window increment", out); }
+        connSendWindow_ += increment;
+        if(connSendWindow_ > MAX_WINDOW) { return ConnError_(FLOW_CONTROL_ERROR, "connection window overflow", out); }
+        return true;
+    }
+    if(sid > lastStreamId_) {
+        return ConnError_(PROTOCOL_ERROR, "WINDOW_UPDATE on idle stream", out);
+    }
+    Stream* stream = FindStream_(sid);
+    if(!stream) {
+        return true;        // 流已经关闭了，窗口更新可能是在途的
+    }
+    if(increment == 0) {
+        ResetStream_(sid, PROTOCOL_ERROR, out);
+        return true;
+    }
+    stream->sendWindow += increment;
+    if(stream->sendWindow > MAX_WINDOW) {
+        ResetStream_(sid, FLOW_CONTROL_ERROR, out);
+        return true;
+    }
+    // 因为窗口用完移出了发送队列的流，重新排进去
+    if(stream->sendWindow > 0 && stream->responded && stream->dataSent < stream->dataLen) {
+        Enqueue_(stream);
+    }
+    return true;
+}
+
+Http2Session::Stream* Http2Session::FindStream_(uint32_t sid) {
+    auto it = streams_.find(sid);
+    return it == streams_.end() ? nullptr : it->second.get();
+}
+
+// 对端结束了这个流：请求收完了，生成响应
+void Http2Session::EndStream_(Stream* stream, Buffer& out) {
+    stream->remoteClosed = true;
+    if(stream->responded) {
+        // 请求还没收完就已经回复了（例如413），响应也发完了的话流就结束了
+        if(stream->dataSent >= stream->dataLen) {
+            CloseStream_(stream->id);
+        }
+        return;
+    }
+    if(stream->request.StreamsBody()) {
+        FeedUpload_(stream, nullptr, nullptr, true);
+    }
+    else if(!stream->body.empty()) {
+        stream->request.SetBody(stream->body.data(), stream->body.data() + stream->body.size());
+    }
+    int code = stream->request.ErrorCode();
+    Respond_(stream, code ? code : 200, out);
+}
+
+// 上传的请求体收到一块解析一块（文件内容直接写进文件，大小按upload.maxBodyBytes限制），
+//  body里面只留下解析器这次没用掉的尾巴，和下一个DATA帧拼起来再解析
+void Http2Session::FeedUpload_(Stream* stream, const char* begin, const char* end, bool last) {
+    std::string& rest = stream->body;
+    bool buffered = !rest.empty();
+    if(buffered) {
+        rest.append(begin, end - begin);
+        begin = rest.data();
+        end = begin + rest.size();
+    }
+    size_t used = stream->request.FeedBody(begin, end, last);
+    if(buffered) {
+        rest.erase(0, used);
+    }
+    else {
+        rest.assign(begin + used, end);
+    }
+}
+
+void Http2Session::Respond_(Stream* stream, int code, Buffer& out) {
+    stream->responded = true;
+    stream->response.Init(&stream->arena, srcDir_, stream->request, true, code);
+    stream->response.Prepare(1);    // 只支持单段的Range，多段的请求回复整个文件
+    stream->dataLen = stream->response.ContentLength();
+    stream->data = stream->response.Content();
+    stream->dataSent = 0;
+
+    // 响应头：状态码用静态表，content-type进动态表（同一个页面的css、js会反复用到），content-length不入表
+    char status[8], length[24];
+    snprintf(status, sizeof(status), "%d", stream->response.Code());
+    int lengthLen = snprintf(length, sizeof(length), "%zu", stream->dataLen);
+    block_.RetrieveAll();
+    encoder_.BeginBlock(block_);
+    encoder_.Encode(StrView(":status", 7), StrView(status, strlen(status)), block_);
+    encoder_.Encode(StrView("server", 6), StrView("WebServer", 9), block_);
+    encoder_.Encode(StrView("date", 4), HttpResponse::Date(), block_, false);
+    if(stream->response.Code() != 304) {
+        encoder_.Encode(StrView("content-type", 12), stream->response.ContentType(), block_);
+        encoder_.Encode(StrView("content-length", 14), StrView(length, lengthLen), block_, false);
+        if(stream->response.ContentEncoding()) {
+            const char* encoding = stream->response.ContentEncoding();
+            encoder_.Encode(StrView("content-encoding", 16), StrView(encoding, strlen(encoding)), block_);
+        }
+    }
+    if(stream->response.VaryEncoding()) {
+        encoder_.Encode(StrView("vary", 4), StrView("accept-encoding", 15), block_);
+    }
+    if(!stream->response.ContentRange().empty()) {
+        encoder_.Encode(StrView("content-range", 13), stream->response.ContentRange(), block_, false);
+    }
+    if(!stream->response.CacheControl().empty()) {
+        encoder_.Encode(StrView("cache-control", 13), stream->response.CacheControl(), block_);
+    }
+    if(!stream->response.ETag().empty()) {
+        encoder_.Encode(StrView("etag", 4), stream->response.ETag(), block_, false);
+        encoder_.Encode(StrView("last-modified", 13), stream->response.LastModified(), block_, false);
+        encoder_.Encode(StrView("accept-ranges", 13), StrView("bytes", 5), block_);
+    }
+
+    // 头部块超过对端的帧大小时拆成HEADERS + CONTINUATION
+    const char* p = block_.Peek();
+    size_t remain = block_.ReadableBytes();
+    bool first = true;
+    do {
+        size_t n = std::min(remain, peerMaxFrameSize_);
+        remain -= n;
+        uint8_t flags = (remain == 0 ? FLAG_END_HEADERS : 0);
+        if(first && stream->dataLen == 0) { flags |= FLAG_END_STREAM; }
+        WriteFrameHeader_(out, n, first ? HEADERS : CONTINUATION, flags, stream->id);
+        out.Append(p, n);
+        p += n;
+        first = false;
+    } while(remain > 0);
+    LOG_DEBUG("h2 stream %u: %d, %zu bytes", stream->id, stream->response.Code(), stream->dataLen);
+
+    if(stream->dataLen == 0) {
+        ResponseDone_(stream, out);
+    }
+    else {
+        Enqueue_(stream);
+    }
+}
+
+// 响应发完了：请求也收完了就关闭流，否则剩下的请求体不要了，重置这个流
+void Http2Session::ResponseDone_(Stream* stream, Buffer& out) {
+    if(stream->remoteClosed) {
+        CloseStream_(stream->id);
+    }
+    else {
+        ResetStream_(stream->id, NO_ERROR, out);
+    }
+}
+
+// 轮流给每个有数据的流发一帧，直到窗口用完、队列为空或者这一轮生成的数据够多了
+void Http2Session::Schedule_(Buffer& out) {
+    size_t frameMax = std::min(peerMaxFrameSize_, MAX_DATA_FRAME);
+    while(!sendQueue_.empty() && connSendWindow_ > 0 && out.ReadableBytes() < config_->http2.maxOutputBytes) {
+        uint32_t sid = sendQueue_.front();
+        sendQueue_.pop_front();
+        Stream* stream = FindStream_(sid);
+        if(!stream) { continue; }
+        stream->queued = false;
+        if(stream->sendWindow <= 0) { continue; }      // 等这个流的WINDOW_UPDATE
+        size_t n = std::min(stream->dataLen - stream->dataSent, frameMax);
+        n = std::min(n, static_cast<size_t>(std::min(connSendWindow_, stream->sendWindow)));
+        bool last = (stream->dataSent + n == stream->dataLen);
+        WriteFrameHeader_(out, n, DATA, last ? FLAG_END_STREAM : 0, sid);
+        out.Append(stream->data + stream->dataSent, n);
+        stream->dataSent += n;
+        stream->sendWindow -= n;
+        connSendWindow_ -= n;
+        if(last) {
+            ResponseDone_(stream, out);
+        }
+        else {
+            Enqueue_(stream);
+        }
+    }
+}
+
+void Http2Session::Enqueue_(Stream* stream) {
+    if(!stream->queued) {
+        stream->queued = true;
+        sendQueue_.push_back(stream->id);
+    }
+}
+
+void Http2Session::CloseStream_(uint32_t sid) {
+    streams_.erase(sid);
+}
+
+void Http2Session::ResetStream_(uint32_t sid, ERROR_CODE code, Buffer& out) {
+    uint8_t payload[4] = { 0, 0, 0, static_cast<uint8_t>(code) };
+    WriteFrameHeader_(out, 4, RST_STREAM, 0, sid);
+    out.Append(payload, 4);
+    CloseStream_(sid);
+}
+
+bool Http2Session::ConnError_(ERROR_CODE code, const char* reason, Buffer& out) {
+    LOG_WARN("h2 connection error %d: %s", code, reason);
+    uint8_t payload[8] = {
+        static_cast<uint8_t>(lastStreamId_ >> 24), static_cast<uint8_t>(lastStreamId_ >> 16),
+        static_cast<uint8_t>(lastStreamId_ >> 8), static_cast<uint8_t>(lastStreamId_),
+        0, 0, 0, static_cast<uint8_t>(code),
+    };
+    WriteFrameHeader_(out, 8, GOAWAY, 0, 0);
+    out.Append(payload, 8);
+    goaway_ = true;
+    return false;
+}
+
+void Http2Session::WriteSettings_(Buffer& out) {
+    uint32_t streams = config_->http2.maxConcurrentStreams;
+    uint32_t window = config_->http2.initialWindowSize;
+    uint8_t payload[12] = {
+        0x00, 0x03,     // SETTINGS_MAX_CONCURRENT_STREAMS
+        static_cast<uint8_t>(streams >> 24), static_cast<uint8_t>(streams >> 16),
+        static_cast<uint8_t>(streams >> 8), static_cast<uint8_t>(streams),
+        0x00, 0x04,     // SETTINGS_INITIAL_WINDOW_SIZE
+        static_cast<uint8_t>(window >> 24), static_cast<uint8_t>(window >> 16),
+        static_cast<uint8_t>(window >> 8), static_cast<uint8_t>(window),
+    };
+    WriteFrameHeader_(out, sizeof(payload), SETTINGS, 0, 0);
+    out.Append(payload, sizeof(payload));
+}
+
+void Http2Session::WriteFrameHeader_(Buffer& out, size_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+    uint8_t header[FRAME_HEADER_LEN] = {
+        static_cast<uint8_t>(len >> 16), static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len),
+        type, flags,
+        static_cast<uint8_t>((sid >> 24) & 0x7f), static_cast<uint8_t>(sid >> 16),
+        static_cast<uint8_t>(sid >> 8), static_cast<uint8_t>(sid),
+    };
+    out.Append(header, FRAME_HEADER_LEN);
+}
+
+void Http2Session::WriteWindowUpdate_(Buffer& out, uint32_t sid, uint32_t increment) {
+    uint8_t payload[4] = {
+        static_cast<uint8_t>((increment >> 24) & 0x7f), static_cast<uint8_t>(increment >> 16),
+        static_cast<uint8_t>(increment >> 8), static_cast<uint8_t>(increment),
+    };
+    WriteFrameHeader_(out, 4, WINDOW_UPDATE, 0, sid);
+    out.Append(payload, 4);
+}
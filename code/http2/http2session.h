@@ -0,0 +1,160 @@
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+/**********************************************************************
+ * ----------------------------Http2Session----------------------------
+ *
+ * 一个HTTP/2（h2c）连接的协议状态，由HttpConn持有，和HTTP/1.x一样在工作
+ * 线程里面处理（EPOLLONESHOT保证同一时间只有一个线程在处理这个连接）：
+ * 1、分帧：从读缓冲区里面取出完整的帧，按类型处理；SETTINGS、PING、
+ *    WINDOW_UPDATE这些控制帧直接回复；
+ * 2、流：HEADERS（+CONTINUATION）经过HPACK解码以后变成一个HttpRequest，
+ *    对端结束流（END_STREAM）以后交给HttpResponse生成响应，路由、表单、
+ *    错误页面都和HTTP/1.x走同一套逻辑；每个流有自己的arena；
+ * 3、多路复用和流量控制：所有有数据要发的流排成一个队列轮流发送，每次
+ *    最多一帧，同时受连接窗口、流窗口和对端SETTINGS_MAX_FRAME_SIZE的限制；
+ *    窗口用完的流先移出队列，等对端的WINDOW_UPDATE再放回去；
+ * 4、出错：连接级错误回复GOAWAY然后关闭连接，流级错误回复RST_STREAM。
+ *
+ * 内存：流可能跨好几次读事件、和别的流交错，不能用连接的请求级arena，
+ * 每个流（连同它的arena、请求体）是单独new出来的，流结束时释放；头部块
+ * 拼接用的headerBlock_属于连接，容量一直留着，不会每个请求都重新分配。
+ *
+ * 两种开始方式：
+ * 1、prior knowledge：对端一上来就发送连接前言，调用Start()；
+ * 2、HTTP/1.1的Upgrade: h2c：调用StartUpgrade()，回复101以后升级前的请求
+ *    作为流1，在HTTP/2上回复。
+ *
+***********************************************************************/
+
+#include <memory>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include "hpack.h"
+#include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "../config/config.h"
+#include "../http/httprequest.h"
+#include "../http/httpresponse.h"
+
+class Http2Session {
+public:
+    // 帧类型（RFC 7540 6）
+    enum FRAME_TYPE {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9,
+    };
+
+    // 错误码（RFC 7540 7）
+    enum ERROR_CODE {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        COMPRESSION_ERROR = 0x9,
+    };
+
+    static const size_t PREFACE_LEN = 24;
+    // 读缓冲区开头是不是客户端的连接前言：1是，0数据还不够判断，-1不是
+    static int MatchPreface(const Buffer& buff);
+
+    Http2Session(const char* srcDir, const ServerConfig* config);
+    ~Http2Session();
+
+    // prior knowledge：写出我们的SETTINGS，等对端的连接前言
+    void Start(Buffer& out);
+    // 由HTTP/1.1升级而来：settings是HTTP2-Settings头部的值（base64url编码的SETTINGS帧负载），
+    //  升级前的请求（method、path）作为流1回复；settings不合法时返回false，什么都不写
+    bool StartUpgrade(Buffer& out, const StrView& settings, const StrView& method, const StrView& path);
+
+    // 处理in里面所有完整的帧，再按窗口把待发送的数据编成帧写到out
+    void Process(Buffer& in, Buffer& out);
+
+    // 已经发送或者收到GOAWAY，发完out里面的数据以后应该关闭连接
+    bool IsClosing() const { return goaway_ || (peerGoaway_ && streams_.empty()); }
+
+private:
+    struct Stream {
+        uint32_t id;
+        bool remoteClosed;      // 对端已经结束了这个流（END_STREAM）
+        bool responded;         // 响应头已经发出去了
+        bool queued;            // 在发送队列里面
+        int64_t sendWindow;     // 流的发送窗口
+        int64_t recvWindow;     // 流的接收窗口
+        size_t recvConsumed;    // 收到但还没有通过WINDOW_UPDATE归还的字节数
+        std::string body;       // 请求体（上传只留着上一个DATA帧没解析完的尾巴）
+        const char* data;       // 响应体（映射的文件或者生成的页面）
+        size_t dataLen;
+        size_t dataSent;
+        Arena arena;            // 请求和响应的字符串
+        HttpRequest request;
+        HttpResponse response;
+
+        Stream(uint32_t sid, int64_t sendWin, int64_t recvWin);
+    };
+
+    bool HandleFrame_(uint8_t type, uint8_t flags, uint32_t sid, const uint8_t* payload, size_t len, Buffer& out);
+    bool OnData_(uint8_t flags, uint32_t sid, const uint8_t* payload, size_t len, Buffer& out);
+    bool OnHeaders_(uint8_t flags, uint32_t sid, const uint8_t* payload, size_t len, Buffer& out);
+    bool OnHeaderBlock_(Buffer& out);
+    bool OnSettings_(uint8_t flags, const uint8_t* payload, size_t len, Buffer& out);
+    bool ApplySettings_(const uint8_t* payload, size_t len, Buffer& out);
+    bool OnWindowUpdate_(uint32_t sid, const uint8_t* payload, size_t len, Buffer& out);
+
+    Stream* FindStream_(uint32_t sid);
+    void EndStream_(Stream* stream, Buffer& out);
+    void FeedUpload_(Stream* stream, const char* begin, const char* end, bool last);
+    void Respond_(Stream* stream, int code, Buffer& out);
+    void ResponseDone_(Stream* stream, Buffer& out);
+    void Schedule_(Buffer& out);
+    void Enqueue_(Stream* stream);
+    void CloseStream_(uint32_t sid);
+    void ResetStream_(uint32_t sid, ERROR_CODE code, Buffer& out);
+    bool ConnError_(ERROR_CODE code, const char* reason, Buffer& out);
+
+    void WriteSettings_(Buffer& out);
+    static void WriteFrameHeader_(Buffer& out, size_t len, uint8_t type, uint8_t flags, uint32_t sid);
+    static void WriteWindowUpdate_(Buffer& out, uint32_t sid, uint32_t increment);
+
+    const char* srcDir_;
+    const ServerConfig* config_;
+
+    bool prefaceReceived_;      // 已经收到客户端的连接前言
+    bool settingsReceived_;     // 连接前言后面的第一帧必须是SETTINGS
+    bool goaway_;               // 我们已经发送了GOAWAY
+    bool peerGoaway_;           // 对端发送了GOAWAY
+    uint32_t lastStreamId_;     // 对端打开过的最大的流ID
+
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+
+    // 正在接收的头部块（HEADERS后面跟着CONTINUATION时要拼起来）
+    uint32_t headerStream_;     // 0表示没有
+    uint8_t headerFlags_;       // HEADERS帧的标志（END_STREAM）
+    std::string headerBlock_;   // 只clear不释放，之后的头部块直接复用
+    Arena scratch_;             // 被拒绝的流的头部块也要解码（保持HPACK动态表同步），解码结果放在这里
+
+    int64_t connSendWindow_;    // 连接的发送窗口
+    int64_t connRecvWindow_;    // 连接的接收窗口
+    size_t connRecvConsumed_;   // 收到但还没有归还的字节数
+    int64_t peerInitialWindow_; // 对端SETTINGS_INITIAL_WINDOW_SIZE
+    size_t peerMaxFrameSize_;   // 对端SETTINGS_MAX_FRAME_SIZE
+
+    std::unordered_map<uint32_t, std::unique_ptr<Stream>> streams_;
+    std::deque<uint32_t> sendQueue_;    // 有数据要发、并且流窗口没有用完的流（轮流发送）
+    Buffer block_;                      // 编码响应头时的临时缓冲区
+};
+
+#endif //HTTP2_SESSION_H
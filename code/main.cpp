@@ -1,14 +1,29 @@
 #include <unistd.h>
+#include <stdio.h>
 #include "server/webserver.h"
 
-int main() {
+int main(int argc, char* argv[]) {
     /* 守护进程 后台运行 */
     // daemon(1, 0); 
 
+    // 命令行开关，用来和webbench对比不同的发送策略（见webbench-1.5/sendbench.sh）
+    ServerConfig config;
+    int opt;
+    while((opt = getopt(argc, argv, "NC")) != -1) {
+        switch(opt) {
+            case 'N': config.send.nodelay = false; break;   /* 不设置TCP_NODELAY */
+            case 'C': config.send.cork = false; break;      /* 不用TCP_CORK */
+            default:
+                fprintf(stderr, "usage: %s [-N] [-C]\n  -N  keep Nagle (no TCP_NODELAY)\n  -C  no TCP_CORK\n", argv[0]);
+                return 1;
+        }
+    }
+
     WebServer server(
         1316, 3, 60000, false,                  /* 端口 ET模式 timeoutMs 是否优雅退出  */
         3306, "linyueq", "123456", "webServer",   /* Mysql配置 */
-        12, 6, true, 1, 1024);                  /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 1, 1024,                   /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        config);
     
     
     // 启动服务器
@@ -31,6 +31,11 @@ public:
     int GetEventFd(size_t i) const;
 
     uint32_t GetEvents(size_t i) const;
+
+    // 只有EPOLLERR、没有挂断：打开了SO_ZEROCOPY的socket用错误队列通知零拷贝发送完成，不一定是出错了
+    static bool IsErrQueueEvent(uint32_t events) {
+        return (events & EPOLLERR) && !(events & (EPOLLHUP | EPOLLRDHUP));
+    }
         
 private:
     int epollFd_;   // epoll_create()创建一个epoll对象，返回值就是epollFd
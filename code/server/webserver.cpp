@@ -6,9 +6,9 @@ WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
-            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new RBTimer()), threadpool_(new MyThreadPool(threadNum)), epoller_(new Epoller())
+            bool openLog, int logLevel, int logQueSize, const ServerConfig& config):
+            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), config_(config), isClose_(false),
+            timer_(new RBTimer()), paceTimer_(new PaceTimer()), threadpool_(new MyThreadPool(threadNum)), epoller_(new Epoller())
     {
     // Step1：获取HTTP服务器的资源目录（装了各种各样的html文件）
     // /home/linyueq/WebServer-master/
@@ -22,6 +22,25 @@ WebServer::WebServer(
     // Step2：初始化HttpConn的静态成员，客户端连接进来后会封装成HttpConn
     HttpConn::userCount = 0;        //当前所有连接数
     HttpConn::srcDir = srcDir_;     //设置资源目录
+    config_.limit.idleTimeoutMS = timeoutMS_;
+    HttpConn::config = &config_;    //各个连接共用的配置
+    HttpResponse::cachePolicy = &config_.cachePolicy;
+    // 上传目录（在资源目录外面，上传的文件不会被当作静态资源访问）
+    if(config_.upload.enable) {
+        mkdir(config_.upload.dir, 0755);
+    }
+    // 静态文件缓存，资源目录的inotify事件由主线程处理（水平触发，一次读完所有事件）
+    FileCache::Instance()->Init(srcDir_, config_.fileCache);
+    CompressCache::Instance()->Init(config_.compress);
+    ColdLoader::Instance()->Init(config_.coldLoad);
+    if(FileCache::Instance()->NotifyFd() >= 0) {
+        epoller_->AddFd(FileCache::Instance()->NotifyFd(), EPOLLIN);
+    }
+    // 限速：默认qdisc是fq时由内核按SO_MAX_PACING_RATE发送，否则工作线程用令牌桶，令牌用完的连接由paceTimer_唤醒
+    HttpConn::kernelPacing = config_.pacing.kernel && DefaultQdiscIsFq_();
+    if(paceTimer_->Fd() >= 0) {
+        epoller_->AddFd(paceTimer_->Fd(), EPOLLIN);
+    }
 
     // Step3：初始化数据库连接池
     // SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
@@ -31,6 +50,12 @@ WebServer::WebServer(
     // Step4：初始化epoll事件的模式（指EPOLL的触发模式、以及最开始要监听什么类型的事件）
     InitEventMode_(trigMode);
     
+    // 预热资源目录：在开始监听之前完成，端口能连上就说明已经预热好了
+    FileCache::WarmupStats warmup;
+    if(config_.fileCache.warmup) {
+        warmup = FileCache::Instance()->Warmup(config_.fileCache);
+    }
+
     // Step5：初始化Socket相关的一些内容
     if(!InitSocket_()) { isClose_ = true;}
     // printf("Init before Log init\n");
@@ -46,8 +71,18 @@ WebServer::WebServer(
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
+            LOG_INFO("Timeout(ms) idle:%d header:%d body:%d write:%d, minRate:%zuB/s",
+                            timeoutMS_, config_.limit.headerTimeoutMS, config_.limit.bodyTimeoutMS,
+                            config_.limit.writeTimeoutMS, config_.limit.minRateBps);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
+            if(config_.fileCache.archive) {
+                LOG_INFO("Site archive: %s, %zu files", config_.fileCache.archive, FileCache::Instance()->ArchiveFiles());
+            }
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            if(config_.fileCache.warmup) {
+                LOG_INFO("Warm-up: %zu files, %zu bytes, %zu bytes locked, %lldms",
+                            warmup.files, warmup.bytes, warmup.locked, static_cast<long long>(warmup.ms));
+            }
         }
     }
     // Step7：无视SIGPIPE信号
@@ -127,7 +162,19 @@ void WebServer::Start() {
             if(fd == listenFd_) {
                 DealListen_();  // 处理监听的操作，接受客户端连接
             }
+            // 资源目录里面的文件有变化，让文件缓存里面对应的项失效
+            else if(fd == FileCache::Instance()->NotifyFd()) {
+                FileCache::Instance()->HandleNotify();
+            }
+            else if(fd == paceTimer_->Fd()) {
+                DealPaced_();
+            }
             
+            // 打开了零拷贝的连接：EPOLLERR通常只是错误队列里的完成通知，读完以后再确认socket有没有出错
+            else if(Epoller::IsErrQueueEvent(events) && users_.count(fd) > 0 && users_[fd].ZeroCopyEnabled()) {
+                DealErrQueue_(&users_[fd]);
+            }
+
             // 需要终止HTTP连接的一些情况
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 // printf("events error or EPOLLRDHUP|EPOLLHUP!\n");
@@ -178,8 +225,8 @@ void WebServer::AddClient_(int fd, sockaddr_in addr) {
     //Step1：初始化客户端连接（直接存到unordered_map里面了）
     users_[fd].init(fd, addr);
     if(timeoutMS_ > 0) {
-        // Step2：添加到定时器对象中，当检测到超时时执行CloseConn_函数进行关闭连接
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        // Step2：添加到定时器对象中，到期时由OnTimeout_检查连接当前阶段的截止时间（新连接先按请求头超时计算）
+        timer_->add(fd, config_.limit.headerTimeoutMS, std::bind(&WebServer::OnTimeout_, this, &users_[fd]));
     }
     // Step3：添加到epoll中进行管理
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
@@ -207,23 +254,90 @@ void WebServer::DealListen_() {
 // 处理读
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
-    ExtentTime_(client);   // 延长这个客户端的超时时间
+    // 空闲的keep-alive连接来了新请求：截止时间会提前到请求头超时，这是唯一一种截止时间变早的
+    //  阶段切换，需要在主线程里面重新设置定时器（EPOLLONESHOT保证此时没有工作线程在处理它）；
+    //  其他情况下截止时间只会推后，由OnTimeout_惰性续期，不会随着每次收发数据刷新定时器；
+    //  WebSocket连接没有请求头的概念，一直按PING的节奏保活
+    if(timeoutMS_ > 0 && client->Stage() == HttpConn::IDLE && !client->IsWebSocket()) {
+        client->SetStage(HttpConn::READ_HEADER, config_.limit.headerTimeoutMS);
+        timer_->adjust(client->GetFd(), config_.limit.headerTimeoutMS);
+    }
     // 加入到队列中等待线程池中的线程处理（读取数据）——这里绑定的是成员函数，有this指针
     threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
 }
 
+// 限速的连接等到了令牌（主线程中执行）：连接期间没有注册任何事件，这里重新监听EPOLLOUT；
+//  连接已经关闭（或者fd给了新连接）时WakePaced对不上唤醒时间，忽略
+void WebServer::DealPaced_() {
+    std::vector<std::pair<int, int64_t>> due;
+    paceTimer_->Expire(&due);
+    for(const auto& wake : due) {
+        auto it = users_.find(wake.first);
+        if(it != users_.end() && !it->second.IsClose() && it->second.WakePaced(wake.second)) {
+            epoller_->ModFd(wake.first, connEvent_ | EPOLLOUT);
+        }
+    }
+}
+
+bool WebServer::DefaultQdiscIsFq_() {
+    char qdisc[32] = {};
+    FILE* fp = fopen("/proc/sys/net/core/default_qdisc", "r");
+    if(!fp) { return false; }
+    bool fq = fgets(qdisc, sizeof(qdisc), fp) && strncmp(qdisc, "fq", 2) == 0 && (qdisc[2] == '\n' || qdisc[2] == '\0');
+    fclose(fp);
+    return fq;
+}
+
+void WebServer::DealErrQueue_(HttpConn* client) {
+    assert(client);
+    threadpool_->AddTask(std::bind(&WebServer::OnErrQueue_, this, client));
+}
+
+// 读完零拷贝的完成通知以后按连接当前的状态继续：还有数据要发就接着写，否则重新监听EPOLLIN
+void WebServer::OnErrQueue_(HttpConn* client) {
+    assert(client);
+    if(!client->ReapZeroCopy()) {
+        CloseConn_(client);
+        return;
+    }
+    if(client->ToWriteBytes() > 0) {
+        OnWrite_(client);
+        return;
+    }
+    epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+}
+
 // 处理写
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
-    ExtentTime_(client);// 延长这个客户端的超时时间
     // 加入到队列中等待线程池中的线程处理（写数据）——这里绑定的是成员函数，有this指针
     threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
 }
 
-// 延长客户端的超时时间
-void WebServer::ExtentTime_(HttpConn* client) {
+// 定时器到期（主线程中执行）：连接的截止时间可能已经因为阶段切换推后了，这时重新设置定时器；
+//  真正超时的话，还在收请求的连接回复408，其他阶段直接关闭
+void WebServer::OnTimeout_(HttpConn* client) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(client->IsClose()) { return; }
+    int64_t remain = client->RemainingMS();
+    if(remain > 0) {
+        timer_->adjust(client->GetFd(), static_cast<int>(remain));
+        return;
+    }
+    HttpConn::CONN_STAGE stage = client->Stage();
+    // 空闲的WebSocket连接先发PING探活，等PONG也超时了才关闭
+    if(stage == HttpConn::IDLE && client->IsWebSocket()
+            && client->SendPing(config_.websocket.pongTimeoutMS)) {
+        timer_->adjust(client->GetFd(), config_.websocket.pongTimeoutMS);
+        return;
+    }
+    if(stage == HttpConn::READ_HEADER || stage == HttpConn::READ_BODY) {
+        static const char REQUEST_TIMEOUT[] =
+            "HTTP/1.1 408 Request Timeout\r\nConnection: close\r\nContent-length: 0\r\n\r\n";
+        LOG_WARN("Client[%d] request timeout, stage:%d", client->GetFd(), stage);
+        send(client->GetFd(), REQUEST_TIMEOUT, sizeof(REQUEST_TIMEOUT) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+    CloseConn_(client);
 }
 
 // 这个方法是在子线程中执行的（读取数据），这是一个状态（先读取数据）
@@ -250,6 +364,7 @@ void WebServer::OnProcess(HttpConn* client) {
     if(status) {//处理成功，刷新epev事件，监听业务数据什么时候准备好可以进行发送
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
     } else { //无处理数据，刷新epev事件，然后继续监听EPOLL_IN信息
+        client->Flush();    // 流水线上攒着的响应不再等后面的请求
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
     }
 }
@@ -261,6 +376,21 @@ void WebServer::OnWrite_(HttpConn* client) {
     int writeErrno = 0;
     // 写数据
     ret = client->write(&writeErrno);   
+    // 限速的响应用完了令牌：socket一直是可写的，不能注册EPOLLOUT，等令牌补充以后由paceTimer_唤醒
+    //  文件接下来的部分不在页缓存里：先交给ColdLoader读盘，读完以后同样由paceTimer_唤醒
+    if(client->PaceWakeMS() > 0) {
+        FileRef file;
+        const char* data;
+        size_t len;
+        if(client->TakeColdLoad(&file, &data, &len)) {
+            int fd = client->GetFd();
+            int64_t when = client->PaceWakeMS();
+            ColdLoader::Instance()->Submit(file, data, len, [this, fd, when] { paceTimer_->Schedule(fd, when); });
+        } else {
+            paceTimer_->Schedule(client->GetFd(), client->PaceWakeMS());
+        }
+        return;
+    }
 
     // 如果将要写的字节等于0，说明写完了，判断是否要保持连接，保持连接继续去处理
     if(client->ToWriteBytes() == 0) {
@@ -274,13 +404,12 @@ void WebServer::OnWrite_(HttpConn* client) {
             return;
         }
     }
-    else if(ret < 0) {
-        //考虑到有可能会因为socket写缓冲区满了，导致用户缓冲区有数据没传完的情况，所以要判断EAGAIN
-        if(writeErrno == EAGAIN) {
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
-        }
+    //考虑到有可能会因为socket写缓冲区满了（或者未发送的数据超过了TCP_NOTSENT_LOWAT），导致用户缓冲区有数据没传完的情况，
+    //  所以要判断EAGAIN；LT模式下write只写到剩余10KB就返回，也要等下一次EPOLLOUT接着写
+    else if(ret > 0 || writeErrno == EAGAIN) {
+        /* 继续传输 */
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        return;
     }
     //如果另一端突然关闭，那返回的ret<0，并且收到EPIPE
     CloseConn_(client);
@@ -7,24 +7,31 @@
 #include <assert.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/stat.h>    // mkdir()
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
 
 #include "epoller.h"
+#include "../config/config.h"
 #include "../log/log.h"
 #include "../timer/rbtimer.h"
+#include "../timer/pacetimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/mythreadpool.h"
 #include "../pool/sqlconnRAII.h"
 #include "../http/httpconn.h"
+#include "../cache/filecache.h"
+#include "../cache/compresscache.h"
+#include "../cache/coldloader.h"
 
 class WebServer {
 public:
     WebServer(
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, const char* dbName,
-        int connPoolNum, int threadNum, bool openLog, int logLevel, int logQueSize);
+        int connPoolNum, int threadNum, bool openLog, int logLevel, int logQueSize,
+        const ServerConfig& config = ServerConfig());
 
     ~WebServer();
     void Start();
@@ -39,20 +46,25 @@ private:
     void DealRead_(HttpConn* client);           //封装读事务
 
     void SendError_(int fd, const char*info);   //向客户端发送错误信息
-    void ExtentTime_(HttpConn* client);         //延长超时时间
+    void OnTimeout_(HttpConn* client);          //定时器到期：检查连接所处阶段的截止时间
     void CloseConn_(HttpConn* client);          //关闭连接
 
     void OnRead_(HttpConn* client);             //服务器处于Read状态时调用
     void OnWrite_(HttpConn* client);            //服务器处于Write状态时调用
     void OnProcess(HttpConn* client);           //服务器处于Process状态时调用
+    void DealPaced_();                          //限速的连接等到了令牌，重新监听EPOLLOUT
+    void DealErrQueue_(HttpConn* client);       //零拷贝发送的完成通知
+    void OnErrQueue_(HttpConn* client);
 
     static const int MAX_FD = 65536;    // 最大的文件描述符的个数
 
     static int SetFdNonblock(int fd);   // 设置文件描述符非阻塞
+    static bool DefaultQdiscIsFq_();    // 默认的排队规则是不是fq（SO_MAX_PACING_RATE要靠它才能生效）
 
     int port_;                          // 服务器接收的端口
     bool openLinger_;                   // 是否打开优雅关闭
-    int timeoutMS_;                     // 连接的超时时间，单位ms 
+    int timeoutMS_;                     // keep-alive连接的空闲超时时间，单位ms（<=0表示不启用定时器）
+    ServerConfig config_;               // 其他可调参数（各阶段超时、大小限制等）
     bool isClose_;                      // 是否关闭
     int listenFd_;                      // 监听的文件描述符
     char* srcDir_;                      // 资源的目录
@@ -61,6 +73,7 @@ private:
     uint32_t connEvent_;                // 连接的文件描述符的事件
    
     std::unique_ptr<RBTimer> timer_;          // 定时器
+    std::unique_ptr<PaceTimer> paceTimer_;    // 限速连接的唤醒时间（工作线程放入，主线程取出）
     std::unique_ptr<MyThreadPool> threadpool_;  // 线程池
     std::unique_ptr<Epoller> epoller_;          // epoll对象
     std::unordered_map<int, HttpConn> users_;   // 客户端连接的信息【文件描述符，HttpConn】
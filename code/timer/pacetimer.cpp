@@ -0,0 +1,47 @@
+#include "pacetimer.h"
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <chrono>
+
+PaceTimer::PaceTimer() {
+    // steady_clock就是CLOCK_MONOTONIC，唤醒时间直接用绝对时间设置
+    fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+PaceTimer::~PaceTimer() {
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void PaceTimer::Arm_(int64_t whenMS) {
+    struct itimerspec spec = {};
+    if(whenMS > 0) {
+        spec.it_value.tv_sec = whenMS / 1000;
+        spec.it_value.tv_nsec = whenMS % 1000 * 1000000;
+    }
+    // it_value全为0表示停止计时
+    timerfd_settime(fd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void PaceTimer::Schedule(int fd, int64_t whenMS) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(heap_.empty() || whenMS < heap_.top().first) {
+        Arm_(whenMS);
+    }
+    heap_.emplace(whenMS, fd);
+}
+
+void PaceTimer::Expire(std::vector<std::pair<int, int64_t>>* due) {
+    uint64_t expirations;
+    ssize_t ret = read(fd_, &expirations, sizeof(expirations));
+    (void)ret;
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::lock_guard<std::mutex> locker(mtx_);
+    while(!heap_.empty() && heap_.top().first <= now) {
+        due->emplace_back(heap_.top().second, heap_.top().first);
+        heap_.pop();
+    }
+    Arm_(heap_.empty() ? 0 : heap_.top().first);
+}
@@ -0,0 +1,43 @@
+#ifndef PACE_TIMER_H
+#define PACE_TIMER_H
+
+/**********************************************************************
+ * -----------------------------PaceTimer------------------------------
+ *
+ * 限速的连接用完令牌以后要等一会儿再写，这时socket本身是可写的，不能靠EPOLLOUT
+ * 唤醒；工作线程把（fd，唤醒时间）放进这里的最小堆，主线程在timerfd可读时取出
+ * 到期的fd重新注册EPOLLOUT。和RBTimer不同，它可以在任意线程里Schedule：堆顶
+ * 变早时由放入的线程直接调整timerfd，主线程的epoll_wait会被唤醒。
+ *
+***********************************************************************/
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
+class PaceTimer {
+public:
+    PaceTimer();
+    ~PaceTimer();
+
+    // 放到epoll里面的timerfd（创建失败时为-1）
+    int Fd() const { return fd_; }
+    // whenMS（steady_clock的毫秒数）以后唤醒fd，可以在任意线程调用
+    void Schedule(int fd, int64_t whenMS);
+    // 主线程在Fd()可读时调用：取出所有到期的（fd，唤醒时间）
+    void Expire(std::vector<std::pair<int, int64_t>>* due);
+
+private:
+    typedef std::pair<int64_t, int> Entry;     // 唤醒时间，fd
+
+    void Arm_(int64_t whenMS);
+
+    int fd_;
+    std::mutex mtx_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap_;
+};
+
+#endif //PACE_TIMER_H
@@ -5,7 +5,8 @@ void RBTimer::add(int id, int timeout, const TimeoutCallBack& cb) {
     
     /* add的结点本来就存在：则通过ref_获取该节点的rbKey，然后删除该节点，更新时间并重新插入到树中 */
     if(ref_.count(id) > 0) {
-        auto nodePtr = rbtree_.erase(ref_[id]->key);
+        delete static_cast<TimeoutCallBack*>(ref_[id]->value);
+        rbtree_.erase(ref_[id]->key);
     }
     /* add的结点为新节点，维护ref_*/
     TimeoutCallBack* cb_ptr=new TimeoutCallBack(cb);
@@ -67,9 +68,15 @@ void RBTimer::tick() {
             break;
         }
         //回调函数（其实应该交给线程池去做）
-        (*static_cast<TimeoutCallBack*>(node->value))();
-        //删除节点
-        del(node->key.id);
+        rbKey key = node->key;
+        TimeoutCallBack* cb = static_cast<TimeoutCallBack*>(node->value);
+        (*cb)();
+        //删除节点：回调里面可能调用adjust()续期了（节点已经换成新的），这时不能删
+        auto it = ref_.find(key.id);
+        if(it != ref_.end() && it->second->key == key) {
+            del(key.id);
+            delete cb;
+        }
     }
 }
 
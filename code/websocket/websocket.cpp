@@ -0,0 +1,349 @@
+#include "websocket.h"
+#include <algorithm>
+#include "../log/log.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const uint8_t FLAG_FIN = 0x80;
+static const uint8_t FLAG_RSV = 0x70;      // 没有协商任何扩展，RSV位必须是0
+static const uint8_t FLAG_MASK = 0x80;
+static const size_t MAX_CONTROL_PAYLOAD = 125;
+
+static const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+const char WebSocket::PING_FRAME[] = { static_cast<char>(FLAG_FIN | PING), 0 };
+
+static uint32_t Rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+// SHA-1（RFC 3174），只在握手时对一个60字节的串用一次
+static void Sha1(const char* data, size_t len, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    // 补位：0x80，若干0，最后8字节是比特长度（大端）
+    size_t total = (len + 8) / 64 * 64 + 64;
+    std::string msg(data, len);
+    msg.resize(total, '\0');
+    msg[len] = static_cast<char>(0x80);
+    uint64_t bits = static_cast<uint64_t>(len) * 8;
+    for(int i = 0; i < 8; i++) {
+        msg[total - 1 - i] = static_cast<char>(bits >> (8 * i));
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data());
+    for(size_t off = 0; off < total; off += 64) {
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++) {
+            const uint8_t* q = p + off + i * 4;
+            w[i] = (static_cast<uint32_t>(q[0]) << 24) | (static_cast<uint32_t>(q[1]) << 16)
+                 | (static_cast<uint32_t>(q[2]) << 8) | q[3];
+        }
+        for(int i = 16; i < 80; i++) {
+            w[i] = Rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if(i < 20)      { f = (b & c) | (~b & d);           k = 0x5A827999; }
+            else if(i < 40) { f = b ^ c ^ d;                    k = 0x6ED9EBA1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d);  k = 0x8F1BBCDC; }
+            else            { f = b ^ c ^ d;                    k = 0xCA62C1D6; }
+            uint32_t t = Rotl(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = Rotl(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for(int i = 0; i < 5; i++) {
+        digest[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+    }
+}
+
+// 标准base64（带填充），out至少要有(len + 2) / 3 * 4字节
+static size_t Base64Encode(const uint8_t* data, size_t len, char* out) {
+    char* w = out;
+    size_t i = 0;
+    for(; i + 3 <= len; i += 3) {
+        uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        *w++ = BASE64_CHARS[v >> 18];
+        *w++ = BASE64_CHARS[(v >> 12) & 0x3f];
+        *w++ = BASE64_CHARS[(v >> 6) & 0x3f];
+        *w++ = BASE64_CHARS[v & 0x3f];
+    }
+    if(i < len) {
+        uint32_t v = data[i] << 16;
+        if(i + 1 < len) { v |= data[i + 1] << 8; }
+        *w++ = BASE64_CHARS[v >> 18];
+        *w++ = BASE64_CHARS[(v >> 12) & 0x3f];
+        *w++ = (i + 1 < len) ? BASE64_CHARS[(v >> 6) & 0x3f] : '=';
+        *w++ = '=';
+    }
+    return w - out;
+}
+
+bool WebSocket::IsValidKey(const StrView& key) {
+    // 16字节编码以后是22个有效字符加"=="
+    if(key.len != 24 || key.data[22] != '=' || key.data[23] != '=') {
+        return false;
+    }
+    for(size_t i = 0; i < 22; i++) {
+        if(!strchr(BASE64_CHARS, key.data[i]) || key.data[i] == '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+void WebSocket::WriteHandshake(Buffer& out, const StrView& key) {
+    char input[24 + sizeof(WS_GUID) - 1];
+    assert(key.len == 24);
+    memcpy(input, key.data, key.len);
+    memcpy(input + key.len, WS_GUID, sizeof(WS_GUID) - 1);
+    uint8_t digest[20];
+    Sha1(input, sizeof(input), digest);
+    char accept[28];
+    size_t n = Base64Encode(digest, sizeof(digest), accept);
+    out.Append("HTTP/1.1 101 Switching Protocols\r\n"
+               "Upgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: ");
+    out.Append(accept, n);
+    out.Append("\r\n\r\n");
+}
+
+void WebSocket::Unmask(char* data, size_t len, const uint8_t* mask) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // 掩码每4字节循环一次，16字节的向量正好是4个完整的周期
+    uint32_t m;
+    memcpy(&m, mask, 4);
+    const __m128i key = _mm_set1_epi32(static_cast<int>(m));
+    for(; i + 16 <= len; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key));
+    }
+#endif
+    for(; i < len; i++) {
+        data[i] ^= mask[i & 3];
+    }
+}
+
+WebSocket::WebSocket(const WebSocketConfig* config)
+    : config_(config), closing_(false), msgOpcode_(0) {
+    assert(config);
+}
+
+void WebSocket::Process(Buffer& in, Buffer& out) {
+    // 帧直接在读缓冲区上解析和去掩码，需要连续的内存
+    in.Linearize();
+    while(!closing_ && in.ReadableBytes() >= 2) {
+        // 读缓冲区是这个连接自己的，负载去掩码以后就不再需要原来的内容，可以原地改写
+        char* frame = const_cast<char*>(in.Peek());
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(frame);
+        size_t avail = in.ReadableBytes();
+        uint8_t opcode = p[0] & 0x0f;
+        bool fin = p[0] & FLAG_FIN;
+        if((p[0] & FLAG_RSV) || !(p[1] & FLAG_MASK)) {
+            // 客户端发来的帧必须带掩码
+            Close_(PROTOCOL_ERROR, out);
+            break;
+        }
+        size_t len = p[1] & 0x7f;
+        size_t headerLen = 2;
+        if(len == 126) {
+            headerLen = 4;
+        }
+        else if(len == 127) {
+            headerLen = 10;
+        }
+        if(avail < headerLen + 4) {
+            break;      // 帧头还没收完
+        }
+        if(len == 126) {
+            len = (static_cast<size_t>(p[2]) << 8) | p[3];
+        }
+        else if(len == 127) {
+            uint64_t len64 = 0;
+            for(int i = 0; i < 8; i++) { len64 = (len64 << 8) | p[2 + i]; }
+            // 最高位必须是0；再大也超过了消息的上限，按消息过大处理
+            len = static_cast<size_t>(std::min<uint64_t>(len64, SIZE_MAX));
+        }
+        if(len > config_->maxMessageBytes || message_.size() + len > config_->maxMessageBytes) {
+            Close_(MESSAGE_TOO_BIG, out);
+            break;
+        }
+        if(avail - headerLen - 4 < len) {
+            break;      // 负载还没收完
+        }
+        char* payload = frame + headerLen + 4;
+        Unmask(payload, len, p + headerLen);
+        bool ok = HandleFrame_(opcode, fin, payload, len, out);
+        in.Retrieve(headerLen + 4 + len);
+        if(!ok) { break; }
+    }
+}
+
+bool WebSocket::HandleFrame_(uint8_t opcode, bool fin, char* payload, size_t len, Buffer& out) {
+    if(opcode & 0x8) {
+        // 控制帧不能分片，负载不超过125字节，可以插在分片消息中间
+        if(!fin || len > MAX_CONTROL_PAYLOAD) {
+            return Close_(PROTOCOL_ERROR, out);
+        }
+        switch(opcode) {
+            case PING:
+                Send(PONG, payload, len, out);
+                return true;
+            case PONG:
+                return true;    // 收到任何数据都说明连接还活着，HttpConn已经清掉了等待PONG的标志
+            case CLOSE:
+                return OnClose_(payload, len, out);
+            default:
+                return Close_(PROTOCOL_ERROR, out);
+        }
+    }
+    if(opcode == CONTINUATION) {
+        if(msgOpcode_ == 0) {
+            return Close_(PROTOCOL_ERROR, out);
+        }
+    }
+    else if(opcode == TEXT || opcode == BINARY) {
+        if(msgOpcode_ != 0) {
+            return Close_(PROTOCOL_ERROR, out);     // 上一条分片消息还没结束
+        }
+        if(fin) {
+            // 没有分片的消息（绝大多数情况）：直接用读缓冲区里面的负载
+            if(opcode == TEXT && !IsUtf8_(payload, len)) {
+                return Close_(INVALID_DATA, out);
+            }
+            OnMessage_(static_cast<OPCODE>(opcode), payload, len, out);
+            return true;
+        }
+        msgOpcode_ = opcode;
+    }
+    else {
+        return Close_(PROTOCOL_ERROR, out);
+    }
+    message_.append(payload, len);
+    if(fin) {
+        OPCODE type = static_cast<OPCODE>(msgOpcode_);
+        msgOpcode_ = 0;
+        if(type == TEXT && !IsUtf8_(message_.data(), message_.size())) {
+            return Close_(INVALID_DATA, out);
+        }
+        OnMessage_(type, message_.data(), message_.size(), out);
+        message_.clear();
+    }
+    return true;
+}
+
+bool WebSocket::OnClose_(const char* payload, size_t len, Buffer& out) {
+    if(len == 0) {
+        // 对端没有给状态码，回复一个空的CLOSE
+        WriteFrameHeader_(out, CLOSE, 0);
+        closing_ = true;
+        return false;
+    }
+    uint16_t code = (len >= 2) ? static_cast<uint16_t>((static_cast<uint8_t>(payload[0]) << 8) | static_cast<uint8_t>(payload[1])) : 0;
+    // 1004~1006、1015是保留的，不能出现在帧里面
+    bool valid = len >= 2 && ((code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011)
+                              || (code >= 3000 && code <= 4999));
+    if(!valid) {
+        return Close_(PROTOCOL_ERROR, out);
+    }
+    if(!IsUtf8_(payload + 2, len - 2)) {
+        return Close_(INVALID_DATA, out);
+    }
+    return Close_(code, out);
+}
+
+void WebSocket::OnMessage_(OPCODE opcode, const char* data, size_t len, Buffer& out) {
+    // 回显
+    Send(opcode, data, len, out);
+}
+
+bool WebSocket::Close_(uint16_t code, Buffer& out) {
+    if(code != NORMAL_CLOSURE) {
+        LOG_WARN("WebSocket close: %d", code);
+    }
+    char payload[2] = { static_cast<char>(code >> 8), static_cast<char>(code & 0xff) };
+    Send(CLOSE, payload, sizeof(payload), out);
+    closing_ = true;
+    return false;
+}
+
+void WebSocket::Send(OPCODE opcode, const char* data, size_t len, Buffer& out) {
+    WriteFrameHeader_(out, opcode, len);
+    out.Append(data, len);
+}
+
+// 服务器发出的帧不带掩码，总是一帧发完（FIN）
+void WebSocket::WriteFrameHeader_(Buffer& out, uint8_t opcode, size_t len) {
+    char header[10];
+    size_t n = 2;
+    header[0] = static_cast<char>(FLAG_FIN | opcode);
+    if(len < 126) {
+        header[1] = static_cast<char>(len);
+    }
+    else if(len <= 0xffff) {
+        header[1] = 126;
+        header[2] = static_cast<char>(len >> 8);
+        header[3] = static_cast<char>(len);
+        n = 4;
+    }
+    else {
+        header[1] = 127;
+        for(int i = 0; i < 8; i++) {
+            header[2 + i] = static_cast<char>(static_cast<uint64_t>(len) >> (56 - 8 * i));
+        }
+        n = 10;
+    }
+    out.Append(header, n);
+}
+
+// 严格的UTF-8检查：拒绝超长编码、代理项（U+D800~U+DFFF）和超过U+10FFFF的码点
+bool WebSocket::IsUtf8_(const char* data, size_t len) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    const uint8_t* end = p + len;
+    while(p < end) {
+        // ASCII一次跳过8字节
+        if(end - p >= 8) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            if((v & 0x8080808080808080ull) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        uint8_t c = *p;
+        if(c < 0x80) {
+            p++;
+            continue;
+        }
+        int n;
+        uint8_t lo = 0x80, hi = 0xbf;   // 第二个字节的范围
+        if(c >= 0xc2 && c <= 0xdf) { n = 1; }
+        else if(c >= 0xe0 && c <= 0xef) {
+            n = 2;
+            if(c == 0xe0) { lo = 0xa0; }
+            else if(c == 0xed) { hi = 0x9f; }
+        }
+        else if(c >= 0xf0 && c <= 0xf4) {
+            n = 3;
+            if(c == 0xf0) { lo = 0x90; }
+            else if(c == 0xf4) { hi = 0x8f; }
+        }
+        else { return false; }
+        if(end - p <= n || p[1] < lo || p[1] > hi) {
+            return false;
+        }
+        for(int i = 2; i <= n; i++) {
+            if((p[i] & 0xc0) != 0x80) { return false; }
+        }
+        p += n + 1;
+    }
+    return true;
+}
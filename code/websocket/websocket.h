@@ -0,0 +1,89 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+/**********************************************************************
+ * -----------------------------WebSocket------------------------------
+ *
+ * 一个WebSocket（RFC 6455）连接的协议状态，由HttpConn持有，和HTTP/2一样
+ * 在工作线程里面处理：
+ * 1、握手：HttpConn确认是合法的Upgrade: websocket请求以后调用WriteHandshake，
+ *    按Sec-WebSocket-Key算出Sec-WebSocket-Accept（SHA-1 + base64），回复101；
+ * 2、分帧：帧直接在读缓冲区上解析，负载原地去掩码（SSE2一次处理16字节），
+ *    没有分片的消息不经过任何中间拷贝就交给OnMessage_；分片的消息拼接到
+ *    message_里面，收完再交给OnMessage_；
+ * 3、控制帧：PING回复PONG，CLOSE回复CLOSE以后关闭连接；
+ * 4、保活：连接空闲pingIntervalMS以后，WebServer的定时器（主线程）直接往
+ *    socket上发送PING_FRAME，pongTimeoutMS内没有收到任何数据就关闭连接；
+ * 5、出错：协议错误、消息过大、非法UTF-8都按对应的状态码发送CLOSE。
+ *
+ * 应用层目前只有一个回显（/ws），服务器主动推送调用Send()即可。
+ *
+***********************************************************************/
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "../buffer/buffer.h"
+#include "../buffer/arena.h"
+#include "../config/config.h"
+
+class WebSocket {
+public:
+    // 帧类型（RFC 6455 5.2）
+    enum OPCODE {
+        CONTINUATION = 0x0,
+        TEXT = 0x1,
+        BINARY = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xA,
+    };
+
+    // CLOSE帧的状态码（RFC 6455 7.4.1）
+    enum CLOSE_CODE {
+        NORMAL_CLOSURE = 1000,
+        GOING_AWAY = 1001,
+        PROTOCOL_ERROR = 1002,
+        INVALID_DATA = 1007,
+        MESSAGE_TOO_BIG = 1009,
+    };
+
+    // 不带负载的PING帧，定时器在主线程里面直接send()，不经过写缓冲区
+    static const char PING_FRAME[];
+    static const size_t PING_FRAME_LEN = 2;
+
+    // Sec-WebSocket-Key必须是16字节随机数的base64编码（24个字符）
+    static bool IsValidKey(const StrView& key);
+    // 写出101响应
+    static void WriteHandshake(Buffer& out, const StrView& key);
+    // 原地去掩码，mask是帧头里面的4字节掩码
+    static void Unmask(char* data, size_t len, const uint8_t* mask);
+
+    explicit WebSocket(const WebSocketConfig* config);
+
+    // 处理in里面所有完整的帧，回复写到out
+    void Process(Buffer& in, Buffer& out);
+    // 发送一条完整的消息（服务器主动推送也用它）
+    void Send(OPCODE opcode, const char* data, size_t len, Buffer& out);
+
+    // 已经发送了CLOSE，发完out里面的数据以后应该关闭连接
+    bool IsClosing() const { return closing_; }
+
+private:
+    // 处理一个完整的帧，返回false表示连接要关闭了
+    bool HandleFrame_(uint8_t opcode, bool fin, char* payload, size_t len, Buffer& out);
+    bool OnClose_(const char* payload, size_t len, Buffer& out);
+    // 收到一条完整的消息（应用层）
+    void OnMessage_(OPCODE opcode, const char* data, size_t len, Buffer& out);
+    bool Close_(uint16_t code, Buffer& out);
+
+    static void WriteFrameHeader_(Buffer& out, uint8_t opcode, size_t len);
+    static bool IsUtf8_(const char* data, size_t len);
+
+    const WebSocketConfig* config_;
+    bool closing_;          // 我们已经发送了CLOSE
+    uint8_t msgOpcode_;     // 正在接收的分片消息的类型（TEXT/BINARY），0表示没有
+    std::string message_;   // 分片消息拼起来的内容
+};
+
+#endif //WEBSOCKET_H
@@ -0,0 +1,252 @@
+/**********************************************************************
+ * ------------------------------sitepack------------------------------
+ *
+ * 把资源目录打包成一个站点镜像（格式见code/cache/sitepack.h）：
+ *
+ *   ./bin/sitepack resources site.pack
+ *
+ * 1、只打包“其他用户”可读的普通文件，跳过以'.'开头的文件和目录（和服务器一样）；
+ * 2、ETag由内容的CRC32和大小生成，内容不变的文件重新打包以后ETag不变；
+ * 3、没有比原文件新的.gz版本的文本文件生成一份gzip版本（至少小10%才留下）；
+ * 4、先写到同一个目录下的临时文件，写完再rename过去，服务器只会看到完整的镜像。
+ *
+***********************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../code/cache/sitepack.h"
+
+// 要生成gzip版本的文本类资源（和服务器的动态压缩范围一致）
+static const char* const COMPRESSIBLE[] = {
+    ".html", ".htm", ".css", ".js", ".mjs", ".json", ".xml", ".txt", ".csv", ".svg",
+    ".ico", ".ttf", ".otf", ".eot", ".map", ".md",
+};
+static const size_t GZIP_MIN_BYTES = 1024;
+
+struct Item {
+    std::string path;           // 相对路径（以'/'开头）
+    std::string source;         // 磁盘上的完整路径，生成的压缩版本为空
+    std::string content;        // 生成的压缩版本的内容
+    struct stat st;
+    uint64_t size = 0;
+    std::string etag;
+};
+
+static bool EndsWith(const std::string& s, const char* suffix) {
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+static bool Compressible(const std::string& path) {
+    for(const char* suffix : COMPRESSIBLE) {
+        if(EndsWith(path, suffix)) { return true; }
+    }
+    return false;
+}
+
+static bool NewerOrSame(const struct stat& a, const struct stat& b) {
+    return a.st_mtim.tv_sec > b.st_mtim.tv_sec
+        || (a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec >= b.st_mtim.tv_nsec);
+}
+
+static bool ReadFile(const std::string& path, std::string* out) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(!fp) { return false; }
+    char buf[65536];
+    size_t n;
+    out->clear();
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out->append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static void ListTree(const std::string& dir, const std::string& rel, std::vector<Item>* items) {
+    DIR* d = opendir(dir.c_str());
+    if(!d) {
+        fprintf(stderr, "sitepack: opendir %s: %s\n", dir.c_str(), strerror(errno));
+        return;
+    }
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_name[0] == '.') { continue; }
+        Item item;
+        item.source = dir + "/" + ent->d_name;
+        item.path = rel + "/" + ent->d_name;
+        if(stat(item.source.c_str(), &item.st) != 0) { continue; }
+        if(S_ISDIR(item.st.st_mode)) {
+            ListTree(item.source, item.path, items);
+        } else if(S_ISREG(item.st.st_mode)) {
+            if(!(item.st.st_mode & S_IROTH)) {
+                fprintf(stderr, "sitepack: skip %s (not world-readable)\n", item.path.c_str());
+                continue;
+            }
+            item.size = item.st.st_size;
+            items->push_back(std::move(item));
+        }
+    }
+    closedir(d);
+}
+
+// gzip整个内容，没有明显变小时返回false
+static bool Gzip(const std::string& in, std::string* out) {
+    z_stream zs = {};
+    if(deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&zs, in.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = in.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+    zs.avail_out = out->size();
+    int ret = deflate(&zs, Z_FINISH);
+    out->resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END && out->size() * 10 <= in.size() * 9;
+}
+
+static std::string HttpDate(time_t t) {
+    char buf[64];
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    return std::string(buf, strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+}
+
+static bool WriteAll(FILE* fp, const void* data, size_t len) {
+    return fwrite(data, 1, len, fp) == len;
+}
+
+static bool Pad(FILE* fp, uint64_t* pos, uint64_t align) {
+    static const char zeros[SITEPACK_PAGE] = {};
+    uint64_t pad = (align - *pos % align) % align;
+    *pos += pad;
+    return WriteAll(fp, zeros, pad);
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s <resource dir> <output>\n", argv[0]);
+        return 1;
+    }
+    std::string root = argv[1];
+    while(root.size() > 1 && root.back() == '/') { root.pop_back(); }
+    std::string output = argv[2];
+
+    std::vector<Item> items;
+    ListTree(root, "", &items);
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.path < b.path; });
+
+    // 文本文件没有可用的.gz版本时生成一份，修改时间和原文件一样
+    std::vector<Item> generated;
+    for(size_t i = 0; i < items.size(); i++) {
+        const Item& item = items[i];
+        if(!Compressible(item.path) || item.size < GZIP_MIN_BYTES) { continue; }
+        std::string gzPath = item.path + ".gz";
+        auto it = std::lower_bound(items.begin(), items.end(), gzPath,
+                                   [](const Item& a, const std::string& p) { return a.path < p; });
+        if(it != items.end() && it->path == gzPath && NewerOrSame(it->st, item.st)) { continue; }
+        if(it != items.end() && it->path == gzPath) {
+            fprintf(stderr, "sitepack: replace stale %s\n", gzPath.c_str());
+        }
+        std::string content;
+        Item gz;
+        if(!ReadFile(item.source, &content) || !Gzip(content, &gz.content)) { continue; }
+        gz.path = gzPath;
+        gz.st = item.st;
+        gz.size = gz.content.size();
+        generated.push_back(std::move(gz));
+    }
+    for(Item& gz : generated) {
+        auto it = std::lower_bound(items.begin(), items.end(), gz.path,
+                                   [](const Item& a, const std::string& p) { return a.path < p; });
+        if(it != items.end() && it->path == gz.path) {
+            *it = std::move(gz);
+        } else {
+            items.insert(it, std::move(gz));
+        }
+    }
+
+    std::string tmp = output + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if(!fp) {
+        fprintf(stderr, "sitepack: open %s: %s\n", tmp.c_str(), strerror(errno));
+        return 1;
+    }
+    SitePackHeader header = {};
+    memcpy(header.magic, SITEPACK_MAGIC, sizeof(SITEPACK_MAGIC));
+    header.version = SITEPACK_VERSION;
+    header.count = items.size();
+    bool ok = WriteAll(fp, &header, sizeof(header));
+    uint64_t pos = sizeof(header);
+
+    // 内容：不小于一页的按页对齐，小文件紧凑排列
+    std::vector<SitePackEntry> index(items.size());
+    std::string strings;
+    std::string content;
+    for(size_t i = 0; ok && i < items.size(); i++) {
+        Item& item = items[i];
+        if(!item.source.empty() && !ReadFile(item.source, &item.content)) {
+            fprintf(stderr, "sitepack: read %s: %s\n", item.source.c_str(), strerror(errno));
+            ok = false;
+            break;
+        }
+        item.size = item.content.size();
+        ok = Pad(fp, &pos, item.size >= SITEPACK_PAGE ? SITEPACK_PAGE : SITEPACK_ALIGN)
+            && WriteAll(fp, item.content.data(), item.size);
+        uLong crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(item.content.data()), item.size);
+        char etag[64];
+        snprintf(etag, sizeof(etag), "\"%08lx-%llx\"", crc, static_cast<unsigned long long>(item.size));
+        std::string lastModified = HttpDate(item.st.st_mtime);
+
+        SitePackEntry& entry = index[i];
+        entry.offset = pos;
+        entry.size = item.size;
+        entry.mtimeSec = item.st.st_mtim.tv_sec;
+        entry.mtimeNsec = item.st.st_mtim.tv_nsec;
+        entry.mode = item.st.st_mode & 07777;
+        entry.pathOff = strings.size();
+        entry.pathLen = item.path.size();
+        strings += item.path;
+        entry.etagOff = strings.size();
+        entry.etagLen = strlen(etag);
+        strings += etag;
+        entry.lastModifiedOff = strings.size();
+        entry.lastModifiedLen = lastModified.size();
+        strings += lastModified;
+        pos += item.size;
+        std::string().swap(item.content);
+    }
+
+    ok = ok && Pad(fp, &pos, alignof(SitePackEntry));
+    header.indexOffset = pos;
+    ok = ok && WriteAll(fp, index.data(), index.size() * sizeof(SitePackEntry));
+    pos += index.size() * sizeof(SitePackEntry);
+    header.stringsOffset = pos;
+    header.stringsSize = strings.size();
+    ok = ok && WriteAll(fp, strings.data(), strings.size());
+    pos += strings.size();
+    header.fileSize = pos;
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 && WriteAll(fp, &header, sizeof(header));
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    // 镜像要让运行服务器的用户可读
+    ok = ok && chmod(tmp.c_str(), 0644) == 0 && rename(tmp.c_str(), output.c_str()) == 0;
+    if(!ok) {
+        fprintf(stderr, "sitepack: write %s: %s\n", output.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("%s: %zu files, %llu bytes\n", output.c_str(), items.size(), static_cast<unsigned long long>(pos));
+    return 0;
+}
@@ -5,13 +5,668 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/mythreadpool.h"
+#include "../code/buffer/arena.h"
+#include "../code/http/uri.h"
+#include "../code/http/router.h"
+#include "../code/http2/hpack.h"
+#include "../code/websocket/websocket.h"
+#include "../code/http/multipart.h"
+#include "../code/http/httprequest.h"
+#include "../code/http/httpresponse.h"
+#include "../code/http/httpconn.h"
+#include "../code/cache/filecache.h"
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
 #include <features.h>
+#include <assert.h>
+#include <string.h>
+#include <string>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
 #define gettid() syscall(SYS_gettid)
 #endif
 
+void TestArena() {
+    // 块链：当前块放不下时切到新块，前面分配出去的内容不受影响
+    Arena arena(256, 1024);
+    char* first = static_cast<char*>(arena.Alloc(1, 1));
+    *first = 'a';
+    StrView strs[16];
+    for(int i = 0; i < 16; i++) {
+        char text[64];
+        int n = snprintf(text, sizeof(text), "string-%02d-padding-padding-padding", i);
+        strs[i] = arena.CopyStr(text, n);
+    }
+    assert(arena.BytesReserved() > 256);
+    for(int i = 0; i < 16; i++) {
+        char text[64];
+        int n = snprintf(text, sizeof(text), "string-%02d-padding-padding-padding", i);
+        assert(strs[i] == StrView(text, n) && strs[i].data[n] == '\0');
+    }
+    assert(*first == 'a');
+
+    // 对齐：跨块时也要按要求对齐
+    for(size_t align = 1; align <= 64; align <<= 1) {
+        for(int i = 0; i < 20; i++) {
+            arena.Alloc(1, 1);
+            void* p = arena.Alloc(24, align);
+            assert(reinterpret_cast<uintptr_t>(p) % align == 0);
+        }
+    }
+    uint64_t* num = arena.New<uint64_t>(42);
+    assert(reinterpret_cast<uintptr_t>(num) % alignof(uint64_t) == 0 && *num == 42);
+
+    // 超大分配：比块大小还大的请求单独申请一块，整段都可写
+    size_t before = arena.BytesReserved();
+    char* big = static_cast<char*>(arena.Alloc(4000, 16));
+    assert(reinterpret_cast<uintptr_t>(big) % 16 == 0);
+    memset(big, 'x', 4000);
+    assert(arena.BytesReserved() >= before + 4000);
+    char* after = static_cast<char*>(arena.Alloc(8, 1));
+    assert(after < big || after >= big + 4000);
+
+    // Reset：超出保留上限时只留第一块，并且从第一块的开头重新分配
+    assert(arena.BytesReserved() > 1024);
+    arena.Reset();
+    assert(arena.BytesReserved() == 256 && arena.BytesUsed() == 0);
+    assert(static_cast<char*>(arena.Alloc(1, 1)) == first);
+
+    // 没有超出保留上限时后面的块挂在链表上复用，不再申请新内存
+    Arena small(256, 4096);
+    char* head = static_cast<char*>(small.Alloc(200, 1));
+    small.Alloc(200, 1);
+    small.Alloc(200, 1);
+    size_t reserved = small.BytesReserved();
+    assert(reserved > 256 && small.BytesUsed() > 256);
+    small.Reset();
+    assert(small.BytesReserved() == reserved && small.BytesUsed() == 0);
+    assert(static_cast<char*>(small.Alloc(200, 1)) == head);
+    small.Alloc(200, 1);
+    small.Alloc(200, 1);
+    assert(small.BytesReserved() == reserved);
+    printf("TestArena OK\n");
+}
+
+// 规范化以后的路径，失败返回"!"
+static std::string NormalizePath(const char* target) {
+    std::string buf(target);
+    StrView path, query;
+    if(!Uri::ParseTarget(&buf[0], buf.size(), &path, &query)) {
+        return "!";
+    }
+    return std::string(path.data, path.len);
+}
+
+void TestUri() {
+    // 已经是规范形式的路径原样返回
+    assert(NormalizePath("/index.html") == "/index.html");
+    assert(NormalizePath("/css/style.css?v=1") == "/css/style.css");
+    // 合并"//"，消除"."和".."
+    assert(NormalizePath("//a//b") == "/a/b");
+    assert(NormalizePath("/a/./b/") == "/a/b/");
+    assert(NormalizePath("/a/b/../c") == "/a/c");
+    assert(NormalizePath("/a/%2e%2e/") == "/");
+    assert(NormalizePath("/a/%2E%2E/b") == "/b");
+    assert(NormalizePath("/%69ndex.html") == "/index.html");
+    // 越过根目录
+    assert(NormalizePath("/../") == "!");
+    assert(NormalizePath("/..") == "!");
+    assert(NormalizePath("/a/../../etc/passwd") == "!");
+    assert(NormalizePath("/%2e%2e/etc/passwd") == "!");
+    assert(NormalizePath("/a/%2e%2e/%2e%2e/") == "!");
+    // %00和非法的%序列
+    assert(NormalizePath("/index.html%00.png") == "!");
+    assert(NormalizePath("/%zz") == "!");
+    assert(NormalizePath("/a%2") == "!");
+    // 表单解码：'+'是空格，非法的%序列原样保留
+    char form[] = "a+b%27c%zz";
+    size_t len = Uri::UrlDecode(form, strlen(form), true);
+    assert(std::string(form, len) == "a b'c%zz");
+    printf("TestUri OK\n");
+}
+
+static bool RouteIs(const char* path, const char* pattern) {
+    const Route* r = Router::Match(StrView(path, strlen(path)));
+    return pattern ? (r && strcmp(r->pattern, pattern) == 0) : r == nullptr;
+}
+
+static std::string Mime(const char* path) {
+    StrView type = Router::MimeType(StrView(path, strlen(path)));
+    return std::string(type.data, type.len);
+}
+
+void TestRouter() {
+    // 每个精确路由都能命中自己：完美哈希在实际的路由表上没有冲突
+    const char* exact[] = {
+        "/", "/index", "/welcome", "/video", "/picture", "/register", "/register.html",
+        "/login", "/login.html", "/upload", "/ws",
+    };
+    for(const char* path : exact) {
+        assert(RouteIs(path, path));
+    }
+    assert(Router::Match(StrView("/login", 6))->action == RouteAction::LOGIN);
+    assert(Router::Match(StrView("/ws", 3))->action == RouteAction::WEBSOCKET);
+
+    // 未知路径不能命中：落到某个槽里以后还要比较一次字符串
+    const char* unknown[] = {
+        "", "/nope", "/indexx", "/inde", "/login.htm", "/Login", "/ws/", "/css", "/uploads",
+        "/index.html", "/video.html",
+    };
+    for(const char* path : unknown) {
+        assert(RouteIs(path, nullptr));
+    }
+    for(const char* path : exact) {
+        // 和已有路由只差一个字符的路径
+        std::string s(path);
+        for(char c = 'a'; c <= 'z'; c++) {
+            std::string t = s + c;
+            assert(RouteIs(t.c_str(), nullptr));
+            if(s.size() > 1) {
+                t = s.substr(0, s.size() - 1) + c;
+                assert(t == s || RouteIs(t.c_str(), nullptr));
+            }
+        }
+    }
+
+    // 前缀路由
+    assert(RouteIs("/css/style.css", "/css/"));
+    assert(RouteIs("/video/xxx.mp4", "/video/"));
+    assert(RouteIs("/images/", "/images/"));
+    assert(RouteIs("/cssx/style.css", nullptr));
+
+    // 扩展名和原来的SUFFIX_TYPE保持一致（原表里".word"的"nsword"笔误和
+    // css/js末尾多余的空格已经改掉）
+    const char* oldSuffixType[][2] = {
+        { ".html",  "text/html" },
+        { ".xml",   "text/xml" },
+        { ".xhtml", "application/xhtml+xml" },
+        { ".txt",   "text/plain" },
+        { ".rtf",   "application/rtf" },
+        { ".pdf",   "application/pdf" },
+        { ".word",  "application/msword" },
+        { ".png",   "image/png" },
+        { ".gif",   "image/gif" },
+        { ".jpg",   "image/jpeg" },
+        { ".jpeg",  "image/jpeg" },
+        { ".au",    "audio/basic" },
+        { ".mpeg",  "video/mpeg" },
+        { ".mpg",   "video/mpeg" },
+        { ".avi",   "video/x-msvideo" },
+        { ".gz",    "application/x-gzip" },
+        { ".tar",   "application/x-tar" },
+        { ".css",   "text/css" },
+        { ".js",    "text/javascript" },
+    };
+    for(const auto& e : oldSuffixType) {
+        std::string path = std::string("/dir/file") + e[0];
+        assert(Mime(path.c_str()) == e[1]);
+    }
+    assert(Mime("/video/a.mp4") == "video/mp4");
+    // 未知扩展名、没有扩展名、'.'在目录名里，都和原来一样返回text/plain
+    assert(Mime("/a.unknown") == "text/plain");
+    assert(Mime("/a.HTML") == "text/plain");
+    assert(Mime("/noext") == "text/plain");
+    assert(Mime("/a.html/noext") == "text/plain");
+    assert(Mime("") == "text/plain");
+    printf("TestRouter OK\n");
+}
+
+void TestHpack() {
+    // Huffman：包括不在常用码表前面的字节
+    const char* samples[] = { "", "www.example.com", "no-cache", "custom-value", "\x01\xff~|{}" };
+    for(const char* sample : samples) {
+        Buffer buf;
+        Arena arena;
+        StrView in(sample, strlen(sample)), out;
+        Huffman::Encode(in, buf);
+        assert(buf.ReadableBytes() == Huffman::EncodedLen(in));
+        assert(Huffman::Decode(reinterpret_cast<const uint8_t*>(buf.Peek()), buf.ReadableBytes(), &arena, &out));
+        assert(out == in);
+    }
+    // RFC 7541 C.4.1：Huffman编码的"www.example.com"
+    const uint8_t www[] = { 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff };
+    Arena arena;
+    StrView out;
+    assert(Huffman::Decode(www, sizeof(www), &arena, &out) && out == "www.example.com");
+
+    // 编码器和解码器各自维护动态表，连续两个头部块第二次应当只剩索引
+    const char* headers[][2] = {
+        { ":status", "200" }, { "content-type", "text/html" }, { "x-custom", "value" },
+        { "content-length", "1234" }, { "server", "WebServer" },
+    };
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    size_t sizes[2];
+    for(int round = 0; round < 2; round++) {
+        Buffer buf;
+        encoder.BeginBlock(buf);
+        for(const auto& h : headers) {
+            bool indexing = strcmp(h[0], "content-length") != 0;
+            encoder.Encode(StrView(h[0], strlen(h[0])), StrView(h[1], strlen(h[1])), buf, indexing);
+        }
+        sizes[round] = buf.ReadableBytes();
+        HpackDecoder::Field* fields = nullptr;
+        Arena blockArena;
+        assert(decoder.Decode(reinterpret_cast<const uint8_t*>(buf.Peek()), buf.ReadableBytes(), &blockArena, &fields));
+        size_t i = 0;
+        for(HpackDecoder::Field* f = fields; f; f = f->next, i++) {
+            assert(i < 5 && f->name == headers[i][0] && f->value == headers[i][1]);
+        }
+        assert(i == 5);
+    }
+    assert(sizes[1] < sizes[0]);
+    // 截断的头部块
+    Buffer buf;
+    encoder.BeginBlock(buf);
+    encoder.Encode(StrView("x-other", 7), StrView("something long enough", 21), buf);
+    HpackDecoder::Field* fields = nullptr;
+    assert(!decoder.Decode(reinterpret_cast<const uint8_t*>(buf.Peek()), buf.ReadableBytes() - 1, &arena, &fields));
+    printf("TestHpack OK\n");
+}
+
+// 客户端发来的一帧（带掩码，负载不超过64KB）
+static std::string MaskedFrame(uint8_t opcode, const std::string& payload) {
+    const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    std::string frame(1, static_cast<char>(0x80 | opcode));
+    if(payload.size() < 126) {
+        frame += static_cast<char>(0x80 | payload.size());
+    } else {
+        frame += static_cast<char>(0x80 | 126);
+        frame += static_cast<char>(payload.size() >> 8);
+        frame += static_cast<char>(payload.size() & 0xff);
+    }
+    frame.append(reinterpret_cast<const char*>(mask), 4);
+    for(size_t i = 0; i < payload.size(); i++) {
+        frame += static_cast<char>(payload[i] ^ mask[i & 3]);
+    }
+    return frame;
+}
+
+// 一条TEXT消息交给新连接处理：回显了原样的消息返回0，发送了CLOSE返回状态码
+static int EchoText(const std::string& text) {
+    WebSocketConfig config;
+    WebSocket ws(&config);
+    Buffer in, out;
+    std::string frame = MaskedFrame(WebSocket::TEXT, text);
+    in.Append(frame.data(), frame.size());
+    ws.Process(in, out);
+    std::string reply(out.Peek(), out.ReadableBytes());
+    if(reply.size() == 4 && static_cast<uint8_t>(reply[0]) == (0x80 | WebSocket::CLOSE)) {
+        return static_cast<uint8_t>(reply[2]) << 8 | static_cast<uint8_t>(reply[3]);
+    }
+    size_t headerLen = text.size() < 126 ? 2 : 4;
+    assert(static_cast<uint8_t>(reply[0]) == (0x80 | WebSocket::TEXT));
+    assert(reply.compare(headerLen, std::string::npos, text) == 0);
+    return 0;
+}
+
+void TestWebSocket() {
+    // RFC 6455 1.3的握手示例
+    Buffer handshake;
+    WebSocket::WriteHandshake(handshake, StrView("dGhlIHNhbXBsZSBub25jZQ==", 24));
+    std::string response(handshake.Peek(), handshake.ReadableBytes());
+    assert(response.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+
+    // 去掩码：16字节一组的部分加上不满16字节的尾巴，起点不对齐时也要和逐字节的结果一样
+    const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    char data[80], expect[80];
+    for(size_t offset = 0; offset < 4; offset++) {
+        for(size_t len = 0; len + offset <= sizeof(data); len++) {
+            for(size_t i = 0; i < sizeof(data); i++) { data[i] = expect[i] = static_cast<char>(i * 31 + len); }
+            for(size_t i = 0; i < len; i++) { expect[offset + i] ^= mask[i & 3]; }
+            WebSocket::Unmask(data + offset, len, mask);
+            assert(memcmp(data, expect, sizeof(data)) == 0);
+        }
+    }
+
+    // UTF-8：合法的一到四字节序列原样回显
+    assert(EchoText("") == 0);
+    assert(EchoText("hello") == 0);
+    assert(EchoText("h\xc3\xa9llo \xe2\x82\xac \xf0\x9d\x84\x9e \xf4\x8f\xbf\xbf") == 0);
+    assert(EchoText(std::string(200, 'a') + "\xe4\xb8\xad") == 0);
+    // 过长编码、代理区、超过U+10FFFF、被截断的序列都按1007关闭
+    assert(EchoText("\xc0\xaf") == WebSocket::INVALID_DATA);
+    assert(EchoText("\xe0\x80\xaf") == WebSocket::INVALID_DATA);
+    assert(EchoText("\xf0\x80\x80\xaf") == WebSocket::INVALID_DATA);
+    assert(EchoText("\xed\xa0\x80") == WebSocket::INVALID_DATA);
+    assert(EchoText("\xed\xbf\xbf") == WebSocket::INVALID_DATA);
+    assert(EchoText("\xf4\x90\x80\x80") == WebSocket::INVALID_DATA);
+    assert(EchoText("\xf5\x80\x80\x80") == WebSocket::INVALID_DATA);
+    assert(EchoText("ok\xe2\x82") == WebSocket::INVALID_DATA);
+    assert(EchoText("\x80") == WebSocket::INVALID_DATA);
+    printf("TestWebSocket OK\n");
+}
+
+// 按step字节一次把请求体喂给解析器（没消耗的部分留到下一次，和读缓冲区一样）
+static MultipartParser::STATE FeedInSteps(MultipartParser* parser, const std::string& body, size_t step) {
+    std::string pending;
+    for(size_t pos = 0; pos < body.size(); pos += step) {
+        pending.append(body, pos, step);
+        bool last = pos + step >= body.size();
+        size_t used = parser->Feed(pending.data(), pending.size(), last);
+        pending.erase(0, used);
+    }
+    return parser->State();
+}
+
+static std::string ReadAll(const std::string& path) {
+    std::string data;
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(!fp) { return data; }
+    char buf[4096];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0) { data.append(buf, n); }
+    fclose(fp);
+    return data;
+}
+
+void TestMultipart() {
+    UploadConfig config;
+    config.dir = "./testupload/";
+    config.splice = false;
+    mkdir(config.dir, 0755);
+    const char* boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+    // 文件内容里面有分隔符的前缀（"\r\n--"、"\r\n------Web"），不能被当成分隔符
+    std::string content = "line1\r\n--not a delimiter\r\n------WebKit\r\n";
+    for(int i = 0; i < 300; i++) { content += static_cast<char>(i * 7); }
+    std::string body = std::string("--") + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+        "hello world\r\n"
+        "--" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"../a b.txt\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n"
+        + content + "\r\n"
+        "--" + boundary + "--\r\n";
+    std::string contentType = std::string("multipart/form-data; boundary=") + boundary;
+    assert(MultipartParser::Boundary(StrView(contentType.data(), contentType.size())) == boundary);
+
+    // 每次1字节、3字节、分隔符长度附近、整个请求体：分隔符和头部在各种位置被切开
+    size_t steps[] = { 1, 3, 7, 39, 41, 64, body.size() };
+    for(size_t step : steps) {
+        MultipartParser parser(StrView(boundary, strlen(boundary)), &config);
+        assert(FeedInSteps(&parser, body, step) == MultipartParser::DONE);
+        const std::vector<MultipartParser::Part>& parts = parser.Parts();
+        assert(parts.size() == 2);
+        assert(parts[0].name == "title" && parts[0].filename.empty() && parts[0].value == "hello world");
+        assert(parts[1].name == "file" && parts[1].filename == "../a b.txt" && parts[1].size == content.size());
+        // 保存的文件在上传目录里面，文件名只剩安全的字符
+        assert(parts[1].value.compare(0, strlen(config.dir), config.dir) == 0);
+        assert(parts[1].value.find("..", strlen(config.dir)) == std::string::npos);
+        assert(ReadAll(parts[1].value) == content);
+        parser.Commit();
+        unlink(parts[1].value.c_str());
+    }
+
+    // 没有结束分隔符：失败，已经写下的文件被删除
+    std::string truncated = body.substr(0, body.size() - 40);
+    {
+        MultipartParser parser(StrView(boundary, strlen(boundary)), &config);
+        assert(FeedInSteps(&parser, truncated, 5) == MultipartParser::FAILED);
+        assert(parser.ErrorCode() == 400);
+    }
+    // 上传目录应当是空的（成功的都删掉了，失败的由解析器删除）
+    int ret = rmdir(config.dir);
+    assert(ret == 0);
+    (void)ret;
+    printf("TestMultipart OK\n");
+}
+
+// 条件请求、Range、Accept-Encoding的测试共用：临时资源目录里面的文件，按给定的请求头解析一个GET请求
+//  再准备好响应（和HttpConn::process()的步骤一样，只是不经过socket）
+static const char* TEST_RES_DIR = "./testres";
+
+static void WriteTestFile(const char* path, const std::string& data) {
+    mkdir(TEST_RES_DIR, 0755);
+    std::string full = std::string(TEST_RES_DIR) + path;
+    FILE* fp = fopen(full.c_str(), "wb");
+    assert(fp);
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+    chmod(full.c_str(), 0644);
+}
+
+struct TestExchange {
+    ServerConfig config;
+    Arena arena;
+    HttpRequest request;
+    HttpResponse response;
+    std::string head;       // WriteHead写出的状态行和响应头
+
+    // 返回Prepare()以后的状态码，headers是若干行"Name: value\r\n"
+    int Get(const char* path, const std::string& headers = "") {
+        arena.Reset();
+        request.Init(&arena, &config);
+        Buffer buf;
+        buf.Append(std::string("GET ") + path + " HTTP/1.1\r\nHost: test\r\n" + headers + "\r\n");
+        assert(request.parse(buf) == HttpRequest::GET_REQUEST);
+        response.Init(&arena, TEST_RES_DIR, request, true);
+        response.Prepare();
+        Buffer out;
+        response.WriteHead(out);
+        head = out.RetrieveAllToStr();
+        return response.Code();
+    }
+
+    bool HasHeader(const std::string& line) const {
+        return head.find("\r\n" + line + "\r\n") != std::string::npos;
+    }
+};
+
+void TestConditional() {
+    WriteTestFile("/cond.txt", "conditional get");
+    TestExchange ex;
+    assert(ex.Get("/cond.txt") == 200);
+    std::string etag = ex.response.ETag().ToString();
+    std::string lastModified = ex.response.LastModified().ToString();
+    assert(etag.size() > 2 && etag.front() == '"' && etag.back() == '"');
+    assert(ex.HasHeader("ETag: " + etag) && ex.HasHeader("Last-Modified: " + lastModified));
+
+    // If-None-Match：单个ETag、列表、"*"，都没有请求体和Content-length
+    assert(ex.Get("/cond.txt", "If-None-Match: " + etag + "\r\n") == 304);
+    assert(ex.head.find("Content-length") == std::string::npos && ex.HasHeader("ETag: " + etag));
+    assert(ex.Get("/cond.txt", "If-None-Match: \"a\", " + etag + "\r\n") == 304);
+    assert(ex.Get("/cond.txt", "If-None-Match: " + etag + ",\"b\"\r\n") == 304);
+    assert(ex.Get("/cond.txt", "If-None-Match: \"a\", \"b\"\r\n") == 200);
+    assert(ex.Get("/cond.txt", "If-None-Match: *\r\n") == 304);
+    // 弱比较：W/前缀不影响匹配，但引号里面的内容必须一样
+    assert(ex.Get("/cond.txt", "If-None-Match: W/" + etag + "\r\n") == 304);
+    assert(ex.Get("/cond.txt", "If-None-Match: W/\"x\" ,\tW/" + etag + " \r\n") == 304);
+    assert(ex.Get("/cond.txt", "If-None-Match: W/\"" + etag.substr(1, etag.size() - 2) + "x\"\r\n") == 200);
+    assert(ex.Get("/cond.txt", "If-None-Match: " + etag.substr(1, etag.size() - 2) + "\r\n") == 200);
+
+    // If-Modified-Since：原样带回、比文件新、比文件旧、不认识的格式
+    assert(ex.Get("/cond.txt", "If-Modified-Since: " + lastModified + "\r\n") == 304);
+    assert(ex.Get("/cond.txt", "If-Modified-Since: Fri, 01 Jan 2100 00:00:00 GMT\r\n") == 304);
+    assert(ex.Get("/cond.txt", "If-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n") == 200);
+    assert(ex.Get("/cond.txt", "If-Modified-Since: yesterday\r\n") == 200);
+
+    // 两个都有时只看If-None-Match
+    assert(ex.Get("/cond.txt", "If-None-Match: \"a\"\r\nIf-Modified-Since: " + lastModified + "\r\n") == 200);
+    assert(ex.Get("/cond.txt", "If-None-Match: " + etag + "\r\nIf-Modified-Since: Thu, 01 Jan 1970 00:00:00 GMT\r\n") == 304);
+    printf("TestConditional OK\n");
+}
+
+// 通过socketpair让HttpConn处理一个请求并把响应全部发完，返回收到的字节（状态行、响应头和响应体）
+static std::string ConnExchange(const ServerConfig& config, const std::string& request) {
+    int fds[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    HttpConn::config = &config;
+    HttpConn::srcDir = TEST_RES_DIR;
+    HttpConn::isET = false;
+    HttpConn conn;
+    sockaddr_in addr = {};
+    conn.init(fds[0], addr);
+    assert(send(fds[1], request.data(), request.size(), 0) == static_cast<ssize_t>(request.size()));
+    int err = 0;
+    assert(conn.read(&err) > 0);
+    assert(conn.process());
+    // 各段依次放上去，最后pendingBytes_也要减到0，否则ToWriteBytes()不会变成0
+    while(conn.ToWriteBytes() > 0) {
+        assert(conn.write(&err) >= 0);
+    }
+    conn.Close();
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while((n = recv(fds[1], buf, sizeof(buf), 0)) > 0) { data.append(buf, n); }
+    close(fds[1]);
+    return data;
+}
+
+void TestRange() {
+    std::string content;
+    for(int i = 0; i < 3000; i++) { content += static_cast<char>('a' + i * 31 % 26); }
+    WriteTestFile("/range.txt", content);
+    TestExchange ex;
+    assert(ex.Get("/range.txt") == 200);
+    std::string etag = ex.response.ETag().ToString();
+    std::string lastModified = ex.response.LastModified().ToString();
+
+    // 后缀：最后N个字节，N超过文件大小时是整个文件
+    assert(ex.Get("/range.txt", "Range: bytes=-100\r\n") == 206);
+    assert(ex.response.RangeCount() == 1 && ex.response.Ranges()[0].offset == 2900 && ex.response.Ranges()[0].len == 100);
+    assert(ex.response.ContentLength() == 100 && ex.HasHeader("Content-Range: bytes 2900-2999/3000"));
+    assert(ex.HasHeader("Content-length: 100"));
+    assert(std::string(ex.response.Content(), 100) == content.substr(2900));
+    assert(ex.Get("/range.txt", "Range: bytes=-5000\r\n") == 206);
+    assert(ex.response.Ranges()[0].offset == 0 && ex.response.Ranges()[0].len == 3000);
+    // 不带结尾、结尾超过文件
+    assert(ex.Get("/range.txt", "Range: bytes=2990-\r\n") == 206);
+    assert(ex.HasHeader("Content-Range: bytes 2990-2999/3000") && ex.response.ContentLength() == 10);
+    assert(ex.Get("/range.txt", "Range: bytes=100-99999\r\n") == 206);
+    assert(ex.HasHeader("Content-Range: bytes 100-2999/3000"));
+
+    // 所有段都在文件外面：416，Content-Range是"bytes */长度"
+    assert(ex.Get("/range.txt", "Range: bytes=3000-\r\n") == 416);
+    assert(ex.response.ContentRange() == "bytes */3000" && ex.HasHeader("Content-Range: bytes */3000"));
+    assert(ex.Get("/range.txt", "Range: bytes=-0\r\n") == 416);
+    assert(ex.Get("/range.txt", "Range: bytes=5000-6000, 3000-3001\r\n") == 416);
+    // 语法不对、不是bytes、段数太多：忽略Range
+    assert(ex.Get("/range.txt", "Range: bytes=abc\r\n") == 200);
+    assert(ex.Get("/range.txt", "Range: bytes=5-1\r\n") == 200);
+    assert(ex.Get("/range.txt", "Range: items=0-1\r\n") == 200);
+    std::string many = "Range: bytes=0-0";
+    for(size_t i = 1; i <= HttpResponse::MAX_RANGES; i++) { many += "," + std::to_string(i * 10) + "-" + std::to_string(i * 10); }
+    assert(ex.Get("/range.txt", many + "\r\n") == 200);
+
+    // If-Range：ETag要完全一样（不接受弱ETag），日期要和Last-Modified一样，否则回复整个文件
+    assert(ex.Get("/range.txt", "Range: bytes=0-9\r\nIf-Range: " + etag + "\r\n") == 206);
+    assert(ex.Get("/range.txt", "Range: bytes=0-9\r\nIf-Range: " + lastModified + "\r\n") == 206);
+    assert(ex.Get("/range.txt", "Range: bytes=0-9\r\nIf-Range: \"nope\"\r\n") == 200);
+    assert(ex.response.RangeCount() == 0 && ex.response.ContentRange().empty() && ex.response.ContentLength() == 3000);
+    assert(ex.Get("/range.txt", "Range: bytes=0-9\r\nIf-Range: W/" + etag + "\r\n") == 200);
+    assert(ex.Get("/range.txt", "Range: bytes=0-9\r\nIf-Range: Thu, 01 Jan 1970 00:00:00 GMT\r\n") == 200);
+
+    // 多段（可以重叠）：multipart/byteranges，每段前面是分段头，最后是结束分隔符
+    assert(ex.Get("/range.txt", "Range: bytes=0-99,50-149,-10\r\n") == 206);
+    assert(ex.response.RangeCount() == 4);
+    std::string type = ex.response.ContentType().ToString();
+    const std::string prefix = "multipart/byteranges; boundary=";
+    assert(type.compare(0, prefix.size(), prefix) == 0);
+    std::string boundary = type.substr(prefix.size());
+    const char* expected[] = { "0-99/3000", "50-149/3000", "2990-2999/3000" };
+    size_t total = 0;
+    for(size_t i = 0; i < 3; i++) {
+        const HttpResponse::Range& r = ex.response.Ranges()[i];
+        assert(r.head.ToString() == "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes "
+                                    + expected[i] + "\r\n\r\n");
+        total += r.head.len + r.len;
+    }
+    const HttpResponse::Range& end = ex.response.Ranges()[3];
+    assert(end.head.ToString() == "\r\n--" + boundary + "--\r\n" && end.len == 0);
+    total += end.head.len;
+    assert(ex.response.ContentLength() == total && ex.HasHeader("Content-length: " + std::to_string(total)));
+    assert(ex.response.ContentRange().empty());
+
+    // 经过HttpConn发送：响应体的字节数和Content-length一致，各段内容正确（writev和sendfile两种发送方式）
+    for(int useSendfile = 0; useSendfile < 2; useSendfile++) {
+        ServerConfig config;
+        config.send.sendfile = useSendfile == 1;
+        config.send.sendfileMinBytes = 1;
+        std::string resp = ConnExchange(config, "GET /range.txt HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+                                                "Range: bytes=0-99,50-149,-10\r\n\r\n");
+        size_t bodyStart = resp.find("\r\n\r\n");
+        assert(resp.compare(0, 24, "HTTP/1.1 206 Partial Con") == 0 && bodyStart != std::string::npos);
+        std::string body = resp.substr(bodyStart + 4);
+        size_t lenPos = resp.find("Content-length: ");
+        assert(lenPos < bodyStart && static_cast<size_t>(atol(resp.c_str() + lenPos + 16)) == body.size());
+        size_t typePos = resp.find("boundary=");
+        assert(typePos < bodyStart);
+        std::string connBoundary = resp.substr(typePos + 9, resp.find("\r\n", typePos) - typePos - 9);
+        std::string want;
+        const size_t offsets[] = { 0, 50, 2990 }, lens[] = { 100, 100, 10 };
+        for(size_t i = 0; i < 3; i++) {
+            want += "\r\n--" + connBoundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes "
+                    + expected[i] + "\r\n\r\n" + content.substr(offsets[i], lens[i]);
+        }
+        want += "\r\n--" + connBoundary + "--\r\n";
+        assert(body == want);
+    }
+    printf("TestRange OK\n");
+}
+
+void TestEncoding() {
+    // 原文件和比它新的预压缩版本（内容不需要真的是压缩数据，只看选中的是哪个文件）
+    std::string script(2000, 'x');
+    WriteTestFile("/enc.js", script);
+    WriteTestFile("/enc.js.br", "br-version");
+    WriteTestFile("/enc.js.gz", "gzip-version!");
+    WriteTestFile("/plain.txt", "no sidecars here");
+    FileCacheConfig cacheConfig;
+    cacheConfig.enable = false;
+    cacheConfig.precompressed = true;
+    FileCache::Instance()->Init(TEST_RES_DIR, cacheConfig);
+
+    TestExchange ex;
+    // 返回选中的Content-Encoding（原文件为""），同时检查Content-length和Content-Type
+    auto negotiate = [&ex, &script](const char* accept) {
+        std::string headers = accept ? std::string("Accept-Encoding: ") + accept + "\r\n" : "";
+        assert(ex.Get("/enc.js", headers) == 200);
+        assert(ex.HasHeader("Content-type: text/javascript"));
+        const char* encoding = ex.response.ContentEncoding();
+        size_t len = !encoding ? script.size() : (strcmp(encoding, "br") == 0 ? 10 : 13);
+        assert(ex.response.ContentLength() == len && ex.HasHeader("Content-length: " + std::to_string(len)));
+        assert(!encoding || ex.HasHeader(std::string("Content-Encoding: ") + encoding));
+        // 有预压缩版本的文件不管选了哪个都要带Vary
+        assert(ex.response.VaryEncoding() && ex.HasHeader("Vary: Accept-Encoding"));
+        return std::string(encoding ? encoding : "");
+    };
+    assert(negotiate(nullptr) == "");
+    assert(negotiate("identity") == "");
+    // 两个都接受时优先br（不管q值大小，只要不是0）
+    assert(negotiate("gzip, deflate, br") == "br");
+    assert(negotiate("gzip;q=1.0, br;q=0.1") == "br");
+    assert(negotiate("gzip") == "gzip");
+    assert(negotiate("GZIP") == "gzip");
+    assert(negotiate("gzip;q=0.001") == "gzip");
+    // q=0表示不接受（0、0.0、0.000都是）
+    assert(negotiate("br;q=0, gzip") == "gzip");
+    assert(negotiate("br; q=0.0, gzip;q=0.5") == "gzip");
+    assert(negotiate("br;q=0.000, gzip;q=0") == "");
+    // "*"代表没有单独列出来的编码
+    assert(negotiate("*") == "br");
+    assert(negotiate("*;q=0") == "");
+    assert(negotiate("*;q=0, gzip") == "gzip");
+    assert(negotiate("br;q=0, *") == "gzip");
+    assert(negotiate("gzip;q=0, br;q=0, *") == "");
+
+    // 没有预压缩版本（也不会动态压缩）的文件：原样发送，不带Vary
+    assert(ex.Get("/plain.txt", "Accept-Encoding: gzip, br\r\n") == 200);
+    assert(!ex.response.ContentEncoding() && !ex.response.VaryEncoding());
+    assert(ex.head.find("Vary:") == std::string::npos && ex.head.find("Content-Encoding") == std::string::npos);
+
+    // 304也带Vary（缓存按Accept-Encoding区分版本），ETag是实际发送的那个文件的
+    assert(ex.Get("/enc.js", "Accept-Encoding: gzip\r\n") == 200);
+    std::string gzipTag = ex.response.ETag().ToString();
+    assert(ex.Get("/enc.js", "Accept-Encoding: br\r\n") == 200 && ex.response.ETag().ToString() != gzipTag);
+    assert(ex.Get("/enc.js", "Accept-Encoding: gzip\r\nIf-None-Match: " + gzipTag + "\r\n") == 304);
+    assert(ex.HasHeader("Vary: Accept-Encoding"));
+    assert(ex.Get("/enc.js", "Accept-Encoding: br\r\nIf-None-Match: " + gzipTag + "\r\n") == 200);
+    printf("TestEncoding OK\n");
+}
+
 void TestLog() {
     int cnt = 0, level = 0;
     Log::Instance()->init(level, "./testlog1", ".log", 0);
@@ -51,6 +706,15 @@ void TestThreadPool() {
 }
 
 int main() {
+    TestArena();
+    TestUri();
+    TestRouter();
+    TestHpack();
+    TestWebSocket();
+    TestMultipart();
+    TestConditional();
+    TestRange();
+    TestEncoding();
     TestLog();
     TestThreadPool();
 }
\ No newline at end of file
@@ -0,0 +1,40 @@
+#!/bin/bash
+# 发送策略（TCP_NODELAY、TCP_CORK）的对比压测：四种组合各启动一次服务器，用webbench压测，
+# 再从服务器日志里统计每个响应平均发出了几个带数据的报文段（连接关闭时记下的responses、segments）。
+#
+#   ./webbench-1.5/sendbench.sh [url] [clients] [seconds]
+#
+# 在项目根目录运行，需要先编译好./bin/server（或者用SERVER环境变量指定）；每种组合在一个临时
+# 目录里运行（resources链接到项目里的资源目录），日志也写在那里，不会动项目里面的./log。
+
+ROOT=$(pwd)
+URL=${1:-http://127.0.0.1:1316/index.html}
+CLIENTS=${2:-100}
+DURATION=${3:-10}
+SERVER=${SERVER:-$ROOT/bin/server}
+WEBBENCH=$ROOT/webbench-1.5/webbench
+
+[ -x "$SERVER" ] || { echo "$SERVER not found, build the server first" >&2; exit 1; }
+[ -x "$WEBBENCH" ] || make -C "$ROOT/webbench-1.5" webbench > /dev/null || exit 1
+
+printf "%-8s %12s %10s %10s %10s\n" options pages/min responses segments segs/resp
+for opts in "" "-C" "-N" "-N -C"; do
+    dir=$(mktemp -d)
+    ln -s "$ROOT/resources" "$dir/resources"
+    (cd "$dir" && exec "$SERVER" $opts) > "$dir/server.out" 2>&1 &
+    pid=$!
+    sleep 1
+    speed=$("$WEBBENCH" -c "$CLIENTS" -t "$DURATION" "$URL" 2>&1 | sed -n 's/^Speed=\([0-9]*\) pages\/min.*/\1/p')
+    sleep 1             # 等异步日志写完
+    kill $pid
+    wait $pid 2> /dev/null
+    cat "$dir"/log/*.log 2> /dev/null | awk -v opts="${opts:-default}" -v speed="${speed:-0}" '
+        / quit, / {
+            for(i = 1; i <= NF; i++) {
+                if($i ~ /^responses:/) { sub(/^responses:/, "", $i); r += $i + 0 }
+                if($i ~ /^segments:/)  { sub(/^segments:/, "", $i); s += $i + 0 }
+            }
+        }
+        END { printf "%-8s %12s %10d %10d %10.2f\n", opts, speed, r, s, r ? s / r : 0 }'
+    rm -rf "$dir"
+done